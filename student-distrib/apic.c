@@ -0,0 +1,295 @@
+#include "apic.h"
+#include "smp.h"
+#include "paging.h"
+#include "idt_common.h"
+#include "clock.h"
+#include "spinlock.h"
+
+/*
+ * Local APIC and IOAPIC. Every cpu's local APIC takes IPIs, its own timer and the
+ * device interrupts the IOAPIC routes to it, and is acknowledged with one MMIO write
+ * instead of the 8259's port I/O. The ISA lines keep their 8259 vectors
+ * (IRQ_OFFSET + irq), all delivered to the BSP, so handlers don't care which
+ * controller they came through. Without an IOAPIC in the tables the 8259 keeps
+ * delivering through the BSP's LINT0, without a calibrated TSC the PIT keeps ticking.
+ */
+
+// ISA IRQ 2 is the 8259 cascade, devices jumpered to it come in on IRQ 9
+#define ISA_CASCADE_IRQ     (2)
+#define ISA_CASCADE_REDIR   (9)
+
+static uint32_t lapic_base = LAPIC_DEFAULT_BASE;
+static bool lapic_present = FALSE;
+// Set once the IOAPIC delivers the ISA interrupts instead of the 8259
+volatile bool ioapic_active = FALSE;
+// Set once the local APIC timers tick instead of the PIT
+bool apic_timer_active = FALSE;
+
+static uint32_t ioapic_base = 0;
+static uint32_t ioapic_gsi_base;
+static uint32_t ioapic_max_redir;
+// The board boots in PIC mode, the IMCR has to be switched over to the APIC
+static bool imcr_present = FALSE;
+// IOAPIC input and polarity/trigger (ISO_* flags) of each ISA IRQ, identity unless overridden
+static uint32_t isa_gsi[NUM_ISA_IRQS] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+static uint32_t isa_flags[NUM_ISA_IRQS];
+// Local APIC timer counts in one scheduler tick (1/PIT_SPEED_HZ), divided by 16
+static uint32_t tick_count;
+// IOREGSEL and IOWIN have to be used in pairs
+static lock_stats_t ioapic_lock_stats = LOCK_STATS_INIT("ioapic");
+static spinlock_t ioapic_lock = SPINLOCK_INIT(ioapic_lock_stats);
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return *(volatile uint32_t*)(lapic_base + reg);
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t val) {
+    *(volatile uint32_t*)(lapic_base + reg) = val;
+}
+
+static inline uint32_t ioapic_read(uint32_t reg) {
+    *(volatile uint32_t*)(ioapic_base + IOAPIC_REGSEL) = reg;
+    return *(volatile uint32_t*)(ioapic_base + IOAPIC_WIN);
+}
+
+static inline void ioapic_write(uint32_t reg, uint32_t val) {
+    *(volatile uint32_t*)(ioapic_base + IOAPIC_REGSEL) = reg;
+    *(volatile uint32_t*)(ioapic_base + IOAPIC_WIN) = val;
+}
+
+/*  apic_set_lapic_base
+    description: records where the local APICs are, called by smp_detect once it knows
+                 the processor has one
+    inputs: addr - physical address from the MP table or MADT
+    output: none
+    side effect: apic_init will turn the local APIC on
+*/
+void apic_set_lapic_base(uint32_t addr) {
+    lapic_base = addr;
+    lapic_present = TRUE;
+}
+
+/*  apic_add_ioapic
+    description: records an IOAPIC found in the tables, only the first one is used
+                 (the one with the ISA lines on every machine we care about)
+    inputs: addr - physical address of its registers
+            gsi_base - first global system interrupt it handles
+    output: none
+    side effect: apic_init will route the ISA interrupts through it
+*/
+void apic_add_ioapic(uint32_t addr, uint32_t gsi_base) {
+    if (ioapic_base != 0) return;
+    ioapic_base = addr;
+    ioapic_gsi_base = gsi_base;
+}
+
+/*  apic_set_pic_mode
+    description: records that the MP table says the board starts in PIC mode, with the
+                 8259 wired straight to the BSP past the local APIC
+    inputs: none
+    output: none
+    side effect: apic_init switches the IMCR over
+*/
+void apic_set_pic_mode(void) {
+    imcr_present = TRUE;
+}
+
+/*  apic_add_override
+    description: records that an ISA IRQ isn't wired to the IOAPIC input of the same
+                 number, or isn't active high edge triggered (the PIT is usually on 2)
+    inputs: irq - ISA IRQ
+            gsi - global system interrupt it comes in on
+            flags - polarity and trigger mode, ISO_* (0 is the ISA default)
+    output: none
+    side effect: changes how apic_init programs the IRQ
+*/
+void apic_add_override(uint32_t irq, uint32_t gsi, uint32_t flags) {
+    if (irq >= NUM_ISA_IRQS) return;
+    isa_gsi[irq] = gsi;
+    isa_flags[irq] = flags;
+}
+
+/*  ioapic_redirect
+    description: programs the IOAPIC input of an ISA IRQ to deliver its 8259 vector to
+                 the BSP
+    inputs: irq - ISA IRQ
+            masked - TRUE to leave it masked
+    output: none
+    side effect: writes the redirection table entry
+*/
+static void ioapic_redirect(uint32_t irq, bool masked) {
+    uint32_t reg = IOAPIC_REDTBL + 2 * (isa_gsi[irq] - ioapic_gsi_base);
+    uint32_t low = IRQ_OFFSET + irq;
+    uint32_t flags;
+    if (isa_gsi[irq] < ioapic_gsi_base || isa_gsi[irq] - ioapic_gsi_base > ioapic_max_redir) return;
+    if ((isa_flags[irq] & ISO_POLARITY_MASK) == ISO_POLARITY_LOW) low |= REDIR_ACTIVE_LOW;
+    if ((isa_flags[irq] & ISO_TRIGGER_MASK) == ISO_TRIGGER_LEVEL) low |= REDIR_LEVEL;
+    if (masked) low |= REDIR_MASKED;
+    spin_lock_irqsave(&ioapic_lock, flags);
+    ioapic_write(reg + 1, cpus[0].apic_id << REDIR_DEST_SHIFT);
+    ioapic_write(reg, low);
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+}
+
+/*  ioapic_enable_irq
+    description: unmasks an ISA IRQ on the IOAPIC, enable_irq once it is active
+    inputs: irq - ISA IRQ
+    output: 0 on success and -1 on fail
+    side effect: the device's interrupts get delivered to the BSP
+*/
+int ioapic_enable_irq(uint32_t irq) {
+    if (irq >= NUM_ISA_IRQS) return -1;
+    if (irq == ISA_CASCADE_IRQ) irq = ISA_CASCADE_REDIR;
+    ioapic_redirect(irq, FALSE);
+    return 0;
+}
+
+/*  ioapic_disable_irq
+    description: masks an ISA IRQ on the IOAPIC, disable_irq once it is active
+    inputs: irq - ISA IRQ
+    output: 0 on success and -1 on fail
+    side effect: the device's interrupts are held back
+*/
+int ioapic_disable_irq(uint32_t irq) {
+    if (irq >= NUM_ISA_IRQS) return -1;
+    if (irq == ISA_CASCADE_IRQ) irq = ISA_CASCADE_REDIR;
+    ioapic_redirect(irq, TRUE);
+    return 0;
+}
+
+/*  calibrate_timer
+    description: counts how fast the local APIC timer runs against the TSC, the bus
+                 clock it runs off isn't reported anywhere
+    inputs: none
+    output: none
+    side effect: sets tick_count and apic_timer_active
+*/
+static void calibrate_timer(void) {
+    uint32_t elapsed;
+    if (clock_tsc_khz() == 0) return;
+    // A software disabled local APIC keeps its LVT masked
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | SPURIOUS_VECTOR);
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_TIMER_INIT, APIC_CALIBRATE_START);
+    clock_udelay(APIC_CALIBRATE_MSECS * USEC_PER_MSEC);
+    elapsed = APIC_CALIBRATE_START - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+    tick_count = elapsed / APIC_CALIBRATE_MSECS * (MSEC_PER_SEC / PIT_SPEED_HZ);
+    apic_timer_active = (tick_count != 0);
+}
+
+/*  apic_init
+    description: turns on the BSP's local APIC and, when the tables listed one, the
+                 IOAPIC with every ISA line masked like i8259_init left them. Runs
+                 with interrupts off, after paging and init_clock and before any
+                 device unmasks its IRQ.
+    inputs: none
+    output: none
+    side effect: enable_irq, disable_irq and send_eoi go to the APICs from here on,
+                 the scheduler ticks on the local APIC timers
+*/
+void apic_init(void) {
+    uint32_t irq;
+    if (!lapic_present) return;
+    map_mmio(lapic_base);
+    if (imcr_present) {
+        outb(IMCR_SELECT, IMCR_ADDR_PORT);
+        outb(IMCR_APIC, IMCR_DATA_PORT);
+    }
+    if (ioapic_base != 0) {
+        map_mmio(ioapic_base);
+        ioapic_max_redir = (ioapic_read(IOAPIC_VER) >> IOAPIC_MAX_REDIR_SHIFT) & IOAPIC_MAX_REDIR_MASK;
+        for (irq = 0; irq < NUM_ISA_IRQS; irq++)
+            ioapic_redirect(irq, TRUE);
+        ioapic_active = TRUE;
+    }
+    calibrate_timer();
+    lapic_enable(TRUE);
+}
+
+/*  lapic_enable
+    description: turns on the local APIC of the calling cpu so it can send and take
+                 IPIs and run its timer. Without an IOAPIC the BSP keeps getting the
+                 8259's interrupts through LINT0 (virtual wire mode), the others never
+                 see them.
+    inputs: bsp - TRUE on the BSP
+    output: none
+    side effect: changes the local APIC's LVT and priority
+*/
+void lapic_enable(bool bsp) {
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | SPURIOUS_VECTOR);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT0, (bsp && !ioapic_active) ? LAPIC_LVT_EXTINT : LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, bsp ? LAPIC_LVT_NMI : LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_TPR, 0);
+    if (apic_timer_active && !PIT_TICKLESS) {
+        // Periodic like the PIT would be, tickless cpus arm one shots instead
+        lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_DIVIDE_16);
+        lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_PERIODIC | TIMER_VECTOR);
+        lapic_write(LAPIC_TIMER_INIT, tick_count);
+    }
+}
+
+/*  lapic_eoi
+    description: acknowledges the interrupt the local APIC delivered (IPIs, its timer,
+                 and devices once the IOAPIC routes them)
+    inputs: none
+    output: none
+    side effect: the APIC can deliver the next one
+*/
+void lapic_eoi(void) {
+    irq_stats_eoi();
+    lapic_write(LAPIC_EOI, 0);
+}
+
+/*  lapic_send
+    description: writes the interrupt command register once the last IPI is out
+    inputs: apic_id - destination
+            command - delivery mode, level and vector
+    output: none
+    side effect: sends the IPI
+*/
+void lapic_send(uint32_t apic_id, uint32_t command) {
+    uint32_t flags;
+    cli_and_save(flags);
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING)
+        asm volatile ("pause");
+    lapic_write(LAPIC_ICR_HIGH, apic_id << ICR_DEST_SHIFT);
+    lapic_write(LAPIC_ICR_LOW, command);
+    restore_flags(flags);
+}
+
+/*  apic_timer_arm
+    description: arms a single TIMER_VECTOR interrupt on the calling cpu usecs from now
+    inputs: usecs - delay, clamped to what the 32 bit counter can count
+    output: the delay actually armed in usecs, less than asked if it was clamped
+    side effect: replaces any tick already armed
+*/
+uint32_t apic_timer_arm(uint32_t usecs) {
+    // Rounded up, so it never fires before usecs went by
+    uint64_t counts = (uint64_t)tick_count * usecs + APIC_TICK_USECS - 1;
+    div64_32(&counts, APIC_TICK_USECS);
+    if (counts == 0) counts = 1;
+    if (counts > APIC_TIMER_MAX_COUNT) {
+        counts = (uint64_t)APIC_TIMER_MAX_COUNT * APIC_TICK_USECS;
+        div64_32(&counts, tick_count);
+        usecs = (uint32_t)counts;
+        counts = APIC_TIMER_MAX_COUNT;
+    }
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, (uint32_t)counts);
+    return usecs;
+}
+
+/*  apic_timer_stop
+    description: cancels the calling cpu's armed tick, if any
+    inputs: none
+    output: none
+    side effect: the timer stops counting
+*/
+void apic_timer_stop(void) {
+    lapic_write(LAPIC_TIMER_INIT, 0);
+}
@@ -0,0 +1,85 @@
+#ifndef _APIC_H
+#define _APIC_H
+
+#include "types.h"
+#include "lib.h"
+
+// Local APIC, memory mapped (uncached) at the base the MP/ACPI tables give
+#define LAPIC_DEFAULT_BASE  (0xFEE00000)
+#define LAPIC_ID            (0x020)
+#define LAPIC_TPR           (0x080)
+#define LAPIC_EOI           (0x0B0)
+#define LAPIC_SVR           (0x0F0)
+#define LAPIC_ESR           (0x280)
+#define LAPIC_ICR_LOW       (0x300)
+#define LAPIC_ICR_HIGH      (0x310)
+#define LAPIC_LVT_TIMER     (0x320)
+#define LAPIC_LVT_LINT0     (0x350)
+#define LAPIC_LVT_LINT1     (0x360)
+#define LAPIC_TIMER_INIT    (0x380)
+#define LAPIC_TIMER_CURRENT (0x390)
+#define LAPIC_TIMER_DIVIDE  (0x3E0)
+#define LAPIC_ID_SHIFT      (24)
+#define LAPIC_SVR_ENABLE    (0x100)
+#define LAPIC_LVT_MASKED    (0x10000)
+#define LAPIC_LVT_PERIODIC  (0x20000)
+#define LAPIC_LVT_EXTINT    (0x700)     // The 8259 delivers through the BSP's LINT0 when there is no IOAPIC
+#define LAPIC_LVT_NMI       (0x400)
+#define LAPIC_DIVIDE_16     (0x3)
+#define ICR_INIT            (0x500)
+#define ICR_STARTUP         (0x600)
+#define ICR_PENDING         (0x1000)
+#define ICR_ASSERT          (0x4000)
+#define ICR_LEVEL           (0x8000)
+#define ICR_DEST_SHIFT      (24)
+
+// IOAPIC, one register window: write the index to IOREGSEL, then use IOWIN
+#define IOAPIC_DEFAULT_BASE (0xFEC00000)
+#define IOAPIC_REGSEL       (0x00)
+#define IOAPIC_WIN          (0x10)
+#define IOAPIC_VER          (0x01)
+#define IOAPIC_REDTBL       (0x10)      // Two registers per input pin
+#define IOAPIC_MAX_REDIR_SHIFT (16)
+#define IOAPIC_MAX_REDIR_MASK  (0xFF)
+#define REDIR_ACTIVE_LOW    (1 << 13)
+#define REDIR_LEVEL         (1 << 15)
+#define REDIR_MASKED        (1 << 16)
+#define REDIR_DEST_SHIFT    (24)
+
+// Interrupt mode configuration register, PIC mode boards route the 8259 through it
+#define IMCR_ADDR_PORT      (0x22)
+#define IMCR_DATA_PORT      (0x23)
+#define IMCR_SELECT         (0x70)
+#define IMCR_APIC           (0x01)
+
+// ISA interrupt source overrides (MP interrupt entries / MADT type 2 flags)
+#define NUM_ISA_IRQS        (16)
+#define ISO_POLARITY_MASK   (0x3)
+#define ISO_POLARITY_LOW    (0x3)
+#define ISO_TRIGGER_MASK    (0xC)
+#define ISO_TRIGGER_LEVEL   (0xC)
+
+// Measure the local APIC timer against the TSC for this long
+#define APIC_CALIBRATE_MSECS (10)
+#define APIC_CALIBRATE_START (0xFFFFFFFF)
+#define APIC_TICK_USECS     (USEC_PER_MSEC * (MSEC_PER_SEC / PIT_SPEED_HZ))  // What tick_count counts
+#define APIC_TIMER_MAX_COUNT (0xFFFFFFFF)
+#define MSEC_PER_SEC        (1000)
+
+extern volatile bool ioapic_active;
+extern bool apic_timer_active;
+
+void apic_set_lapic_base(uint32_t addr);
+void apic_add_ioapic(uint32_t addr, uint32_t gsi_base);
+void apic_set_pic_mode(void);
+void apic_add_override(uint32_t irq, uint32_t gsi, uint32_t flags);
+void apic_init(void);
+void lapic_enable(bool bsp);
+void lapic_eoi(void);
+void lapic_send(uint32_t apic_id, uint32_t command);
+int ioapic_enable_irq(uint32_t irq);
+int ioapic_disable_irq(uint32_t irq);
+uint32_t apic_timer_arm(uint32_t usecs);
+void apic_timer_stop(void);
+
+#endif
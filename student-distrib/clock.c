@@ -0,0 +1,160 @@
+#include "clock.h"
+#include "rtc.h"
+
+static uint32_t tsc_khz;	// TSC frequency, 0 if calibration failed
+static uint32_t tsc_mult;	// ns = cycles * tsc_mult >> CLOCK_SHIFT
+static uint64_t tsc_base;	// TSC at calibration, time 0 of the clock
+
+// Its own page, so mapping it for user space shows nothing else
+static uint8_t time_page_mem[FOUR_KILOBYTES] __attribute__((aligned(FOUR_KILOBYTES)));
+static time_page_t* const time_page = (time_page_t*)time_page_mem;
+
+/*  div64_32
+	description: divides a 64 bit number by a 32 bit one without libgcc, two divl's
+	inputs: n - dividend, replaced by the quotient
+			divisor - not 0
+	output: the remainder
+	side effect: modifies *n
+*/
+uint32_t div64_32(uint64_t* n, uint32_t divisor) {
+	uint32_t high = (uint32_t)(*n >> 32);
+	uint32_t low = (uint32_t)*n;
+	uint32_t rem = high % divisor;
+	uint32_t quot_high = high / divisor;
+	// rem < divisor, so the quotient of rem:low fits in 32 bits
+	asm volatile ("divl %4" : "=a"(low), "=d"(rem) : "0"(low), "1"(rem), "rm"(divisor));
+	*n = ((uint64_t)quot_high << 32) | low;
+	return rem;
+}
+
+/*  init_clock
+	description: measures how many TSC cycles CALIBRATE_MSECS of PIT channel 2 take,
+				 which gives the TSC frequency for the nanosecond clock
+	inputs: none
+	output: none
+	side effect: busy waits CALIBRATE_MSECS, uses PIT channel 2 with the speaker off,
+				 publishes the result on the time page and maps it for user space
+*/
+void init_clock(void) {
+	uint32_t flags, polls = 0;
+	uint8_t gate;
+	uint64_t start, cycles;
+	cli_and_save(flags);
+	gate = inb(PIT_GATE_PORT);
+	outb((gate & ~PIT_SPEAKER_EN) | PIT_CHL_2_GATE, PIT_GATE_PORT);
+	outb(PIT_CHL_2_ONESHOT, COMMAND_REG);
+	outb((uint8_t)(CALIBRATE_COUNT & R_V_LOW_MASK), PIT_CHL_2);
+	outb((uint8_t)((CALIBRATE_COUNT & R_V_HIGH_MASK) >> SHIFT_VALUE), PIT_CHL_2);
+	start = rdtsc();
+	// OUT2 goes high when the count reaches 0
+	while (!(inb(PIT_GATE_PORT) & PIT_CHL_2_OUT) && ++polls < CALIBRATE_MAX_POLLS);
+	cycles = rdtsc() - start;
+	outb(gate, PIT_GATE_PORT);
+	restore_flags(flags);
+
+	tsc_base = start;
+	if (polls == CALIBRATE_MAX_POLLS || cycles < CALIBRATE_MSECS) {
+		// No usable PIT or TSC, clock_ns falls back on the RTC
+		tsc_khz = 0;
+	} else {
+		div64_32(&cycles, CALIBRATE_MSECS);
+		tsc_khz = (uint32_t)cycles;
+		cycles = (uint64_t)NSEC_PER_MSEC << CLOCK_SHIFT;
+		div64_32(&cycles, tsc_khz);
+		tsc_mult = (uint32_t)cycles;
+	}
+
+	time_page->seq = 0;
+	time_page->ticks = timer_now();
+	time_page->tick_hz = MAX_FREQ;
+	time_page->tsc_khz = tsc_khz;
+	time_page->tsc_mult = tsc_mult;
+	time_page->tsc_shift = CLOCK_SHIFT;
+	time_page->tsc_base_low = (uint32_t)tsc_base;
+	time_page->tsc_base_high = (uint32_t)(tsc_base >> 32);
+	map_time_page((uint32_t)time_page_mem);
+}
+
+/*  clock_tick
+	description: publishes the RTC tick count on the time page, called from
+				 timer_interrupt (so it only keeps up without a TSC, when the RTC
+				 interrupts all the time)
+	inputs: ticks - RTC clock
+	output: none
+	side effect: bumps the time page's seq twice
+*/
+void clock_tick(uint32_t ticks) {
+	time_page->seq++;
+	asm volatile ("" : : : "memory");	// keep the stores in order for readers
+	time_page->ticks = ticks;
+	asm volatile ("" : : : "memory");
+	time_page->seq++;
+}
+
+/*  clock_tsc_khz
+	description: gets the calibrated TSC frequency
+	inputs: none
+	output: kHz, 0 if the TSC is not used
+	side effect: none
+*/
+uint32_t clock_tsc_khz(void) {
+	return tsc_khz;
+}
+
+/*  clock_udelay
+	description: busy waits on the TSC, for when interrupts are off or the RTC is not
+				 ticking yet (starting other processors)
+	inputs: usecs - how long to wait
+	output: none
+	side effect: spins, at least usecs (assumes a 4 GHz TSC if it is not calibrated)
+*/
+void clock_udelay(uint32_t usecs) {
+	uint32_t khz = (tsc_khz == 0) ? UDELAY_FALLBACK_KHZ : tsc_khz;
+	uint64_t cycles = (uint64_t)usecs * (khz / USEC_PER_MSEC);
+	uint64_t start = rdtsc();
+	while (rdtsc() - start < cycles)
+		asm volatile ("pause");
+}
+
+/*  cycles_to_ns
+	description: converts a TSC cycle count to nanoseconds
+	inputs: cycles - TSC difference
+	output: the same duration in ns, 0 if the TSC is not calibrated
+	side effect: none
+*/
+uint64_t cycles_to_ns(uint64_t cycles) {
+	uint32_t high = (uint32_t)(cycles >> 32);
+	uint32_t low = (uint32_t)cycles;
+	// 32x32 multiplies only, (high:low * mult) >> shift done in two halves
+	return (((uint64_t)high * tsc_mult) << (32 - CLOCK_SHIFT)) +
+		(((uint64_t)low * tsc_mult) >> CLOCK_SHIFT);
+}
+
+/*  clock_ns
+	description: monotonic clock
+	inputs: none
+	output: ns since boot (since calibration), at RTC tick resolution if the
+			TSC could not be calibrated
+	side effect: none
+*/
+uint64_t clock_ns(void) {
+	if (tsc_khz == 0)
+		return ((uint64_t)timer_now() * NSEC_PER_SEC) >> RTC_FREQ_SHIFT;
+	return cycles_to_ns(rdtsc() - tsc_base);
+}
+
+/*  system_clock_gettime
+	description: clock_gettime syscall, reads the monotonic clock
+	inputs: clock_id - CLOCK_MONOTONIC, the only clock there is
+			ts - user timespec to fill in
+	output: 0 on success, -1 on a bad clock or pointer
+	side effect: none
+*/
+int32_t system_clock_gettime(int32_t clock_id, timespec_t* ts) {
+	if (clock_id != CLOCK_MONOTONIC) return -1;
+	if ((uint32_t)ts < IN_MB(8) || ts == NULL) return -1;
+	uint64_t ns = clock_ns();
+	ts->tv_nsec = div64_32(&ns, NSEC_PER_SEC);
+	ts->tv_sec = (uint32_t)ns;
+	return 0;
+}
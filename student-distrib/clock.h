@@ -0,0 +1,69 @@
+#ifndef _CLOCK_H
+#define _CLOCK_H
+
+#include "types.h"
+#include "lib.h"
+#include "pit.h"
+#include "timer.h"
+#include "paging.h"
+
+// PIT channel 2 is free (it would drive the speaker), we time the TSC with it
+#define PIT_CHL_2			(0x42)
+#define PIT_CHL_2_ONESHOT	(0xB0)	// Channel 2, lo/hi byte, mode 0
+#define PIT_GATE_PORT		(0x61)
+#define PIT_CHL_2_GATE		(0x01)
+#define PIT_SPEAKER_EN		(0x02)
+#define PIT_CHL_2_OUT		(0x20)
+#define PIT_BASE_HZ			(1193182)
+
+#define CALIBRATE_MSECS		(10)
+#define CALIBRATE_COUNT		(PIT_BASE_HZ / 1000 * CALIBRATE_MSECS)
+#define CALIBRATE_MAX_POLLS	(1000000)	// Give up if channel 2 never counts down
+
+// cycles to ns is a multiply and a shift, tsc_mult = (NSEC_PER_MSEC << CLOCK_SHIFT) / tsc_khz.
+// 22 keeps tsc_mult in 32 bits down to a 1 MHz TSC
+#define CLOCK_SHIFT			(22)
+#define NSEC_PER_USEC		(1000)
+#define NSEC_PER_MSEC		(1000000)
+#define NSEC_PER_SEC		(1000000000)
+#define USEC_PER_MSEC		(1000)
+#define USEC_PER_SEC		(1000000)
+#define UDELAY_FALLBACK_KHZ	(4000000)
+
+#define CLOCK_MONOTONIC		(1)
+
+// Layout shared with user space (ece391_timespec_t)
+typedef struct {
+	uint32_t tv_sec;
+	uint32_t tv_nsec;
+} timespec_t;
+
+/*
+ * time_page_t : read only page at TIME_PAGE_VIRT in every process (ece391_time_page_t
+ *				 in user space), enough to compute clock_ns without a syscall.
+ *				 seq is odd while the kernel is updating, readers retry until they
+ *				 see the same even seq before and after reading.
+ */
+typedef struct {
+	volatile uint32_t seq;
+	uint32_t ticks;			// RTC ticks since boot, as of the last timer interrupt
+	uint32_t tick_hz;		// MAX_FREQ
+	uint32_t tsc_khz;		// 0 if the TSC is not calibrated, use clock_gettime then
+	uint32_t tsc_mult;		// ns = (tsc - tsc_base) * tsc_mult >> tsc_shift
+	uint32_t tsc_shift;
+	uint32_t tsc_base_low;
+	uint32_t tsc_base_high;
+} time_page_t;
+
+void init_clock(void);
+void clock_tick(uint32_t ticks);
+uint32_t clock_tsc_khz(void);
+void clock_udelay(uint32_t usecs);
+uint64_t cycles_to_ns(uint64_t cycles);
+uint64_t clock_ns(void);
+uint32_t div64_32(uint64_t* n, uint32_t divisor);
+
+// Syscall handler
+int32_t system_clock_gettime(int32_t clock_id, timespec_t* ts);
+
+#endif
@@ -279,7 +279,7 @@ int32_t file_open(const uint8_t * name) {
     uint32_t fd;
     ret = get_available_fd(pcb, &fd);
 
-    if (ret != 0 || pcb->files[fd].flags != 0) return -1;
+    if (ret != 0) return -1;
 
     file_t newfile; //sets all flags for files after taking an empty file and setting attributes to global open file
     newfile.file_ops.open = file_open;
@@ -393,7 +393,7 @@ int32_t dir_open(const uint8_t * name) {
     uint32_t fd;
     ret = get_available_fd(pcb, &fd);
 
-    if (ret != 0 || pcb->files[fd].flags != 0) return -1;
+    if (ret != 0) return -1;
 
     // Copy the found dentry's contents into the open_dir variable
     file_t newfile;
@@ -515,7 +515,7 @@ int32_t rtc_open(const uint8_t * name) {
     uint32_t fd;
     ret = get_available_fd(pcb, &fd);
 
-    if (ret != 0 || pcb->files[fd].flags != 0) return -1;
+    if (ret != 0) return -1;
 
     file_t newfile; //sets all flags for files after taking an empty file and setting attributes to global open file
     newfile.file_ops.open = rtc_open;
@@ -556,6 +556,33 @@ int32_t rtc_close(int32_t fd) {
 }
 
 
+/* irqstats_open
+ * description: Open the interrupt stats, a virtual file not in the filesystem image
+ * input:
+ * 	name - Should always be IRQ_STATS_FILE
+ * output:
+ *	The FD of the new file, or -1 on failure
+ * side effects: Initializes a new file as the interrupt stats
+*/
+int32_t irqstats_open(const uint8_t * name) {
+    pcb_t * pcb = get_current_pcb();
+    uint32_t fd;
+    if (get_available_fd(pcb, &fd) != 0) return -1;
+
+    file_t newfile;
+    newfile.file_ops.open = irqstats_open;
+    newfile.file_ops.close = rtc_close;     // Nothing to release either
+    newfile.file_ops.read = irq_stats_read;
+    newfile.file_ops.write = irq_stats_write;
+    newfile.inode = 0;
+    newfile.f_pos = 0;
+    newfile.flags = 1;
+
+    pcb->files[fd] = newfile;
+
+    return fd;
+}
+
 int32_t sb16_open(const uint8_t * name){
     if (name == NULL) return -1;    //performing invalid name and file type checks
 
@@ -569,7 +596,7 @@ int32_t sb16_open(const uint8_t * name){
     uint32_t fd;
     ret = get_available_fd(pcb, &fd);
 
-    if (ret != 0 || pcb->files[fd].flags != 0) return -1;
+    if (ret != 0) return -1;
 
     file_t newfile; //sets all flags for files after taking an empty file and setting attributes to global open file
     newfile.file_ops.open = sb16_open;
@@ -612,7 +639,6 @@ int32_t sb16_write(int32_t fd, int8_t * data, uint32_t len){
 }
 
 int32_t sb16_read(int32_t fd, int8_t * buf, uint32_t count){
-    while (!got_dsp_int);
-    got_dsp_int = 0;
+    sb16_wait_int();
     return 0;
 }
@@ -93,6 +93,8 @@ int32_t file_read(int32_t fd, int8_t * buf, uint32_t count);
 int32_t rtc_open(const uint8_t * name);
 int32_t rtc_close(int32_t fd);
 
+int32_t irqstats_open(const uint8_t * name);
+
 int32_t dir_open(const uint8_t * name);
 int32_t dir_close(int32_t fd);
 int32_t dir_write(int32_t fd, int8_t * data, uint32_t len);
@@ -4,6 +4,8 @@
 
 #include "i8259.h"
 #include "lib.h"
+#include "apic.h"
+#include "idt_common.h"
 
 /* Interrupt masks to determine which interrupts are enabled and disabled */
 uint8_t master_mask; /* IRQs 0-7  */
@@ -57,11 +59,14 @@ void i8259_init(void) {
 	description: enables irq line on specified pic
 	inputs: irq line number
 	output:	0 on success and -1 on fail
-	side effect: writes to pic and enables irq line
+	side effect: writes to pic and enables irq line, or the IOAPIC once it took over
 */
 int enable_irq(uint32_t irq_num) {
 	uint16_t port;	//which port will be accessed
 	uint8_t mask;	//mask to be passed
+	uint32_t flags;
+	// the pics stay fully masked, the ioapic delivers the same vectors
+	if (ioapic_active) return ioapic_enable_irq(irq_num);
 	// check if irq num is in bounds
 	if(irq_num > 15 || irq_num < 0 ){
 		//do this exception
@@ -77,6 +82,8 @@ int enable_irq(uint32_t irq_num) {
 		//master irq line
 		port = MASTER_DATA_PORT;		//sets port to master port
 	}
+	//a nested handler could change the mask between our inb and outb
+	cli_and_save(flags);
 	mask = inb(port); 					//current masking in specifed pic
 	mask &= ~(1 << irq_num);			//sets irq_num in mask to zero
 	outb(mask, port);
@@ -85,6 +92,7 @@ int enable_irq(uint32_t irq_num) {
 		mask &= ~(1 << SLAVE_IRQ_LINE_NUM);	//sets corresponding bit to 0 in mask
 		outb(mask, MASTER_DATA_PORT);
 	}
+	restore_flags(flags);
 	return 0;
 }
 
@@ -93,11 +101,14 @@ int enable_irq(uint32_t irq_num) {
 	description: disables irq line on complementary pic
 	inputs: irq line number
 	output:	0 on success and -1 on fail
-	side effect: writes to pic mask register and masks a specifed irq line
+	side effect: writes to pic mask register and masks a specifed irq line, or the
+	             IOAPIC once it took over
 */
 int disable_irq(uint32_t irq_num) {
 	uint16_t port;	//which port will be accessed
 	uint8_t mask;	//mask to be passed
+	uint32_t flags;
+	if (ioapic_active) return ioapic_disable_irq(irq_num);
 	// check if irq num is in bounds
 	if(irq_num > 15 || irq_num < 0 ){
 		//do this exception
@@ -113,6 +124,7 @@ int disable_irq(uint32_t irq_num) {
 		//master irq line
 		port = MASTER_DATA_PORT;	//sets port to master port
 	}
+	cli_and_save(flags);
 	mask = inb(port); //current masking in specifed pic
 	mask |= 1 << irq_num; // set irq_num in mask to 1 to disable
 	outb(mask, port);
@@ -121,6 +133,7 @@ int disable_irq(uint32_t irq_num) {
 		mask |= 1 << SLAVE_IRQ_LINE_NUM;	//sets corresponding bit to 1 in mask
 		outb(mask, MASTER_DATA_PORT);
 	}
+	restore_flags(flags);
 	return 0;
 }
 
@@ -129,9 +142,15 @@ int disable_irq(uint32_t irq_num) {
 	description: sends an end of interrupt command to corresponding pic
 	inputs: irq line number that is issuing the eoi
 	output: 0 on success and -1 on fail
-	side effect: writes eoi "0x60" OR'ed with irq num to corresponding pic
+	side effect: writes eoi "0x60" OR'ed with irq num to corresponding pic, or
+	             acknowledges the local APIC (one mmio write) once the IOAPIC took over
 */
 int send_eoi(uint32_t irq_num) {
+	irq_stats_eoi();
+	if (ioapic_active) {
+		lapic_eoi();
+		return 0;
+	}
 	// check if irq num is in bounds
 	if(irq_num > 15 || irq_num < 0 ){
 		//do this exception
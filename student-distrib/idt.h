@@ -55,6 +55,11 @@ extern void irq2B(void);
 extern void irq2C(void);
 extern void irq2D(void);
 extern void irq2E(void);
+extern void irq30(void);
+extern void irq31(void);
+extern void irq32(void);
+extern void irq33(void);
+extern void irqFF(void);
 extern void irq80(void);
 
 
@@ -1,8 +1,20 @@
 #include "idt_common.h"
+#include "clock.h"
+#include "sb16.h"
 
 // Holds the interrupt handlers corresponding to each IDT entry
 static irq_desc IRQhandlers[NUM_VEC];
 
+uint32_t device_irqs = 0;
+uint32_t all_irqs = 0;
+
+// Per cpu stack device handlers run on, a pcb_t header at the bottom of each
+static uint8_t irq_stacks[MAX_CPUS][IRQ_STACK_SIZE] __attribute__((aligned(IRQ_STACK_SIZE)));
+
+// What do_IRQ measured per vector since boot or the last write to the irqstats file. The
+// tick vectors come in without the kernel lock, on every cpu at once, so theirs can miss a few.
+static irq_stats_t irq_stats[NUM_VEC];
+
 static handler_t serviceRoutines[] = {
     irq00, irq01, irq02, irq03, irq04, irq05, irq06, irq07, irq08, irq09,
     irq0A, irq0B, irq0C, irq0D, irq0E, irq0F, irq10, irq11, irq12, irq13,
@@ -21,6 +33,7 @@ static handler_t serviceRoutines[] = {
 void setupIDT(void)
 {
     int i; // Iterator
+    pcb_t* header;
 
     // First initialize the IRQhandler array and mark all IDT entries as
     // not present by default
@@ -43,10 +56,53 @@ void setupIDT(void)
     setTrap(SYSCALL_GATE, irq80);
     idt[SYSCALL_GATE].dpl = USER_PERMISSION;
 
+    // Same syscalls through sysenter, for CPUs that have it
+    init_sysenter();
+
+    // Scheduler and inter-processor vectors, the spurious one only irets
+    setInt(RESCHED_VECTOR, irq30);
+    setInt(YIELD_VECTOR, irq31);
+    setInt(TLB_VECTOR, irq32);
+    setInt(TIMER_VECTOR, irq33);
+    setInt(SPURIOUS_VECTOR, irqFF);
+    idt[SPURIOUS_VECTOR].present = 1;
+
     // For the PIT, RTC, and keyboard, reference their specific handlers
 	setIRQhandler(PIT_IRQ, &schedulerHandler);
     setIRQhandler(RTC_IRQ, &RTCHandler);
     setIRQhandler(KEY_IRQ, &keyboardHandler);
+    setIRQhandler(RESCHED_VECTOR, &reschedHandler);
+    setIRQhandler(YIELD_VECTOR, &yieldHandler);
+    setIRQhandler(TLB_VECTOR, &tlbHandler);
+    setIRQhandler(TIMER_VECTOR, &apicTimerHandler);
+
+    // Nothing runs on an interrupt stack for a process, see get_current_pcb
+    for (i = 0; i < MAX_CPUS; i++) {
+        header = (pcb_t*)irq_stacks[i];
+        memset(header, 0, sizeof(pcb_t));
+        header->process_id = KTHREAD_PCB_MARK;
+        header->parent_id = -1;
+        header->tid = HEADLESS_TTY;
+    }
+}
+
+/*
+    init_sysenter
+	description: points the SYSENTER MSRs at sysenter_entry. The GDT has the kernel
+               code and data, then user code and data, right where sysenter and
+               sysexit expect them next to KERNEL_CS. Every cpu runs this for itself.
+	inputs: none
+	output: none
+	side effect: enables the sysenter syscall path, does nothing without SEP
+*/
+void init_sysenter(void)
+{
+    if (!(cpuid_edx(CPUID_FEATURES) & CPUID_EDX_SEP))
+        return;
+    wrmsr(MSR_SYSENTER_CS, KERNEL_CS);
+    // Not a stack, sysenter_entry reads this cpu's esp0 out of the TSS it points at
+    wrmsr(MSR_SYSENTER_ESP, (uint32_t)this_cpu()->tss);
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
 }
 
 
@@ -132,15 +188,85 @@ extern void setIRQhandler(int vec, handler_t handler)
   }
 }
 
+/*
+    close_irq_frame
+	description: charges the time since an interrupt came in to its handler
+	inputs: frame: the interrupt
+            now: low half of the TSC
+	output: none
+	side effect: changes irq_stats
+*/
+static void close_irq_frame(irq_frame_t* frame, uint32_t now)
+{
+    irq_stats_t* stats = &irq_stats[frame->vec];
+    uint32_t cycles = now - frame->entry_tsc;
+    stats->handler_cycles += cycles;
+    if (cycles > stats->handler_max) stats->handler_max = cycles;
+    frame->closed = TRUE;
+}
+
+/*
+    record_latency
+	description: puts the time since an interrupt came in into its vector's histogram
+	inputs: frame: the interrupt
+	output: none
+	side effect: changes irq_stats
+*/
+static void record_latency(irq_frame_t* frame)
+{
+    uint32_t cycles = (uint32_t)rdtsc() - frame->entry_tsc;
+    uint32_t bucket = 0;
+    while (cycles >>= 1)
+        bucket++;
+    irq_stats[frame->vec].latency[bucket]++;
+}
+
+/*
+    run_device_handler
+	description: runs a device's handler with interrupts on, only its own line masked,
+                 so the PIT and other devices can come in on top of it. Handlers that
+                 switch jobs can't run like this, see schedule.
+	inputs: vec: a PIC/IOAPIC vector
+	output: none
+	side effect: acknowledges the interrupt before the handler runs, may run
+                 nested interrupts and then the scheduler
+*/
+static void run_device_handler(int vec)
+{
+    uint32_t line = vec - IRQ_OFFSET;
+    cpu_t* cpu = this_cpu();
+    irq_frame_t* frame = cpu->irq_frame;
+    disable_irq(line);
+    // The early EOI only lets other lines in, the line is done when it's unmasked
+    frame->eoi_done = TRUE;
+    send_eoi(line);
+    cpu->irq_depth++;
+    // Only the outermost one moves to the interrupt stack
+    call_irq_handler(IRQhandlers[vec].handler,
+        (cpu->irq_depth == 1) ? (uint32_t)&irq_stacks[this_cpu_id()][IRQ_STACK_SIZE] : 0);
+    cpu->irq_depth--;
+    // Nested interrupts put cpu->irq_frame back, a device handler never switches jobs
+    record_latency(frame);
+    enable_irq(line);
+    // Back on the job's stack, a tick that came in meanwhile can switch jobs now
+    if (cpu->irq_depth == 0 && cpu->need_resched) {
+        cpu->need_resched = FALSE;
+        irq_resched();
+    }
+}
+
 /*
     do_IRQ
-	description: Execute a specific IRQ handlers
+	description: Execute a specific IRQ handlers, timing it for irq_stats_read
 	inputs: vec: Vector into the IDT (with the offset of 0x20 to skip exceptions)
+            entry_tsc: low half of the TSC when common_interrupt was entered
 	output: -1 on failure, 0 on success
 	side effect: Performs an interrupt handler, and sends EOI to PIC
 */
-extern unsigned int do_IRQ(int vec)
+extern unsigned int do_IRQ(int vec, uint32_t entry_tsc)
 {
+    irq_frame_t frame;
+    cpu_t* cpu;
     // Since each ISR pushed the exact bitflip of its number, bitflip it back
     // To restore the original IRQ number
     vec = ~vec;
@@ -151,13 +277,188 @@ extern unsigned int do_IRQ(int vec)
     if (IRQhandlers[vec].handler == NULL) {
         return -1;
     }
-    // If we have a valid handler, execute it
-    (*IRQhandlers[vec].handler)();
+    // The scheduler counts its own (PIT) interrupts, yields and IPIs aren't devices
+    if (vec >= IRQ_OFFSET && vec < IRQ_OFFSET + NUM_PIC_VEC && vec != PIT_IRQ) device_irqs++;
+    all_irqs++;
+    irq_stats[vec].count++;
+    cpu = this_cpu();
+    frame.vec = vec;
+    frame.entry_tsc = entry_tsc;
+    frame.eoi_done = FALSE;
+    frame.closed = FALSE;
+    frame.prev = cpu->irq_frame;
+    cpu->irq_frame = &frame;
+    // Devices nest, the PIT, APIC timer, IPIs and yields run with interrupts off
+    // (they switch jobs) and send their own EOI
+    if (vec < NUM_PIC_VEC + IRQ_OFFSET && vec >= IRQ_OFFSET && vec != PIT_IRQ) {
+        run_device_handler(vec);
+    } else {
+        (*IRQhandlers[vec].handler)();
+    }
+    // Already accounted for if the handler switched jobs, maybe we're on another cpu now
+    if (!frame.closed) {
+        close_irq_frame(&frame, (uint32_t)rdtsc());
+        this_cpu()->irq_frame = frame.prev;
+    }
+    return 0;
+}
+
+/*
+    irq_stats_eoi
+	description: records how long the interrupt being handled on this cpu took to
+                 get acknowledged, send_eoi and lapic_eoi call it. Nested device
+                 handlers record theirs at unmask instead, see run_device_handler
+	inputs: none
+	output: none
+	side effect: changes irq_stats
+*/
+void irq_stats_eoi(void)
+{
+    irq_frame_t* frame = this_cpu()->irq_frame;
+    if (frame == NULL || frame->eoi_done) return;
+    frame->eoi_done = TRUE;
+    record_latency(frame);
+}
+
+/*
+    irq_stats_switch
+	description: closes the interrupts being handled on this cpu right before it
+                 switches jobs, whatever runs next isn't their handlers' time
+	inputs: none
+	output: none
+	side effect: changes irq_stats, this cpu is handling no interrupt afterwards
+*/
+void irq_stats_switch(void)
+{
+    cpu_t* cpu = this_cpu();
+    irq_frame_t* frame;
+    uint32_t now = (uint32_t)rdtsc();
+    for (frame = cpu->irq_frame; frame != NULL; frame = frame->prev)
+        close_irq_frame(frame, now);
+    cpu->irq_frame = NULL;
+}
+
+/*
+    irq_name
+	description: gets what a vector is for, as shown in the irqstats file
+	inputs: vec: Vector into the IDT
+	output: a short name
+	side effect: none
+*/
+static const int8_t* irq_name(uint32_t vec)
+{
+    if (vec == PIT_IRQ) return "pit";
+    if (vec == KEY_IRQ) return "keyboard";
+    if (vec == RTC_IRQ) return "rtc";
+    if (vec == IRQ_OFFSET + sb_pic_line) return "sb16";
+    if (vec == RESCHED_VECTOR) return "resched";
+    if (vec == YIELD_VECTOR) return "yield";
+    if (vec == TLB_VECTOR) return "tlb";
+    if (vec == TIMER_VECTOR) return "apic timer";
+    return "irq";
+}
 
-    // If our interrupt came from the PIC, send it an EOI
-    if (vec < NUM_PIC_VEC + IRQ_OFFSET && vec >= IRQ_OFFSET) {
-        send_eoi(vec - IRQ_OFFSET);
+/*
+    append_str, append_num
+	description: add to the text irq_stats_read builds, dropping what doesn't fit
+	inputs: pos: where the text ends so far, moved past what was added
+            end: end of the buffer
+            str/num: what to add
+	output: none
+	side effect: writes to the buffer
+*/
+static void append_str(int8_t** pos, int8_t* end, const int8_t* str)
+{
+    while (*str != '\0' && *pos < end)
+        *(*pos)++ = *str++;
+}
+
+static void append_num(int8_t** pos, int8_t* end, uint32_t num)
+{
+    int8_t digits[IRQ_NUM_DIGITS];
+    append_str(pos, end, itoa(num, digits, 10));
+}
+
+/*
+    build_irq_stats
+	description: writes the irqstats text, a line per vector that came in with its
+                 count and handler cycles, then the latency histogram: entry to EOI,
+                 or to unmask for the nested device handlers
+	inputs: buf: where to put it, IRQ_STATS_BUF_SIZE bytes
+	output: its length
+	side effect: none
+*/
+static uint32_t build_irq_stats(int8_t* buf)
+{
+    int8_t* pos = buf;
+    int8_t* end = buf + IRQ_STATS_BUF_SIZE;
+    int8_t hex[IRQ_NUM_DIGITS];
+    irq_stats_t* stats;
+    uint64_t avg;
+    uint32_t vec, i;
+    append_str(&pos, end, "vec name count avg max (cycles), latency log2:count to eoi (devices: to unmask)\n");
+    for (vec = IRQ_OFFSET; vec < NUM_VEC; vec++) {
+        stats = &irq_stats[vec];
+        if (stats->count == 0) continue;
+        avg = stats->handler_cycles;
+        div64_32(&avg, stats->count);
+        append_str(&pos, end, "0x");
+        append_str(&pos, end, itoa(vec, hex, 16));
+        append_str(&pos, end, " ");
+        append_str(&pos, end, irq_name(vec));
+        append_str(&pos, end, " ");
+        append_num(&pos, end, stats->count);
+        append_str(&pos, end, " ");
+        append_num(&pos, end, (uint32_t)avg);
+        append_str(&pos, end, " ");
+        append_num(&pos, end, stats->handler_max);
+        append_str(&pos, end, ",");
+        for (i = 0; i < IRQ_HIST_BUCKETS; i++) {
+            if (stats->latency[i] == 0) continue;
+            append_str(&pos, end, " ");
+            append_num(&pos, end, i);
+            append_str(&pos, end, ":");
+            append_num(&pos, end, stats->latency[i]);
+        }
+        append_str(&pos, end, "\n");
     }
+    return pos - buf;
+}
+
+/*
+    irq_stats_read
+	description: read for the irqstats file, the text is taken at the start of the
+                 file and read in pieces from there (one reader at a time)
+	inputs: fd: the file
+            buf: where to read to
+            count: bytes wanted
+	output: bytes read, 0 at the end
+	side effect: advances the file position
+*/
+int32_t irq_stats_read(int32_t fd, int8_t* buf, uint32_t count)
+{
+    static int8_t text[IRQ_STATS_BUF_SIZE];
+    static uint32_t length;
+    file_t* file = &get_current_pcb()->files[fd];
+    if (buf == NULL) return -1;
+    if (file->f_pos == 0) length = build_irq_stats(text);
+    if (file->f_pos >= length) return 0;
+    if (count > length - file->f_pos) count = length - file->f_pos;
+    memcpy(buf, text + file->f_pos, count);
+    file->f_pos += count;
+    return count;
+}
+
+/*
+    irq_stats_write
+	description: write for the irqstats file, any write starts counting over
+	inputs: ignored
+	output: 0
+	side effect: clears irq_stats
+*/
+int32_t irq_stats_write(int32_t fd, int8_t* buf, uint32_t count)
+{
+    memset(irq_stats, 0, sizeof(irq_stats));
     return 0;
 }
 
@@ -10,12 +10,26 @@
 #include "syscall.h"
 #include "colors.h"
 #include "scheduler.h"
+#include "smp.h"
 
 
 #define NUM_EXCEPT      (32) // Number of exception spaces, Defined in the IA32 manual pg 5-1
 #define IRQ_OFFSET      (0x20) // Where IRQ entries start on the IDT
 #define NUM_PIC_VEC     (15)   // Number of IRQ lines associated with the PIC
 #define SYSCALL_GATE    (0x80)
+// Vectors past the PIC's that the local APIC and the scheduler use
+#define RESCHED_VECTOR  (0x30)  // IPI, run the scheduler as if the PIT fired
+#define YIELD_VECTOR    (0x31)  // int from scheduler_yield
+#define TLB_VECTOR      (0x32)  // IPI, a shared page table changed
+#define TIMER_VECTOR    (0x33)  // Local APIC timer, the scheduler tick when there is one
+#define SPURIOUS_VECTOR (0xFF)  // Local APIC spurious interrupts, ignored
+
+// SYSENTER/SYSEXIT setup, see init_sysenter
+#define CPUID_FEATURES      (1)
+#define CPUID_EDX_SEP       (1 << 11)
+#define MSR_SYSENTER_CS     (0x174)
+#define MSR_SYSENTER_ESP    (0x175)
+#define MSR_SYSENTER_EIP    (0x176)
 #define EXCEPT_RET_VAL  (255)   // Value passed to system_halt from the exception handler (arbitrary)
 
 #define USER_PERMISSION  (3)
@@ -30,6 +44,16 @@ enum except_type{
     none
 };
 
+// Interrupt stats, see irq_stats_read
+#define IRQ_STATS_FILE      "irqstats"  // Virtual file, not in the filesystem image
+#define IRQ_HIST_BUCKETS    (32)        // log2 of the cycles
+#define IRQ_STATS_BUF_SIZE  (4096)
+#define IRQ_NUM_DIGITS      (12)
+
+// Device handlers run here, same size and alignment as a kernel stack so
+// get_current_pcb finds the header at the bottom
+#define IRQ_STACK_SIZE      (8192)
+
 // IDT entry handlers that do not return and take no arguments
 typedef void (*handler_t) (void);
 
@@ -43,6 +67,23 @@ typedef struct {
     handler_t handler;
 } irq_desc;
 
+// What do_IRQ measured for one vector, all in TSC cycles
+typedef struct {
+    uint32_t count;
+    uint64_t handler_cycles;    // From entry to the handler returning (or switching jobs)
+    uint32_t handler_max;
+    uint32_t latency[IRQ_HIST_BUCKETS];  // Entry to EOI, or to unmask for devices, bucket i is [2^i, 2^(i+1))
+} irq_stats_t;
+
+// One interrupt being handled on a cpu, lives on do_IRQ's stack
+typedef struct irq_frame {
+    uint32_t vec;
+    uint32_t entry_tsc;         // Low half of the TSC in common_interrupt
+    bool eoi_done;
+    bool closed;                // Accounted for, the job switched away or the handler returned
+    struct irq_frame* prev;     // Interrupt this one interrupted
+} irq_frame_t;
+
 // All of the fields defining an exception
 typedef struct {
     const char* msg; // Exception Message
@@ -55,10 +96,27 @@ void setupIDT(void);
 void setTrap(int num, handler_t routine);
 void setInt(int num, handler_t routine);
 void setIRQhandler(int vec, handler_t handler);
+void init_sysenter(void);
+
+// Fast syscall entry in idt.S
+extern void sysenter_entry(void);
+// Runs a device handler with interrupts on, switching to stack_top unless it is 0
+extern void call_irq_handler(handler_t handler, uint32_t stack_top);
 
 // Wrapper functions for Interrupts and Exceptions
 void do_exception(except_args args);
-unsigned int do_IRQ(int vec);
+unsigned int do_IRQ(int vec, uint32_t entry_tsc);
+
+// Interrupt stats
+void irq_stats_eoi(void);
+void irq_stats_switch(void);
+int32_t irq_stats_read(int32_t fd, int8_t* buf, uint32_t count);
+int32_t irq_stats_write(int32_t fd, int8_t* buf, uint32_t count);
+
+// Device interrupts (PIC lines but the PIT) since the scheduler stats were reset
+extern uint32_t device_irqs;
+// Every interrupt do_IRQ ran (timers, RTC, IPIs, yields and devices), same window
+extern uint32_t all_irqs;
 
 
 
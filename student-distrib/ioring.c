@@ -0,0 +1,299 @@
+#include "ioring.h"
+
+// Submission and completion ring pages, per ring
+static uint8_t ioring_pages[IORING_MAX_RINGS][2][FOUR_KILOBYTES] __attribute__((aligned(FOUR_KILOBYTES)));
+
+static ioring_t iorings[IORING_MAX_RINGS];
+static lock_stats_t ioring_lock_stats = LOCK_STATS_INIT("ioring");
+
+/* init_iorings
+ * description: marks every ring free and sets up its lock
+ * input: none
+ * output: none
+ * side effects: none
+ */
+void init_iorings(void) {
+    int32_t i;
+    for (i = 0; i < IORING_MAX_RINGS; i++) {
+        spin_lock_init(&iorings[i].lock, &ioring_lock_stats);
+        init_wait_queue(&iorings[i].work_wait);
+        init_wait_queue(&iorings[i].cq_wait);
+        iorings[i].pid = IORING_NO_PID;
+        iorings[i].alive = FALSE;
+        iorings[i].workers = 0;
+    }
+}
+
+/* find_ioring
+ * description: gets the ring a process set up
+ * input:
+ * 	pid - owner
+ * output:
+ *	the ring, NULL if it has none
+ * side effects: none
+ */
+static ioring_t* find_ioring(int32_t pid) {
+    int32_t i;
+    uint32_t flags;
+    bool found;
+    for (i = 0; i < IORING_MAX_RINGS; i++) {
+        spin_lock_irqsave(&iorings[i].lock, flags);
+        found = (iorings[i].pid == pid && iorings[i].alive);
+        spin_unlock_irqrestore(&iorings[i].lock, flags);
+        // Only pid itself sets up or releases its ring, this stays true
+        if (found) return &iorings[i];
+    }
+    return NULL;
+}
+
+/* post_cqe
+ * description: completes a request. The ring's lock must be held.
+ * input:
+ * 	ring - its ring
+ *  user_data - from the request
+ *  res - result
+ * output: none
+ * side effects: wakes the owner if it waits for completions
+ */
+static void post_cqe(ioring_t* ring, uint32_t user_data, int32_t res) {
+    io_cqe_t* cqe = &ring->cq->entries[ring->cq_tail & IORING_MASK];
+    cqe->user_data = user_data;
+    cqe->res = res;
+    ring->cq_tail++;
+    ring->cq->tail = ring->cq_tail;
+    ring->in_flight--;
+    wake_up(&ring->cq_wait);
+}
+
+/* ioring_timeout_fn
+ * description: timer callback completing a timeout request
+ * input:
+ * 	timer - the io_timeout_t's timer
+ * output: none
+ * side effects: posts a completion with res 0
+ */
+static void ioring_timeout_fn(ktimer_t* timer) {
+    io_timeout_t* timeout = (io_timeout_t*)timer;
+    ioring_t* ring = timeout->ring;
+    uint32_t flags;
+    spin_lock_irqsave(&ring->lock, flags);
+    // Fired while its owner was halting, nobody wants the completion
+    if (timeout->in_use && ring->alive)
+        post_cqe(ring, timeout->user_data, 0);
+    timeout->in_use = FALSE;
+    spin_unlock_irqrestore(&ring->lock, flags);
+}
+
+/* ioring_worker
+ * description: worker thread body, runs reads and writes off the work FIFO on behalf
+ *              of the ring's owner (it acts as that process, see kthread_create)
+ * input:
+ * 	arg - the ring
+ * output: none
+ * side effects: blocks in drivers like the process would have
+ */
+static void ioring_worker(void* arg) {
+    ioring_t* ring = (ioring_t*)arg;
+    io_sqe_t sqe;
+    int32_t res;
+    uint32_t flags;
+
+    spin_lock_irqsave(&ring->lock, flags);
+    while (ring->alive) {
+        if (ring->work_head == ring->work_tail) {
+            sleep_on_locked(&ring->work_wait, &ring->lock);
+            continue;
+        }
+        sqe = ring->work[ring->work_head & IORING_MASK];
+        ring->work_head++;
+        ring->busy++;
+        spin_unlock_irqrestore(&ring->lock, flags);
+        // Drivers and fd tables still count on the big kernel lock, the rest of
+        // the loop is covered by the ring's
+        kernel_lock();
+        if (sqe.opcode == IORING_OP_READ)
+            res = system_read(sqe.fd, (void*)sqe.addr, sqe.len);
+        else
+            res = system_write(sqe.fd, (void*)sqe.addr, sqe.len);
+        kernel_unlock();
+        spin_lock_irqsave(&ring->lock, flags);
+        ring->busy--;
+        if (ring->alive) {
+            post_cqe(ring, sqe.user_data, res);
+        } else if (ring->busy == 0) {
+            // The owner halted while we ran it, nobody wants the result. The last
+            // one done gives back the pid halt left to us.
+            release_pid(ring->pid);
+            ring->pid = IORING_NO_PID;
+        }
+    }
+    ring->workers--;
+    // Exits with interrupts off, like it always did
+    spin_unlock(&ring->lock);
+    kthread_exit();
+}
+
+/* system_ioring_setup
+ * description: gives the calling process a submission and a completion ring, mapped
+ *              at IORING_VIRT and IORING_VIRT + 4kb, and starts its workers
+ * input:
+ * 	addr - user pointer that gets IORING_VIRT
+ * output:
+ *	0 on success, -1 if it already has one or there are no rings or threads left
+ * side effects: maps two pages into the process
+ */
+int32_t system_ioring_setup(uint8_t** addr) {
+    if ((uint32_t)addr < IN_MB(8) || addr == NULL) return -1;
+    pcb_t* pcb = get_current_pcb();
+    int32_t i, idx;
+    uint32_t flags;
+    ioring_t* ring;
+
+    if (find_ioring(pcb->process_id) != NULL) return -1;
+    // Rings of dead processes are only free once their workers are gone. Taking the
+    // pid while it isn't alive yet keeps the ring ours and out of find_ioring.
+    for (idx = 0; idx < IORING_MAX_RINGS; idx++) {
+        ring = &iorings[idx];
+        spin_lock_irqsave(&ring->lock, flags);
+        if (ring->pid == IORING_NO_PID && ring->workers == 0) {
+            ring->pid = pcb->process_id;
+            spin_unlock_irqrestore(&ring->lock, flags);
+            break;
+        }
+        spin_unlock_irqrestore(&ring->lock, flags);
+    }
+    if (idx == IORING_MAX_RINGS) return -1;
+    ring->sq = (io_sq_t*)ioring_pages[idx][0];
+    ring->cq = (io_cq_t*)ioring_pages[idx][1];
+    memset(ring->sq, 0, FOUR_KILOBYTES);
+    memset(ring->cq, 0, FOUR_KILOBYTES);
+    ring->sq_head = ring->cq_tail = 0;
+    ring->in_flight = ring->busy = 0;
+    ring->work_head = ring->work_tail = 0;
+    for (i = 0; i < IORING_ENTRIES; i++)
+        ring->timeouts[i].in_use = FALSE;
+    spin_lock_irqsave(&ring->lock, flags);
+    ring->alive = TRUE;
+    for (i = 0; i < IORING_WORKERS; i++) {
+        if (kthread_create(ioring_worker, ring, pcb->process_id) == 0)
+            ring->workers++;
+    }
+    if (ring->workers == 0) {
+        ring->alive = FALSE;
+        ring->pid = IORING_NO_PID;
+        spin_unlock_irqrestore(&ring->lock, flags);
+        return -1;
+    }
+    map_shm_page(pcb->process_id, IORING_VIRT, (uint32_t)ring->sq);
+    map_shm_page(pcb->process_id, IORING_VIRT + FOUR_KILOBYTES, (uint32_t)ring->cq);
+    spin_unlock_irqrestore(&ring->lock, flags);
+    *addr = (uint8_t*)IORING_VIRT;
+    return 0;
+}
+
+/* submit_sqe
+ * description: takes one request off the submission ring. The ring's lock must be held.
+ * input:
+ * 	ring - ring to take from, must have a submission and room for its completion
+ *  sqe - copy of the request
+ * output: none
+ * side effects: timeouts are armed, reads and writes are handed to the workers
+ */
+static void submit_sqe(ioring_t* ring, io_sqe_t* sqe) {
+    int32_t i;
+    ring->in_flight++;
+    switch (sqe->opcode) {
+        case IORING_OP_READ:
+        case IORING_OP_WRITE:
+            ring->work[ring->work_tail & IORING_MASK] = *sqe;
+            ring->work_tail++;
+            wake_up(&ring->work_wait);
+            return;
+        case IORING_OP_TIMEOUT:
+            // At most IORING_ENTRIES are in flight, so one is always free
+            for (i = 0; i < IORING_ENTRIES && ring->timeouts[i].in_use; i++);
+            ring->timeouts[i].in_use = TRUE;
+            ring->timeouts[i].ring = ring;
+            ring->timeouts[i].user_data = sqe->user_data;
+            init_timer(&ring->timeouts[i].timer, ioring_timeout_fn, NULL);
+            add_timer(&ring->timeouts[i].timer, msecs_to_ticks(sqe->len));
+            return;
+        case IORING_OP_NOP:
+            post_cqe(ring, sqe->user_data, 0);
+            return;
+        default:
+            post_cqe(ring, sqe->user_data, -1);
+            return;
+    }
+}
+
+/* system_ioring_enter
+ * description: submits requests from the submission ring and waits for completions
+ * input:
+ * 	to_submit - how many submissions to take at most
+ *  min_complete - return once this many completions are waiting to be reaped
+ * output:
+ *	number of completions waiting, -1 if the process has no ring
+ * side effects: blocks until min_complete completions are there. Submissions that
+ *               would overflow the completion ring stay put until the next call.
+ */
+int32_t system_ioring_enter(int32_t to_submit, int32_t min_complete) {
+    ioring_t* ring = find_ioring(get_current_pcb()->process_id);
+    if (ring == NULL) return -1;
+    uint32_t flags, ready;
+    io_sqe_t sqe;
+
+    spin_lock_irqsave(&ring->lock, flags);
+    while (to_submit-- > 0 && ring->sq_head != ring->sq->tail) {
+        // Every completion needs a free slot when it is posted
+        if (ring->cq_tail - ring->cq->head + ring->in_flight >= IORING_ENTRIES) break;
+        sqe = ring->sq->entries[ring->sq_head & IORING_MASK];
+        ring->sq_head++;
+        ring->sq->head = ring->sq_head;
+        submit_sqe(ring, &sqe);
+    }
+    while ((ready = ring->cq_tail - ring->cq->head) < (uint32_t)min_complete && ring->in_flight > 0)
+        sleep_on_locked(&ring->cq_wait, &ring->lock);
+    spin_unlock_irqrestore(&ring->lock, flags);
+    return ready;
+}
+
+/* ioring_release
+ * description: tears down a halting process' ring without waiting for it. Pending
+ *              timeouts and queued requests are dropped, requests a worker is
+ *              running are cancelled and their completions dropped. Until those
+ *              workers are done they may still use the process' memory, so the
+ *              last of them gives its pid back instead of halt.
+ * input:
+ * 	pid - halting process
+ * output:
+ *	TRUE if workers still run requests and will release pid, FALSE if halt should
+ * side effects: unmaps the ring pages, wakes the workers
+ */
+bool ioring_release(int32_t pid) {
+    ioring_t* ring = find_ioring(pid);
+    if (ring == NULL) return FALSE;
+    uint32_t flags;
+    int32_t i;
+    bool busy;
+
+    // Only we arm them, and del_timer waits for a callback that takes the ring's
+    // lock, so this goes first and without it
+    for (i = 0; i < IORING_ENTRIES; i++)
+        del_timer(&ring->timeouts[i].timer);
+    spin_lock_irqsave(&ring->lock, flags);
+    ring->alive = FALSE;
+    for (i = 0; i < IORING_ENTRIES; i++)
+        ring->timeouts[i].in_use = FALSE;
+    // Queued work is dropped, idle workers see alive is gone and exit
+    ring->work_head = ring->work_tail;
+    wake_up(&ring->work_wait);
+    // Busy ones stop waiting on the driver (e.g: for a line nobody will type)
+    kthread_cancel(pid);
+    unmap_shm_page(pid, IORING_VIRT);
+    unmap_shm_page(pid, IORING_VIRT + FOUR_KILOBYTES);
+    busy = (ring->busy > 0);
+    if (!busy) ring->pid = IORING_NO_PID;
+    spin_unlock_irqrestore(&ring->lock, flags);
+    return busy;
+}
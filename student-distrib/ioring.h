@@ -0,0 +1,103 @@
+#ifndef _IORING_H
+#define _IORING_H
+
+#include "types.h"
+#include "lib.h"
+#include "paging.h"
+#include "syscall.h"
+#include "scheduler.h"
+#include "timer.h"
+
+#define IORING_ENTRIES		(32)	// Power of 2, per ring
+#define IORING_MASK			(IORING_ENTRIES - 1)
+#define IORING_MAX_RINGS	(2)
+#define IORING_WORKERS		(3)		// Blocking requests a ring can have in flight at once
+// Past the shared memory segments in the process' shm page table
+#define IORING_VIRT			(SHM_VIRT_BASE + IN_MB(2))
+#define IORING_NO_PID		(-1)
+
+#define IORING_OP_NOP		(0)
+#define IORING_OP_READ		(1)		// read(fd, addr, len)
+#define IORING_OP_WRITE		(2)		// write(fd, addr, len)
+#define IORING_OP_TIMEOUT	(3)		// completes with 0 after len milliseconds
+
+/*
+ * io_sqe_t : a request, written by the process into the submission ring.
+ * io_cqe_t : its completion, written by the kernel into the completion ring,
+ *			  res is what the read or write returned.
+ * Same layout as ece391_io_sqe_t/ece391_io_cqe_t in user space.
+ */
+typedef struct {
+	uint32_t opcode;
+	int32_t fd;
+	uint32_t addr;
+	uint32_t len;
+	uint32_t user_data;	// Handed back in the completion
+} io_sqe_t;
+
+typedef struct {
+	uint32_t user_data;
+	int32_t res;
+} io_cqe_t;
+
+/*
+ * io_sq_t / io_cq_t : one page each, shared with the process. The producer only moves
+ *					   tail and the consumer only moves head, both count up forever and
+ *					   index entries mod IORING_ENTRIES. The process produces
+ *					   submissions, the kernel produces completions.
+ */
+typedef struct {
+	volatile uint32_t head;
+	volatile uint32_t tail;
+	io_sqe_t entries[IORING_ENTRIES];
+} io_sq_t;
+
+typedef struct {
+	volatile uint32_t head;
+	volatile uint32_t tail;
+	io_cqe_t entries[IORING_ENTRIES];
+} io_cq_t;
+
+struct ioring;
+
+// A timeout request waiting on a kernel timer
+typedef struct {
+	ktimer_t timer;		// First, so the timer callback can cast back
+	struct ioring* ring;
+	uint32_t user_data;
+	bool in_use;
+} io_timeout_t;
+
+/*
+ * ioring_t : kernel side of a process' rings. Submissions are copied out of the
+ *			  shared page by ioring_enter, timeouts go on the timer wheel and reads and
+ *			  writes onto the work FIFO for the ring's worker threads, which run them
+ *			  through the process' file_ops as if the process had called read/write.
+ */
+typedef struct ioring {
+	spinlock_t lock;		// Covers everything below but what the process owns in sq and cq
+	int32_t pid;			// Owner, IORING_NO_PID when free. Kept after it halts until busy is 0.
+	bool alive;
+	io_sq_t* sq;
+	io_cq_t* cq;
+	uint32_t sq_head;		// Our copies, the process can't be trusted with them
+	uint32_t cq_tail;
+	uint32_t in_flight;		// Taken from the SQ, not completed yet
+	uint32_t busy;			// Of those, being run by a worker right now
+	uint32_t workers;		// Worker threads that haven't exited
+	io_sqe_t work[IORING_ENTRIES];
+	uint32_t work_head;
+	uint32_t work_tail;
+	io_timeout_t timeouts[IORING_ENTRIES];
+	wait_queue_t work_wait;	// Idle workers
+	wait_queue_t cq_wait;	// The process waiting for completions
+} ioring_t;
+
+void init_iorings(void);
+bool ioring_release(int32_t pid);
+
+// Syscall handlers
+int32_t system_ioring_setup(uint8_t** addr);
+int32_t system_ioring_enter(int32_t to_submit, int32_t min_complete);
+
+#endif
@@ -18,6 +18,14 @@
 #include "syscall.h"
 #include "sb16.h"
 #include "scheduler.h"
+#include "shm.h"
+#include "pipe.h"
+#include "timer.h"
+#include "clock.h"
+#include "ioring.h"
+#include "workqueue.h"
+#include "smp.h"
+#include "apic.h"
 
 #define RUN_TESTS
 
@@ -157,11 +165,17 @@ void entry(unsigned long magic, unsigned long addr) {
     setupIDT();
     // printf("Done\n");
 
+    /* Find the other processors while the BIOS tables are reachable without paging */
+    smp_detect();
+
     /*  Initialize Paging */
     // printf("Initializing paging... ");
     init_paging();
     // printf("Done\n");
 	init_user_vidmem();
+	init_shm();
+	init_pipes();
+	init_iorings();
 
     /* Initialize the filesystem */
     // printf("Initializing filesystem... ");
@@ -175,8 +189,14 @@ void entry(unsigned long magic, unsigned long addr) {
 
     /* Initialize devices - These also unmask themselves on the PIC */
     // printf("Initializing RTC... ");
+	init_clock();
+	/* Local APIC and IOAPIC take over from the PIC when there are any, devices
+	   unmask themselves on whichever is in charge */
+	apic_init();
 	init_pit();
 	init_scheduling();
+	init_workqueues();
+	init_timers();
     init_RTC();
     // printf("Done\n");
 
@@ -226,16 +246,25 @@ void entry(unsigned long magic, unsigned long addr) {
 #endif
 
     // Schedule our three jobs
-    schedule_job((uint8_t*)"shell 0", NULL, 0, FALSE);
-    schedule_job((uint8_t*)"shell 1", NULL, 1, FALSE);
-	schedule_job((uint8_t*)"shell 2", NULL, 2, FALSE);
+    schedule_job((uint8_t*)"shell 0", NULL, 0, FALSE, NULL);
+    schedule_job((uint8_t*)"shell 1", NULL, 1, FALSE, NULL);
+	schedule_job((uint8_t*)"shell 2", NULL, 2, FALSE, NULL);
 
 	clear();
 	setcursor(0, 0);
 
+	/* Start the other processors, everything they share is set up by now */
+	cli();
+	smp_init();
+
+#ifdef RUN_TESTS
+    /* Run the tests that need the other processors online */
+     //launch_smp_tests();
+#endif
+
 	/* Enable interrupts */
 	sti();
 
-    /* Spin (nicely, so we don't chew up cycles) */
-    asm volatile (".1: hlt; jmp .1;");
+    /* Become the idle job (halts, so we don't chew up cycles) */
+    idle_loop();
 }
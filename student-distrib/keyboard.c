@@ -1,5 +1,6 @@
 #include "keyboard.h"
 #include "terminal.h"
+#include "workqueue.h"
 
 // Key mappings
 int scan_map[SCAN_NUM] = {
@@ -28,6 +29,20 @@ uint8_t rshift_pressed = FALSE;
 uint8_t ctrl_pressed = FALSE;
 uint8_t alt_pressed = FALSE;
 
+// Scan codes the interrupt handler captured and keyboard_work hasn't handled yet.
+// Single producer (the handler, keyboard interrupts don't nest) and single consumer
+// (keyboard_work), so no lock: only the handler moves tail and only the work moves
+// head, each after the slot it owns is done with. x86 doesn't reorder stores with
+// stores or loads with loads, keeping the compiler from doing it is enough.
+static uint8_t scancodes[SCANCODE_BUFF_SIZE];
+static volatile uint32_t scancodes_head = 0;
+static volatile uint32_t scancodes_tail = 0;
+// Scan codes that came in with the ring full, never expected at this size
+static uint32_t scancodes_dropped = 0;
+static work_t keyboard_work;
+
+#define compiler_barrier()	asm volatile ("" : : : "memory")
+
 /*
   updateState
 	description: Updates above state vars
@@ -142,6 +157,14 @@ int shortcutHandler(int code){
     int key = scan_map[code];
 
     /* Actual System Shortcuts */
+    // SHIFT-PGUP/PGDN scroll the terminal back through what scrolled off it
+    if ((key == KEY_PAGE_UP || key == KEY_PAGE_DOWN) && (lshift_pressed || rshift_pressed)) {
+        if (key == KEY_PAGE_UP)
+            scrollback_view(ttys[tid].scrollback_view + SCROLLBACK_STEP);
+        else
+            scrollback_view((int32_t)ttys[tid].scrollback_view - SCROLLBACK_STEP);
+        return 1;
+    }
     // CTRL-L Clears the screen and resert the cursor
     if (key == 'l' && ctrl_pressed && !alt_pressed) {
         setcursor(0,0);
@@ -194,6 +217,11 @@ int shortcutHandler(int code){
 		ttys[tid].history_pos = 0;
 		ttys[tid].history_viewer = 0;
 		ttys[tid].history_size = 0;
+	} else if (key == 's' && ctrl_pressed && alt_pressed && KEY_DEBUG) {
+		// CTRL-ALT-S prints (and resets) scheduler latency and overhead, and lock use
+		print_sched_stats();
+		print_lock_stats();
+		return 1;
 	}
 
     // Default
@@ -400,24 +428,32 @@ int backspaceHandle(void) {
 
 /*
   keyboard_handler_helper
-	description: see keyboardHandler description
-	inputs: none
+	description: Handles one key press or release, see keyboardHandler description
+	inputs: code - scan code read from the keyboard
 	output: none
-	side effect: Reads from keyboard and writes to screen and changes state vars
+	side effect: Writes to screen and changes state vars
 */
-void keyboard_handler_helper(void){
-    // Get scan code from the keyboard
-    uint8_t code = inb(KEYBOARD_SCAN_CODE_PORT);
+void keyboard_handler_helper(uint8_t code){
+    uint32_t flags;
 
     // First update state vars and check if its not a shortcut,
     // if it updates or is a shortcut, we are done
     int updated = updateState(code);
+    // Shortcuts can switch terminals, which must not be preempted halfway
+    spin_lock_irqsave(&tty_switch_lock, flags);
     int shortcuted = shortcutHandler(code);
+    // Keep printing wherever the switch left us
+    get_current_pcb()->tid = tid;
+    spin_unlock_irqrestore(&tty_switch_lock, flags);
     if (updated || shortcuted) return;
 
     // Key unpresses only matter for state vars & shortcuts
     if (code >= UNPRESS_OFFSET) return;
 
+    // Typing goes back to the screen
+    if (ttys[tid].scrollback_view)
+        scrollback_view(0);
+
     // Check if its a 'normal' character
     int character = (int)getPrintableKey(code);
 
@@ -524,6 +560,8 @@ void keyboard_handler_helper(void){
         // Print char, add to buff
         putc((char)character);
         ttys[tid].keyboard_buff[ttys[tid].current_size++] = (char) character;
+        // A reader could start waiting right as we look
+        spin_lock_irqsave(&ttys[tid].lock, flags);
         // Flush buffer (but not really, there's no point. Security?)
         if (ttys[tid].read_pending == FALSE)  {
             ttys[tid].current_size = 0;
@@ -531,7 +569,9 @@ void keyboard_handler_helper(void){
         } else {
             // Set entered flag for terminal read and wait for it to copy
             ttys[tid].returned = TRUE;
+            terminal_wake_reader(tid);
         }
+        spin_unlock_irqrestore(&ttys[tid].lock, flags);
 		ttys[tid].clear_num = 0;
     } else {
         // If possible add to buff, otherwise ignore keypress
@@ -542,28 +582,67 @@ void keyboard_handler_helper(void){
     }
 }
 
+/*
+  keyboard_work_fn
+	description: Handles the captured scan codes in order, run by the system work
+				 queue's thread with interrupts on
+	inputs: work - keyboard_work
+	output: none
+	side effect: Writes to the active terminal and changes state vars
+*/
+static void keyboard_work_fn(work_t* work){
+	pcb_t* self = get_current_pcb();
+	uint32_t flags, head;
+	uint8_t code;
+	for (head = scancodes_head; head != scancodes_tail; head++) {
+		code = scancodes[head & SCANCODE_BUFF_MASK];
+		// Read the slot before handing it back to the handler
+		compiler_barrier();
+		scancodes_head = head + 1;
+		// Make sure key strokes echo to the active terminal, not preemptible
+		cli_and_save(flags);
+		if (self->tid != tid) {
+			if (self->tid != HEADLESS_TTY) get_vidmem(self->tid);
+			self->tid = tid;
+			set_vidmem(tid);
+		}
+		restore_flags(flags);
+		keyboard_handler_helper(code);
+	}
+}
+
 /*
   keyboardHandler
-	description: Handles interrupts from the keyboard (key presses and releases)
+	description: Handles interrupts from the keyboard (key presses and releases),
+				 only captures the scan code and leaves the rest to keyboard_work
 	inputs: none
 	output: none
-	side effect: Reads from keyboard and writes to screen and changes state vars
+	side effect: Reads from keyboard, wakes the system work queue
 */
 void keyboardHandler(void){
-	cli(); // Don't want to stack keyboard interrupts
-
-	// Make sure key stroke echos to active terminal
-    get_vidmem(get_current_pcb()->tid);
-	set_vidmem(tid);
-
-	// Call the actual handler
-	keyboard_handler_helper();
-
-	// Change putc's routing back to the current job
-	get_vidmem(tid);
-	set_vidmem(get_current_pcb()->tid);
+	// Get scan code from the keyboard
+	uint8_t code = inb(KEYBOARD_SCAN_CODE_PORT);
+	uint32_t tail = scancodes_tail;
+	if (tail - scancodes_head < SCANCODE_BUFF_SIZE) {
+		scancodes[tail & SCANCODE_BUFF_MASK] = code;
+		// The slot has to be filled before keyboard_work can see it
+		compiler_barrier();
+		scancodes_tail = tail + 1;
+	} else {
+		scancodes_dropped++;
+	}
+	schedule_work(&keyboard_work);
+}
 
-    // The syscall handler will IRET to restore interrupts for us
+/*
+  keyboard_dropped
+	description: gets how many scan codes were lost to a full ring since boot
+	inputs: none
+	output: the count
+	side effect: none
+*/
+uint32_t keyboard_dropped(void){
+	return scancodes_dropped;
 }
 
 /*
@@ -592,6 +671,7 @@ void init_keyboard(void){
   	// //set keyboard to scanning so it sends interrupts
   	// outb(SET_SCANNING, KEYBOARD_SCAN_CODE_PORT);
 
+	init_work(&keyboard_work, keyboard_work_fn, NULL);
   	// Unmask the keyboard's IRQ line
   	enable_irq(KEY_PIC_LINE);
 }
@@ -90,6 +90,8 @@
 #define LETTER_UPPERCASE_OFFSET 32
 #define PRINTABLE_MASK 0x00FF
 #define KEYBOARD_BUFF_SIZE (TOTAL_KEYBOARD_BUFF_SIZE-1)
+#define SCANCODE_BUFF_SIZE 1024 // Power of 2, scan codes waiting for the work queue
+#define SCANCODE_BUFF_MASK (SCANCODE_BUFF_SIZE-1)
 
 // Keyboard Init Constants
 #define KEY_PIC_LINE  (0x01)
@@ -127,6 +129,7 @@ extern uint8_t alt_pressed;
 
 void init_keyboard(void);
 void keyboardHandler(void);
+uint32_t keyboard_dropped(void);
 void setmode(uint8_t insert_mode);
 
 #endif
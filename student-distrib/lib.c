@@ -14,6 +14,13 @@ char* video_mem = (char *)VIDEO;
 uint8_t background_color = BLACK;
 uint8_t foreground_color = GRAY;
 bool is_visible = TRUE;
+// Terminal the globals above were last loaded from, see save_vidmem
+static int32_t vidmem_tid = -1;
+// Row of the VGA ring the screen starts at, only the visible terminal is in it
+static int vga_origin = 0;
+// Rows above the screen from here on scrolled off vga_tid and aren't in its scrollback yet
+static int vga_saved = 0;
+static int32_t vga_tid = -1;
 
 #define attribute_byte (background_color << 4 | foreground_color)
 
@@ -32,12 +39,17 @@ void clear(void) {
  * Function: setter function for vidmem
  */
 int32_t set_vidmem(int32_t terminal_id) {
-    video_mem = (char*)ttys[terminal_id].vidmem_ptr;
+    vidmem_tid = terminal_id;
 	screen_x = ttys[terminal_id].cursor_x;
 	screen_y = ttys[terminal_id].cursor_y;
 	background_color = ttys[terminal_id].background_color;
 	foreground_color = ttys[terminal_id].foreground_color;
 	is_visible = ttys[terminal_id].is_visible;
+    // The visible terminal is written where the screen currently starts
+    if (is_visible)
+        video_mem = (char*)VIDEO + ((vga_origin * NUM_COLS) << 1);
+    else
+        video_mem = (char*)ttys[terminal_id].vidmem_ptr;
     return 0;
 }
 
@@ -47,7 +59,6 @@ int32_t set_vidmem(int32_t terminal_id) {
  * Function: getter function for vidmem
  */
 int32_t get_vidmem(int32_t terminal_id) {
-	ttys[terminal_id].vidmem_ptr = (uint8_t*)video_mem;
 	ttys[terminal_id].cursor_x = screen_x;
 	ttys[terminal_id].cursor_y = screen_y;
 	ttys[terminal_id].background_color = background_color;
@@ -56,6 +67,17 @@ int32_t get_vidmem(int32_t terminal_id) {
     return 0;
 }
 
+/* save_vidmem
+ * Inputs: none
+ * Return Value: none
+ * Function: get_vidmem for the terminal set_vidmem last loaded, if any. Every cpu
+ *           shares the globals, whoever leaves the kernel puts them back.
+ */
+void save_vidmem(void) {
+    if (vidmem_tid >= 0 && vidmem_tid < MAX_TERMINALS)
+        get_vidmem(vidmem_tid);
+}
+
 /* setbg
  * Inputs: color index 0-15
  * Return Value: none
@@ -136,22 +158,115 @@ void clear_line(unsigned int line_num) {
     memset_word(start_addr, (attribute_byte << 8) | BLANK_CHAR, NUM_COLS);
 }
 
+/* set_vga_start
+ * Inputs: offset = cell of VGA memory to show at the top left
+ * Return Value: none
+ * Function: Sets the CRTC start address
+ * http://www.osdever.net/FreeVGA/vga/crtcreg.htm#0C */
+static void set_vga_start(int offset) {
+    outb(VGA_START_HIGH, VGA_REGISTER_PORT);
+    outb((unsigned char)((offset >> 8) & 0xFF), VGA_DATA_PORT);
+    outb(VGA_START_LOW, VGA_REGISTER_PORT);
+    outb((unsigned char)(offset & 0xFF), VGA_DATA_PORT);
+}
+
+/* save_scrolled
+ * Inputs: rows = how many rows above the screen to save
+ * Return Value: none
+ * Function: puts the rows that scrolled off the visible terminal since the last
+ *           call in its scrollback, all at once */
+static void save_scrolled(int rows) {
+    if (rows > vga_saved)
+        scrollback_push(vga_tid, (uint16_t*)VIDEO + vga_saved * NUM_COLS, rows - vga_saved);
+    vga_saved = rows;
+}
+
 /* scroll
  * Inputs: none
  * Return Value: none
- * Function: moves the vmem up by one, making space at the bottom */
+ * Function: moves the vmem up by one, making space at the bottom. On screen that
+ *           is only moving the CRTC start a row down the VGA ring, the rows still
+ *           shown get copied back to its start once it runs out. The row that
+ *           goes goes to the terminal's scrollback, right away for hidden ones
+ *           and once the ring runs out for the visible one. A terminal some
+ *           process has vidmapped copies instead, its page is the screen at the
+ *           start of the ring, which must stay where it is. */
 void scroll(void) {
-    int x, y, src, dest;
-    // Move everything up one, erasing the top row
-    for (y = 0; y < NUM_ROWS-1; y++) {
-        for (x = 0; x < NUM_COLS; x++) {
-            dest = (y*NUM_COLS) + x;
-            src = dest + NUM_COLS;
-            *(uint8_t *)(video_mem + (dest << 1)) = *(uint8_t *)(video_mem + (src << 1));
-            *(uint8_t *)(video_mem + (dest << 1) + 1) = *(uint8_t *)(video_mem + (src << 1) + 1);
-        }
+    bool pinned = (vidmem_tid >= 0 && vidmem_tid < MAX_TERMINALS && ttys[vidmem_tid].vidmaps > 0);
+    if (!is_visible || pinned) {
+        scrollback_push(vidmem_tid, (uint16_t*)video_mem, 1);
+        memmove(video_mem, video_mem + (NUM_COLS << 1), ((NUM_ROWS-1)*NUM_COLS) << 1);
+        clear_line(NUM_ROWS-1);
+        return;
+    }
+    vga_tid = vidmem_tid;
+    // Output drops out of scrollback
+    if (vga_tid >= 0 && vga_tid < MAX_TERMINALS)
+        ttys[vga_tid].scrollback_view = 0;
+    if (vga_origin + NUM_ROWS < VGA_RING_ROWS) {
+        vga_origin++;
+        video_mem += NUM_COLS << 1;
+    } else {
+        save_scrolled(vga_origin + 1);
+        memcpy((char*)VIDEO, video_mem + (NUM_COLS << 1), ((NUM_ROWS-1)*NUM_COLS) << 1);
+        vga_origin = 0;
+        vga_saved = 0;
+        video_mem = (char*)VIDEO;
     }
+    // Blank the new row before it shows up
     clear_line(NUM_ROWS-1);
+    set_vga_start(vga_origin * NUM_COLS);
+}
+
+/* vga_home
+ * Inputs: none
+ * Return Value: none
+ * Function: moves the screen back to the start of the VGA ring, where VIDEO (and the
+ *           page vidmap hands out) has it, out of scrollback */
+void vga_home(void) {
+    if (vga_tid >= 0 && vga_tid < MAX_TERMINALS)
+        ttys[vga_tid].scrollback_view = 0;
+    save_scrolled(vga_origin);
+    vga_saved = 0;
+    if (vga_origin != 0) {
+        memmove((char*)VIDEO, (char*)VIDEO + ((vga_origin * NUM_COLS) << 1), (NUM_ROWS*NUM_COLS) << 1);
+        vga_origin = 0;
+        if (is_visible) {
+            video_mem = (char*)VIDEO;
+            setcursor(screen_x, screen_y);
+        }
+    }
+    set_vga_start(0);
+}
+
+/* vga_screen
+ * Inputs: none
+ * Return Value: where the visible terminal's screen is in the VGA ring
+ * Function: getter function */
+uint16_t* vga_screen(void) {
+    return (uint16_t*)VIDEO + vga_origin * NUM_COLS;
+}
+
+/* vga_spare_screen
+ * Inputs: none
+ * Return Value: a screen's worth of the VGA ring that isn't on screen
+ * Function: first saves the rows above the screen that would get overwritten */
+uint16_t* vga_spare_screen(void) {
+    save_scrolled(vga_origin);
+    if (vga_origin >= NUM_ROWS)
+        return (uint16_t*)VIDEO;
+    return (uint16_t*)VIDEO + (vga_origin + NUM_ROWS) * NUM_COLS;
+}
+
+/* vga_show
+ * Inputs: screen = rows in the VGA ring to show, NULL for the visible terminal's
+ * Return Value: none
+ * Function: points the CRTC at them */
+void vga_show(const uint16_t* screen) {
+    if (screen == NULL)
+        set_vga_start(vga_origin * NUM_COLS);
+    else
+        set_vga_start(screen - (uint16_t*)VIDEO);
 }
 
 /* movecursor
@@ -204,13 +319,13 @@ void setcursor(int x, int y) {
     screen_x = x;
     screen_y = y;
 	if (!is_visible) return;
-    int position = (screen_y*NUM_COLS) + screen_x;
+    int position = ((vga_origin + screen_y)*NUM_COLS) + screen_x;
     // VGA Cursor Location Low Register
-    outb(0x0F, VGA_REGISTER_PORT);
+    outb(VGA_CURSOR_LOW, VGA_REGISTER_PORT);
     outb((unsigned char)(position & 0xFF), VGA_DATA_PORT);
 
     // VGA Cursor Location High Register
-    outb(0x0E, VGA_REGISTER_PORT);
+    outb(VGA_CURSOR_HIGH, VGA_REGISTER_PORT);
     outb((unsigned char)((position >> 8) & 0xFF), VGA_DATA_PORT);
 }
 
@@ -399,6 +514,48 @@ void putc(uint8_t c) {
     setcursor(screen_x, screen_y);
 }
 
+/* int32_t putbuf(const int8_t* buf, uint32_t n);
+ * Inputs: buf = characters to print, n = how many
+ * Return Value: n
+ * Function: Output a buffer to the console like n putc's would, but copies each run
+ *           of characters on a row straight into vidmem and only moves the hardware
+ *           cursor once at the end */
+int32_t putbuf(const int8_t* buf, uint32_t n) {
+    uint16_t attrib = attribute_byte << 8;
+    uint16_t* cell;
+    uint32_t i = 0;
+    int room;
+    while (i < n) {
+        if (buf[i] == '\n' || buf[i] == '\r') {
+            if (++screen_y >= NUM_ROWS) {
+                screen_y = NUM_ROWS-1;
+                scroll();
+            }
+            screen_x = 0;
+            i++;
+            continue;
+        }
+        // Copy up to the end of the row or the next line break
+        cell = (uint16_t*)video_mem + (NUM_COLS * screen_y + screen_x);
+        room = NUM_COLS - screen_x;
+        while (i < n && room > 0 && buf[i] != '\n' && buf[i] != '\r') {
+            *cell++ = attrib | (uint8_t)buf[i++];
+            room--;
+        }
+        screen_x = NUM_COLS - room;
+        // Filling the last column wraps right away, same as putc
+        if (screen_x == NUM_COLS) {
+            if (screen_y == NUM_ROWS-1)
+                scroll();
+            else
+                screen_y++;
+            screen_x = 0;
+        }
+    }
+    setcursor(screen_x, screen_y);
+    return n;
+}
+
 /* void putxya(uint8_t c, uint32_t x, uint32_t y, uint8_t attrib);
  * Inputs: uint_8* c = character to print
  *         x,y,a = x,y coordinates and attrib byte respectively
@@ -708,19 +865,19 @@ void* memcpy(void* dest, const void* src, uint32_t n) {
  *         const void* src = source of move
  *              uint32_t n = number of byets to move
  * Return Value: pointer to dest
- * Function: move n bytes of src to dest */
+ * Function: move n bytes of src to dest. memcpy only copies forwards, so it can
+ *           move anything down; moving up goes backwards a byte at a time */
 void* memmove(void* dest, const void* src, uint32_t n) {
+    if (dest <= src)
+        return memcpy(dest, src, n);
     asm volatile ("                             \n\
             movw    %%ds, %%dx                  \n\
             movw    %%dx, %%es                  \n\
-            cld                                 \n\
-            cmp     %%edi, %%esi                \n\
-            jae     .memmove_go                 \n\
             leal    -1(%%esi, %%ecx), %%esi     \n\
             leal    -1(%%edi, %%ecx), %%edi     \n\
             std                                 \n\
-            .memmove_go:                        \n\
             rep     movsb                       \n\
+            cld                                 \n\
             "
             :
             : "D"(dest), "S"(src), "c"(n)
@@ -32,6 +32,15 @@
 // VGA ports for manipulating the Cursor
 #define VGA_REGISTER_PORT (0x3D4)
 #define VGA_DATA_PORT (0x3D5)
+#define VGA_START_HIGH (0x0C)
+#define VGA_START_LOW (0x0D)
+#define VGA_CURSOR_HIGH (0x0E)
+#define VGA_CURSOR_LOW (0x0F)
+
+// VGA memory the visible terminal scrolls through (0xB8000-0xBCFFF), the
+// terminals' own pages come right after it
+#define VGA_RING_PAGES (5)
+#define VGA_RING_ROWS ((VGA_RING_PAGES << 12) / (NUM_COLS << 1))
 
 #include "types.h"
 #include "colors.h"
@@ -41,6 +50,7 @@ extern uint8_t foreground_color;
 
 int32_t printf(int8_t *format, ...);
 void putc(uint8_t c);
+int32_t putbuf(const int8_t* buf, uint32_t n);
 void putxya(uint8_t c, uint32_t x, uint32_t y, uint8_t attrib);
 void putxy(uint8_t c, uint32_t x, uint32_t y);
 void putxy_fb(uint8_t c, uint32_t x, uint32_t y, uint8_t fg, uint8_t bg);
@@ -54,6 +64,7 @@ int8_t* strgetword(uint32_t n, int8_t* s, uint32_t size);
 void clear(void);
 int32_t set_vidmem(int32_t terminal_id);
 int32_t get_vidmem(int32_t terminal_id);
+void save_vidmem(void);
 void setbg(unsigned int color);
 void setfg(unsigned int color);
 void reset_colors(void);
@@ -61,6 +72,10 @@ void backspace(void);
 void rbackspace(uint32_t n);
 void clear_line(unsigned int line_num);
 void scroll(void);
+void vga_home(void);
+uint16_t* vga_screen(void);
+uint16_t* vga_spare_screen(void);
+void vga_show(const uint16_t* screen);
 void movecursor(int dir);
 void rmovecursor(int dir, int n);
 void setcursor(int x, int y);
@@ -130,6 +145,25 @@ static inline uint32_t inl(port) {
     return val;
 }
 
+/* Reads the 64 bit time stamp counter */
+static inline uint64_t rdtsc(void) {
+    uint64_t val;
+    asm volatile ("rdtsc" : "=A"(val));
+    return val;
+}
+
+/* Writes a model specific register */
+static inline void wrmsr(uint32_t msr, uint64_t val) {
+    asm volatile ("wrmsr" : : "c"(msr), "A"(val));
+}
+
+/* Runs cpuid for a leaf, returns edx (the feature flags for leaf 1) */
+static inline uint32_t cpuid_edx(uint32_t leaf) {
+    uint32_t eax = leaf, ebx, ecx = 0, edx;
+    asm volatile ("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    return edx;
+}
+
 /* Writes a byte to a port */
 #define outb(data, port)                \
 do {                                    \
@@ -117,12 +117,20 @@ To enable PSE (4 MiB pages) the following code is required.
  */
 
 #include "paging.h"
+#include "syscall.h"
+#include "smp.h"
 uint32_t page_directory[ONE_KILOBYTE]__attribute__((aligned(FOUR_KILOBYTES))); // The actual page directory
 
 uint32_t first_page_table[ONE_KILOBYTE]__attribute__((aligned(FOUR_KILOBYTES))); //page table for 0 to 4 MB
 
 uint32_t vid_mem_page_table[ONE_KILOBYTE]__attribute__((aligned(FOUR_KILOBYTES))); //page table for vid mrm
 
+uint32_t shm_page_tables[MAX_PIDS][ONE_KILOBYTE]__attribute__((aligned(FOUR_KILOBYTES))); //per process page tables for shared memory at 132MB
+
+uint32_t time_page_table[ONE_KILOBYTE]__attribute__((aligned(FOUR_KILOBYTES))); //page table for the time page at 136MB
+
+uint32_t cpu_page_directories[MAX_CPUS-1][ONE_KILOBYTE]__attribute__((aligned(FOUR_KILOBYTES))); //page directories of the other cpus, the BSP uses page_directory
+
 
 //int some_variable __attribute__((aligned (BYTES_TO_ALIGN_TO)));
 
@@ -143,10 +151,11 @@ extern void init_paging(){
         first_page_table[i]=(i*FOUR_KILOBYTES)|ENABLE_SUPERVISOR_RW_NOT_PRESENT;        //Putting physical page address and setting bits
     }																					// for rw present
                                                                                         //video memory reserve here
-    first_page_table[VID_ADDR]|=ENABLE_SUPERVISOR_RW_PRESENT;
+    for (i = 0; i < VGA_RING_PAGES; i++)													//the ring the screen scrolls through
+        first_page_table[VID_ADDR+i]|=ENABLE_SUPERVISOR_RW_PRESENT;
 
-    for (i = 1; i < MAX_TERMINALS+1; i++)													//for vid mem save
-        first_page_table[VID_ADDR+i]|=ENABLE_USER_RW_PRESENT;
+    for (i = 0; i < MAX_TERMINALS; i++)														//for vid mem save
+        first_page_table[VID_ADDR+VGA_RING_PAGES+i]|=ENABLE_USER_RW_PRESENT;
 
 
     page_directory[0]=(uint32_t)first_page_table|ENABLE_SUPERVISOR_RW_PRESENT;          //sets the first 4 MB to the first 4kb page tables
@@ -219,13 +228,15 @@ extern void init_DMA_page(void * addr)
  * 	pid - PID of the process we are switching to
  * output:
  *	None
- * side effects: Changes the page directory and flushes tlb
+ * side effects: Changes this cpu's page directory and flushes tlb
 */
 extern void add_process_page(int32_t pid){
     
+    uint32_t* pgdir=this_cpu()->pgdir;                                //each cpu runs its own process
     int32_t addr=PROCESS_MEM_START_MB+(PROCESS_PAGE_SIZE_MB*(pid+1)); //address for the process based on pid number and then shift to match pde format
     addr=addr<<FOUR_MB_PAGE_ALIGNMENT_SHIFT;
-    page_directory[PDE_FOR_128MB]=addr|ENABLE_PSE|ENABLE_USER_RW_PRESENT; //32 for 128MB, as it's mapping 4 MB per PDE
+    pgdir[PDE_FOR_128MB]=addr|ENABLE_PSE|ENABLE_USER_RW_PRESENT; //32 for 128MB, as it's mapping 4 MB per PDE
+    pgdir[PDE_FOR_SHM]=(uint32_t)shm_page_tables[pid]|ENABLE_USER_RW_PRESENT; //shared memory segments this process attached
     //Flush TLB <---- greatest comment ever
     flush_tlb();
     return;
@@ -261,7 +272,7 @@ void init_user_vidmem() {
 uint8_t* get_vidmem_tty(int32_t tid){
 	if (tid == -1)
 		return (uint8_t*) VIDEO-FOUR_KILOBYTES;
-    uint32_t base=(VIDEO+FOUR_KILOBYTES)+(tid*FOUR_KILOBYTES);          //Gets pointer for vidmem by calculating the address we gave to it based on tid
+    uint32_t base=(VIDEO+VGA_RING_PAGES*FOUR_KILOBYTES)+(tid*FOUR_KILOBYTES); //Gets pointer for vidmem by calculating the address we gave to it based on tid, past the VGA ring
     if(base<VIDEO||base>=IN_MB(4))
         return NULL;
     return (uint8_t*)base;
@@ -280,8 +291,97 @@ void map_addr_to_addr(void* from_addr, void* to_addr) {
 	uint32_t base = SHIFT_RIGHT_12((uint32_t)from_addr);
 	first_page_table[base] = (uint32_t)to_addr|ENABLE_USER_RW_PRESENT;      //Map from Page to to Page
 	flush_tlb();
+	smp_flush_tlb_others();                                                 //every cpu shares this page table
+}
+
+/* map_shm_page
+ * description: maps a 4kb shared memory page into a process' shared memory page table
+ * input:
+ * 	    pid:        process whose page table is changed
+ *      virt_addr:  user virtual address inside the shared memory 4MB region
+ *      phys_addr:  4kb aligned physical address of the shared page
+ * output:
+ *	    None
+ * side effects: Changes the page table and flushes tlb
+*/
+void map_shm_page(int32_t pid, uint32_t virt_addr, uint32_t phys_addr) {
+    if (pid < 0 || pid >= MAX_PIDS || SHIFT_RIGHT_22(virt_addr) != PDE_FOR_SHM) return;
+    shm_page_tables[pid][SHIFT_RIGHT_12(virt_addr) & (ONE_KILOBYTE-1)] = phys_addr|ENABLE_USER_RW_PRESENT;
+    flush_tlb();
 }
 
+/* unmap_shm_page
+ * description: removes a 4kb shared memory page from a process' shared memory page table
+ * input:
+ * 	    pid:        process whose page table is changed
+ *      virt_addr:  user virtual address inside the shared memory 4MB region
+ * output:
+ *	    None
+ * side effects: Changes the page table and flushes tlb
+*/
+void unmap_shm_page(int32_t pid, uint32_t virt_addr) {
+    if (pid < 0 || pid >= MAX_PIDS || SHIFT_RIGHT_22(virt_addr) != PDE_FOR_SHM) return;
+    shm_page_tables[pid][SHIFT_RIGHT_12(virt_addr) & (ONE_KILOBYTE-1)] = 0;
+    flush_tlb();
+}
+
+/* map_time_page
+ * description: maps the kernel's time page read only at TIME_PAGE_VIRT. Every process
+ *              shares the page directory entry, so this is done once.
+ * input:
+ *      phys_addr:  4kb aligned physical address of the time page
+ * output:
+ *	    None
+ * side effects: Changes the page directory and flushes tlb
+*/
+void map_time_page(uint32_t phys_addr) {
+    time_page_table[0] = phys_addr|ENABLE_USER_RO_PRESENT;     // user can read, only the kernel writes
+    page_directory[PDE_FOR_TIME_PAGE] = (uint32_t)time_page_table|ENABLE_USER_RW_PRESENT;
+    flush_tlb();
+}
+
+/* map_mmio
+ * description: identity maps the 4MB around a device's registers, uncached. Must be
+ *              done before init_cpu_page_directory so every cpu has it.
+ * input:
+ *      phys_addr:  physical address of the registers, way above the kernel
+ * output:
+ *	    None
+ * side effects: Changes the page directory and flushes tlb
+*/
+void map_mmio(uint32_t phys_addr) {
+    page_directory[SHIFT_RIGHT_22(phys_addr)] = (phys_addr & ~(IN_MB(4)-1))|ENABLE_PSE|PAGE_CACHE_DISABLE|PAGE_WRITE_THROUGH|ENABLE_SUPERVISOR_RW_PRESENT;
+    flush_tlb();
+}
+
+/* map_low_page
+ * description: identity maps a 4kb page in the first 4MB for the kernel, e.g. the
+ *              real mode page other cpus start in
+ * input:
+ *      phys_addr:  4kb aligned physical address below 4MB
+ * output:
+ *	    None
+ * side effects: Changes the page table and flushes tlb
+*/
+void map_low_page(uint32_t phys_addr) {
+    first_page_table[SHIFT_RIGHT_12(phys_addr)] = phys_addr|ENABLE_SUPERVISOR_RW_PRESENT;
+    flush_tlb();
+}
+
+/* init_cpu_page_directory
+ * description: gives a cpu its own copy of the page directory, so add_process_page
+ *              can map a different process on every cpu. The page tables are shared.
+ * input:
+ *      cpu:        index in cpus, 1 or more
+ * output:
+ *	    the page directory for the cpu's cr3
+ * side effects: Copies page_directory as it is now
+*/
+uint32_t* init_cpu_page_directory(uint32_t cpu) {
+    uint32_t* pgdir = cpu_page_directories[cpu-1];
+    memcpy(pgdir, page_directory, sizeof(page_directory));
+    return pgdir;
+}
 
 // to be added later for malloc
 
@@ -27,6 +27,15 @@
 #define PDE_FOR_128MB (32)
 #define PDE_FOR_256MB (64)
 #define USER_VID_MEM  (0x10000000)
+#define USER_PAGE_START (PDE_FOR_128MB << FOUR_MB_PAGE_ALIGNMENT_SHIFT)  // The process' own 4MB page
+#define USER_PAGE_END   (USER_PAGE_START + IN_MB(PROCESS_PAGE_SIZE_MB))
+#define PDE_FOR_SHM   (33)      // 132MB, right after the program page
+#define SHM_VIRT_BASE (PDE_FOR_SHM << FOUR_MB_PAGE_ALIGNMENT_SHIFT)
+#define PDE_FOR_TIME_PAGE (34)  // 136MB, the same read only time page in every process
+#define TIME_PAGE_VIRT (PDE_FOR_TIME_PAGE << FOUR_MB_PAGE_ALIGNMENT_SHIFT)
+#define ENABLE_USER_RO_PRESENT 0x5
+#define PAGE_WRITE_THROUGH 0x8
+#define PAGE_CACHE_DISABLE 0x10
 
 
 // extern void change_current_process_addr(uint32_t addr);
@@ -38,6 +47,14 @@ extern void flush_tlb();
 void init_user_vidmem();
 uint8_t* get_vidmem_tty(int32_t tid);
 void map_addr_to_addr(void* from_addr, void* to_addr);
+void map_shm_page(int32_t pid, uint32_t virt_addr, uint32_t phys_addr);
+void unmap_shm_page(int32_t pid, uint32_t virt_addr);
+void map_time_page(uint32_t phys_addr);
+void map_mmio(uint32_t phys_addr);
+void map_low_page(uint32_t phys_addr);
+uint32_t* init_cpu_page_directory(uint32_t cpu);
+
+extern uint32_t page_directory[ONE_KILOBYTE];
 
 extern void init_DMA_page(void * addr);
 
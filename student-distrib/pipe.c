@@ -0,0 +1,248 @@
+#include "pipe.h"
+
+// Ring buffers, one page per pipe
+static uint8_t pipe_buffs[MAX_PIPES][PIPE_BUFF_SIZE] __attribute__((aligned(FOUR_KBYTES)));
+
+static pipe_t pipes[MAX_PIPES];
+static lock_stats_t pipe_lock_stats = LOCK_STATS_INIT("pipe");
+
+/* init_pipes
+ * description: marks every pipe free and sets up its lock and wait queues
+ * input: none
+ * output: none
+ * side effects: none
+ */
+void init_pipes(void) {
+    int32_t i;
+    for (i = 0; i < MAX_PIPES; i++) {
+        spin_lock_init(&pipes[i].lock, &pipe_lock_stats);
+        init_wait_queue(&pipes[i].read_queue);
+        init_wait_queue(&pipes[i].write_queue);
+        pipes[i].readers = 0;
+        pipes[i].writers = 0;
+    }
+}
+
+/* pipe_free
+ * description: gives back a pipe system_pipe claimed but could not open
+ * input:
+ * 	pipe - the pipe, with one reader and one writer nobody holds
+ * output: none
+ * side effects: the pipe is free again
+ */
+static void pipe_free(pipe_t* pipe) {
+    uint32_t flags;
+    spin_lock_irqsave(&pipe->lock, flags);
+    pipe->readers = 0;
+    pipe->writers = 0;
+    spin_unlock_irqrestore(&pipe->lock, flags);
+}
+
+/* system_pipe
+ * description: creates a pipe and opens both of its ends in the calling process
+ * input:
+ * 	fds - user array of two ints, filled with the read end fd and the write end fd
+ * output:
+ *	0 on success, -1 on error
+ * side effects: uses up two fds of the calling process
+ */
+int32_t system_pipe(int32_t* fds) {
+    if ((uint32_t)fds < IN_MB(8) || fds == NULL) return -1;
+    pcb_t* pcb = get_current_pcb();
+    uint32_t fd_read, fd_write;
+    int32_t idx;
+    uint32_t flags;
+    pipe_t* pipe;
+
+    // Find a free pipe and claim it, one end each so nobody else takes it
+    for (idx = 0; idx < MAX_PIPES; idx++) {
+        pipe = &pipes[idx];
+        spin_lock_irqsave(&pipe->lock, flags);
+        if (pipe->readers == 0 && pipe->writers == 0) {
+            pipe->read_pos = 0;
+            pipe->count = 0;
+            pipe->readers = 1;
+            pipe->writers = 1;
+            spin_unlock_irqrestore(&pipe->lock, flags);
+            break;
+        }
+        spin_unlock_irqrestore(&pipe->lock, flags);
+    }
+    if (idx == MAX_PIPES) return -1;
+
+    // Claiming the read end fd first makes the next search skip it
+    if (get_available_fd(pcb, &fd_read) != 0) {
+        pipe_free(pipe);
+        return -1;
+    }
+    if (get_available_fd(pcb, &fd_write) != 0) {
+        pcb->files[fd_read].flags = 0;
+        pipe_free(pipe);
+        return -1;
+    }
+
+    file_t read_end, write_end;
+    read_end.file_ops.open = NULL;
+    read_end.file_ops.close = pipe_close;
+    read_end.file_ops.read = pipe_read;
+    read_end.file_ops.write = NULL;
+    read_end.inode = idx;   // Pipe ends keep their pipe index where files keep their inode
+    read_end.f_pos = 0;
+    read_end.flags = 1;
+
+    write_end = read_end;
+    write_end.file_ops.read = NULL;
+    write_end.file_ops.write = pipe_write;
+
+    pcb->files[fd_read] = read_end;
+    pcb->files[fd_write] = write_end;
+
+    fds[PIPE_READ_END] = fd_read;
+    fds[PIPE_WRITE_END] = fd_write;
+    return 0;
+}
+
+/* pipe_read
+ * description: reads from a pipe, blocking until there is data or every write end is closed
+ * input:
+ * 	fd - read end of a pipe
+ *  buf - buffer to fill
+ *  nbytes - size of buf
+ * output:
+ *	bytes read, 0 at end of file, -1 on error
+ * side effects: sleeps while the pipe is empty
+ */
+int32_t pipe_read(int32_t fd, int8_t* buf, uint32_t nbytes) {
+    if (buf == NULL || fd < 0 || fd >= NUM_FILES) return -1;
+    pipe_t* pipe = &pipes[get_current_pcb()->files[fd].inode];
+    uint8_t* ring = pipe_buffs[get_current_pcb()->files[fd].inode];
+    uint32_t flags, n, first;
+
+    spin_lock_irqsave(&pipe->lock, flags);
+    while (pipe->count == 0) {
+        // Nobody left to write, this is the end of the file
+        if (pipe->writers == 0) {
+            spin_unlock_irqrestore(&pipe->lock, flags);
+            return 0;
+        }
+        if (sleep_on_locked(&pipe->read_queue, &pipe->lock) == -1) {
+            spin_unlock_irqrestore(&pipe->lock, flags);
+            return -1;
+        }
+    }
+
+    // Copy out in at most two pieces, the second one when we wrap around
+    n = MIN(nbytes, pipe->count);
+    first = MIN(n, PIPE_BUFF_SIZE - pipe->read_pos);
+    memcpy(buf, ring + pipe->read_pos, first);
+    memcpy(buf + first, ring, n - first);
+    pipe->read_pos = (pipe->read_pos + n) % PIPE_BUFF_SIZE;
+    pipe->count -= n;
+    wake_up(&pipe->write_queue);
+    spin_unlock_irqrestore(&pipe->lock, flags);
+    return n;
+}
+
+/* pipe_write
+ * description: writes all of buf into a pipe, blocking while the pipe is full
+ * input:
+ * 	fd - write end of a pipe
+ *  buf - data to write
+ *  nbytes - size of buf
+ * output:
+ *	bytes written, -1 if every read end is closed before anything was written
+ * side effects: sleeps while the pipe is full
+ */
+int32_t pipe_write(int32_t fd, int8_t* buf, uint32_t nbytes) {
+    if (buf == NULL || fd < 0 || fd >= NUM_FILES) return -1;
+    pipe_t* pipe = &pipes[get_current_pcb()->files[fd].inode];
+    uint8_t* ring = pipe_buffs[get_current_pcb()->files[fd].inode];
+    uint32_t flags, n, first, write_pos;
+    uint32_t written = 0;
+
+    spin_lock_irqsave(&pipe->lock, flags);
+    while (written < nbytes) {
+        // Nobody will ever read this
+        if (pipe->readers == 0) {
+            spin_unlock_irqrestore(&pipe->lock, flags);
+            return (written == 0) ? -1 : (int32_t)written;
+        }
+        if (pipe->count == PIPE_BUFF_SIZE) {
+            if (sleep_on_locked(&pipe->write_queue, &pipe->lock) == -1) {
+                spin_unlock_irqrestore(&pipe->lock, flags);
+                return (written == 0) ? -1 : (int32_t)written;
+            }
+            continue;
+        }
+        // Copy in as much as fits, in at most two pieces
+        write_pos = (pipe->read_pos + pipe->count) % PIPE_BUFF_SIZE;
+        n = MIN(nbytes - written, PIPE_BUFF_SIZE - pipe->count);
+        first = MIN(n, PIPE_BUFF_SIZE - write_pos);
+        memcpy(ring + write_pos, buf + written, first);
+        memcpy(ring, buf + written + first, n - first);
+        pipe->count += n;
+        written += n;
+        wake_up(&pipe->read_queue);
+    }
+    spin_unlock_irqrestore(&pipe->lock, flags);
+    return written;
+}
+
+/* pipe_close
+ * description: closes one end of a pipe
+ * input:
+ * 	fd - pipe end to close
+ * output:
+ *	0 on success, -1 on error
+ * side effects: frees the pipe once both ends are closed everywhere
+ */
+int32_t pipe_close(int32_t fd) {
+    if (fd < 0 || fd >= NUM_FILES) return -1;
+    pcb_t* pcb = get_current_pcb();
+    if (pcb->files[fd].flags == 0) return -1;
+    pipe_release(&pcb->files[fd]);
+    pcb->files[fd].flags = 0;
+    return 0;
+}
+
+/* pipe_dup
+ * description: takes another reference on a pipe end that is being copied
+ * input:
+ * 	file - the copy, does nothing if it is not an open pipe end
+ * output: none
+ * side effects: changes the pipe's reader/writer counts
+ */
+void pipe_dup(file_t* file) {
+    if (file == NULL || file->flags == 0) return;
+    pipe_t* pipe = &pipes[file->inode];
+    uint32_t flags;
+    spin_lock_irqsave(&pipe->lock, flags);
+    if (file->file_ops.read == pipe_read)
+        pipe->readers++;
+    else if (file->file_ops.write == pipe_write)
+        pipe->writers++;
+    spin_unlock_irqrestore(&pipe->lock, flags);
+}
+
+/* pipe_release
+ * description: drops a reference on a pipe end
+ * input:
+ * 	file - the end going away, does nothing if it is not an open pipe end
+ * output: none
+ * side effects: changes the pipe's reader/writer counts, wakes the other side
+ */
+void pipe_release(file_t* file) {
+    if (file == NULL || file->flags == 0) return;
+    pipe_t* pipe = &pipes[file->inode];
+    uint32_t flags;
+    spin_lock_irqsave(&pipe->lock, flags);
+    // Whoever waits on the other side has to notice EOF / the broken pipe
+    if (file->file_ops.read == pipe_read) {
+        pipe->readers--;
+        wake_up(&pipe->write_queue);
+    } else if (file->file_ops.write == pipe_write) {
+        pipe->writers--;
+        wake_up(&pipe->read_queue);
+    }
+    spin_unlock_irqrestore(&pipe->lock, flags);
+}
@@ -0,0 +1,44 @@
+#ifndef _PIPE_H
+#define _PIPE_H
+
+#include "types.h"
+#include "lib.h"
+#include "fs.h"
+#include "syscall.h"
+#include "scheduler.h"
+
+#define MAX_PIPES       (8)
+#define PIPE_BUFF_SIZE  (FOUR_KBYTES)   // One page of ring buffer per pipe
+#define PIPE_READ_END   (0)
+#define PIPE_WRITE_END  (1)
+
+/*
+ * pipe_t : bookkeeping for one pipe. The data lives in a page sized ring buffer,
+ *          bytes [read_pos, read_pos+count) (mod PIPE_BUFF_SIZE) are unread.
+ *          A pipe is free when nobody holds either end.
+ */
+typedef struct {
+    uint32_t read_pos;
+    uint32_t count;
+    uint32_t readers;   // Open read ends (across all processes)
+    uint32_t writers;   // Open write ends (across all processes)
+    spinlock_t lock;    // Covers everything above and the ring buffer
+    wait_queue_t read_queue;    // Readers waiting for data
+    wait_queue_t write_queue;   // Writers waiting for room
+} pipe_t;
+
+void init_pipes(void);
+
+// Syscall handler
+int32_t system_pipe(int32_t* fds);
+
+// File operations for pipe ends
+int32_t pipe_read(int32_t fd, int8_t* buf, uint32_t nbytes);
+int32_t pipe_write(int32_t fd, int8_t* buf, uint32_t nbytes);
+int32_t pipe_close(int32_t fd);
+
+// Reference counting used when file_t's are copied around (dup2, execute, run)
+void pipe_dup(file_t* file);
+void pipe_release(file_t* file);
+
+#endif
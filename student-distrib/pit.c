@@ -1,4 +1,39 @@
 #include "pit.h"
+#include "clock.h"
+#include "spinlock.h"
+
+// clock_ns each PIT_EVENT_* wants an interrupt at, channel 0 is armed for the earliest
+static uint64_t pit_deadlines[PIT_EVENTS] = {PIT_NO_DEADLINE, PIT_NO_DEADLINE};
+static lock_stats_t pit_lock_stats = LOCK_STATS_INIT("pit");
+static spinlock_t pit_lock = SPINLOCK_INIT(pit_lock_stats);
+
+/*
+description: arms channel 0 for the earliest deadline, or stops it if there is none.
+			 pit_lock must be held.
+input: now - clock_ns
+output: none
+sfx: a deadline further than the PIT can count gets an early interrupt, which
+	 pit_expired_events turns into another one shot
+*/
+static void pit_program(uint64_t now){
+	uint64_t next = PIT_NO_DEADLINE;
+	uint32_t i;
+	for (i = 0; i < PIT_EVENTS; i++) {
+		if (pit_deadlines[i] < next) next = pit_deadlines[i];
+	}
+	if (next == PIT_NO_DEADLINE) {
+		pit_stop();
+		return;
+	}
+	if (next <= now) {
+		pit_arm_usecs(0);
+	} else if (next - now >= (uint64_t)PIT_MAX_USECS * NSEC_PER_USEC) {
+		pit_arm_usecs(PIT_MAX_USECS);
+	} else {
+		// Rounded up, it must not come before the deadline
+		pit_arm_usecs(((uint32_t)(next - now) + NSEC_PER_USEC - 1) / NSEC_PER_USEC);
+	}
+}
 
 /*
 description: returns reload value for given frequency in hz
@@ -15,10 +50,20 @@ uint16_t pit_get_reload_val(unsigned long hz){
 description: initializes the pit
 input: none
 output: none
-sfx: enables irq line on pic and sets the pit to generate ints at PIT_SPEED_HZ
+sfx: enables irq line on pic and sets the pit to generate ints at PIT_SPEED_HZ, or in
+	 tickless mode arms the one shot the deadlines ask for (none at boot)
 */
 void init_pit(void){
 	disable_irq(PIT_PIC_LINE);
+	if (apic_timer_active || PIT_TICKLESS) {
+		// One shots for whoever set a deadline: the timer wheel, and the scheduler
+		// unless every cpu ticks on its local APIC timer
+		spin_lock(&pit_lock);
+		pit_program(clock_ns());
+		spin_unlock(&pit_lock);
+		enable_irq(PIT_PIC_LINE);
+		return;
+	}
 	uint16_t reload_val = pit_get_reload_val(PIT_SPEED_HZ);
 	//tell the pit it is being programmed to be a square wave generator with rate of PIT_SPEED_MS
 	outb(PIT_COMMAND, COMMAND_REG);
@@ -29,3 +74,85 @@ void init_pit(void){
 	enable_irq(PIT_PIC_LINE);
 	return;
 }
+
+/*
+description: arms a single interrupt one tick (1/PIT_SPEED_HZ) from now
+input: none
+output: none
+sfx: reprograms channel 0 in one shot mode, replaces any tick already armed
+*/
+void pit_arm_tick(void){
+	uint16_t reload_val = pit_get_reload_val(PIT_SPEED_HZ);
+	//mode 0 counts down once and raises irq 0 at zero
+	outb(PIT_ONESHOT_COMMAND, COMMAND_REG);
+	outb((uint8_t)(reload_val&R_V_LOW_MASK), CHL_0);
+	outb((uint8_t)((reload_val&R_V_HIGH_MASK)>>SHIFT_VALUE),CHL_0);
+}
+
+/*
+description: arms a single interrupt usecs from now
+input: usecs - delay, clamped to what the 16 bit counter can count (about 55 ms)
+output: the delay actually armed in usecs, less than asked if it was clamped
+sfx: reprograms channel 0 in one shot mode, replaces any interrupt already armed
+*/
+uint32_t pit_arm_usecs(uint32_t usecs){
+	// Rounded up, so it never fires before usecs went by
+	uint64_t counts = (uint64_t)MIN(usecs, PIT_MAX_USECS) * PIT_BASE_HZ + USEC_PER_SEC - 1;
+	div64_32(&counts, USEC_PER_SEC);
+	if (counts == 0) counts = 1;
+	if (counts > PIT_MAX_COUNT) counts = PIT_MAX_COUNT;
+	outb(PIT_ONESHOT_COMMAND, COMMAND_REG);
+	outb((uint8_t)(counts & R_V_LOW_MASK), CHL_0);
+	outb((uint8_t)((counts & R_V_HIGH_MASK) >> SHIFT_VALUE), CHL_0);
+	counts *= USEC_PER_SEC;
+	div64_32(&counts, PIT_BASE_HZ);
+	return (uint32_t)counts;
+}
+
+/*
+description: cancels the armed tick, if any
+input: none
+output: none
+sfx: channel 0 waits for a count that never comes, so it stays quiet
+*/
+void pit_stop(void){
+	outb(PIT_ONESHOT_COMMAND, COMMAND_REG);
+}
+
+/*
+description: sets when one of channel 0's users wants an interrupt
+input: event - PIT_EVENT_*
+	   deadline - clock_ns to interrupt at, PIT_NO_DEADLINE for none
+output: none
+sfx: re-arms the one shot if that changes anything
+*/
+void pit_set_deadline(uint32_t event, uint64_t deadline){
+	uint32_t flags;
+	spin_lock_irqsave(&pit_lock, flags);
+	if (pit_deadlines[event] != deadline) {
+		pit_deadlines[event] = deadline;
+		pit_program(clock_ns());
+	}
+	spin_unlock_irqrestore(&pit_lock, flags);
+}
+
+/*
+description: sorts out who a one shot interrupt was for, called from the PIT handler
+input: none
+output: PIT_EVENT_MASK of every event whose deadline passed, those are cleared
+sfx: arms the one shot for the deadlines left
+*/
+uint32_t pit_expired_events(void){
+	uint32_t flags, i, events = 0;
+	uint64_t now = clock_ns();
+	spin_lock_irqsave(&pit_lock, flags);
+	for (i = 0; i < PIT_EVENTS; i++) {
+		if (pit_deadlines[i] <= now) {
+			pit_deadlines[i] = PIT_NO_DEADLINE;
+			events |= PIT_EVENT_MASK(i);
+		}
+	}
+	pit_program(now);
+	spin_unlock_irqrestore(&pit_lock, flags);
+	return events;
+}
@@ -45,9 +45,21 @@ Bits         Usage
  from osdev
 */
 #define PIT_COMMAND		(0x34)
+#define PIT_ONESHOT_COMMAND	(0x30)	// Channel 0, lo/hi byte, mode 0
+// Only interrupt when the scheduler has a reason to (someone to preempt for),
+// FALSE for the old periodic PIT_SPEED_HZ tick
+#define PIT_TICKLESS	TRUE
 #define PIT_CONST_1		(3000)
 #define PIT_CONST_2		(3579545)
 #define PIT_SPEED_HZ	(50)
+#define PIT_MAX_COUNT	(0xFFFF)	// Largest one shot count, about 55 ms
+#define PIT_MAX_USECS	(55000)
+// Who shares channel 0's one shots, see pit_set_deadline
+#define PIT_EVENT_SCHED	(0)		// The scheduler tick, without APIC timers
+#define PIT_EVENT_WHEEL	(1)		// The timer wheel's next expiry
+#define PIT_EVENTS		(2)
+#define PIT_EVENT_MASK(event)	(1 << (event))
+#define PIT_NO_DEADLINE	((uint64_t)-1)
 #define R_V_LOW_MASK	(0x00FF)
 #define R_V_HIGH_MASK	(0xFF00)
 #define SHIFT_VALUE		(8)
@@ -59,5 +71,10 @@ Bits         Usage
 
 
 void init_pit(void);
+void pit_arm_tick(void);
+uint32_t pit_arm_usecs(uint32_t usecs);
+void pit_stop(void);
+void pit_set_deadline(uint32_t event, uint64_t deadline);
+uint32_t pit_expired_events(void);
 void pit_handler(void);
 #endif
@@ -26,7 +26,8 @@ void init_RTC(void)
     outb(RTC_REG_B | RTC_DIS_NMI, RTC_PORT);
     reg = inb(CMOS_PORT); // Get the value of register B
     outb(RTC_REG_B | RTC_DIS_NMI, RTC_PORT); // Select Register B again
-    outb(reg | RTC_INT_EN, CMOS_PORT);	// Write to B with bit 6 (periodic interrupts) enabled
+    // Bit 6 (periodic interrupts) only when the timer wheel needs the RTC, see program_wheel_event
+    outb(timer_rtc_always() ? (reg | RTC_INT_EN) : (reg & ~RTC_INT_EN), CMOS_PORT);
 
     // set the frequency to lowest setting (32768 >> (RTC_RATE-1)) Hz
 
@@ -45,16 +46,39 @@ void init_RTC(void)
 
 }
 
+/*
+    rtc_set_periodic
+	description: turns the periodic interrupt on or off, the rate stays what init_RTC set
+	inputs: on - TRUE for MAX_FREQ interrupts, FALSE for none
+	output: none
+	side effect: changes register B, acknowledges a tick that was already due
+*/
+void rtc_set_periodic(bool on)
+{
+    uint8_t reg;
+    uint32_t flags;
+    cli_and_save(flags);
+    outb(RTC_REG_B | RTC_DIS_NMI, RTC_PORT);
+    reg = inb(CMOS_PORT);
+    outb(RTC_REG_B | RTC_DIS_NMI, RTC_PORT);
+    outb(on ? (reg | RTC_INT_EN) : (reg & ~RTC_INT_EN), CMOS_PORT);
+    outb(RTC_REG_C, RTC_PORT);
+    inb(CMOS_PORT);
+    restore_flags(flags);
+}
+
 /*
     RTCHandler
-	description: Handles periodic inputs from the Real-time clock
+	description: Handles periodic inputs from the Real-time clock, which only come
+                 while the timer wheel needs them (see program_wheel_event)
 	inputs: none
 	output:	none
-	side effect: (Currently) writes to screen, read from RTC
+	side effect: runs expired kernel timers, read from RTC
 */
 void RTCHandler(void)
 {
 	Global_RTC_Clock++; //inc the global clk to show an interrupt has occured
+	timer_interrupt(); // wakes read_RTC and sleep callers that are due
     // Read from RTC register C and discard the result
     // This read serves as an acknowledge to the RTC, so it will send another interrupt
     outb(RTC_REG_C, RTC_PORT);
@@ -79,6 +103,8 @@ int32_t set_RTC(int32_t fd, int8_t* buf, uint32_t size){
 	// go to id in array and insert freq
 	pcb_t* PcbPtr = get_current_pcb();
 	PcbPtr->rtc_rate = temp;
+	// the new rate starts counting from now
+	PcbPtr->rtc_next = timer_now();
 	return 0;
 }
 /*
@@ -89,26 +115,26 @@ input:
 	frequency : the frequency to wait for in Hz
 output:
 	0: on success or on bad fd
-sideeffct: none
+sideeffct: sleeps on a kernel timer until the process' next virtual interrupt
 */
 int32_t read_RTC(int32_t fd, int8_t* buf, uint32_t nbytes){
-	sti();
-
 	//check fd
 	if(fd<0 || fd>NUM_FILES){
 		return 0;
 	}
 	//get rate from pcb block
-	uint32_t rate = (get_current_pcb())->rtc_rate;
-	unsigned long PrevClk = Global_RTC_Clock;
-	// these are the number of interrupts that must happen v
-	unsigned long TicksToElaspe = (unsigned long) ( MAX_FREQ/rate);
-	while(1){
-		if( ( Global_RTC_Clock - PrevClk ) >= TicksToElaspe ){
-			// if ticks have elasped break the while loop
-			break;
-		}
+	pcb_t* PcbPtr = get_current_pcb();
+	uint32_t now = timer_now();
+	// these are the number of interrupts that must happen between virtual ones
+	uint32_t period = MAX_FREQ / PcbPtr->rtc_rate;
+	// virtual interrupts are a fixed period apart no matter when read is called,
+	// unless we fell behind by a whole period, then start over from now
+	PcbPtr->rtc_next += period;
+	if( (int32_t)(PcbPtr->rtc_next - now) <= 0 || PcbPtr->rtc_next - now > period ){
+		PcbPtr->rtc_next = now + period;
 	}
+	// one timer per sleeping reader instead of waking every reader each tick
+	timer_sleep_until(PcbPtr->rtc_next);
 	return 0;
 }
 /*
@@ -126,7 +152,8 @@ int get_RTC_freq( void ){
 	return (get_current_pcb())->rtc_rate;
 }
 /*
-description: this returns the global clk
+description: this returns the global clk, only counting while the RTC interrupts
+             (use timer_now for the time)
 input: none
 output: cur glb clk var
 side effect: none
@@ -146,9 +173,7 @@ int RTC_udelay(unsigned long usecs){
 		return -1;
 	}
 	unsigned long ticks = usecs/PERIOD_USEC;	//how many intrps must happen
-	//curr clock so we can diff it as it progresses
-	unsigned long PrevClk = Global_RTC_Clock;
-	// wait until the diff is equal to the ticks needed
-	while( (Global_RTC_Clock - PrevClk) != ticks){}
+	// sleep on a timer instead of spinning on the clock
+	timer_sleep_until(timer_now() + ticks);
 	return 0;
 }
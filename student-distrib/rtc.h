@@ -5,6 +5,8 @@
 #include "idt_common.h"
 #include "ext-lib.h"
 #include "syscall.h"
+#include "timer.h"
+#include "clock.h"
 
 
 #define RTC_PIC_LINE (0x08) // RTC PIC line
@@ -25,6 +27,7 @@
 // Valid values are 2-15, we choose the slowest possible
 #define RTC_RATE    (6)
 #define MAX_FREQ	(32768 >> (RTC_RATE-1))
+#define RTC_FREQ_SHIFT	(16 - RTC_RATE)	// MAX_FREQ == 1 << RTC_FREQ_SHIFT
 #define PERIOD_USEC	(976)
 
 // Used to set the rate when writing to RTC register A
@@ -38,6 +41,7 @@
 
 void init_RTC(void);
 void RTCHandler(void);
+void rtc_set_periodic(bool on);
 int32_t read_RTC(int32_t fd, int8_t* buf, uint32_t nbytes);
 int32_t set_RTC(int32_t fd, int8_t* buf, uint32_t size);
 int get_RTC_freq(void);
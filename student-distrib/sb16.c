@@ -2,12 +2,19 @@
 
 
 
+// Jobs waiting on the next DSP interrupt
+static wait_queue_t sb16_queue;
+// Covers got_dsp_int between the handler and sb16_wait_int
+static lock_stats_t sb16_lock_stats = LOCK_STATS_INIT("sb16");
+static spinlock_t sb16_lock = SPINLOCK_INIT(sb16_lock_stats);
+
 // Set the DSP Transfer Sampling Rate
 uint32_t sampling_rate = 44100;//44100;
 
 uint16_t init_sound(void)
 {
     got_dsp_int = 0;
+    init_wait_queue(&sb16_queue);
     // Reset the SB16
     sb16_reset();
 
@@ -153,9 +160,30 @@ void init_mixer(void)
 
 }
 
+/* sb16_wait_int
+ * description: blocks until the DSP raises its next interrupt (a half buffer played)
+ * input: none
+ * output: none
+ * side effects: sleeps the current job
+ */
+void sb16_wait_int(void)
+{
+    uint32_t flags;
+    spin_lock_irqsave(&sb16_lock, flags);
+    while (!got_dsp_int)
+        sleep_on_locked(&sb16_queue, &sb16_lock);
+    got_dsp_int = 0;
+    spin_unlock_irqrestore(&sb16_lock, flags);
+}
+
 void sb16_handler(void)
 {
+    uint32_t flags;
+    // Runs nested with interrupts on, see run_device_handler
+    spin_lock_irqsave(&sb16_lock, flags);
     got_dsp_int = 1;
+    wake_up(&sb16_queue);
+    spin_unlock_irqrestore(&sb16_lock, flags);
     inb(SB16_BASE | SB16_16_IRQ_ACK); // Acknowledge the interrupt
 }
 
@@ -103,6 +103,7 @@ uint8_t mixer_read(uint8_t reg);
 void init_DMA(void);
 void init_mixer(void);
 void sb16_handler(void);
+void sb16_wait_int(void);
 int8_t sb16_play();
 
 uint8_t dma_16;
@@ -1,121 +1,835 @@
 #include "scheduler.h"
 #include "syscall.h"
+#include "pipe.h"
+#include "pit.h"
+#include "idt_common.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "clock.h"
 
 /*
  *	Struct and Global Variables
  *
- * 	running_t	:	This struct encapsulated information about the process in order to be able to switch between jobs, thus is holds stack and process information
+ * 	running_t	:	This struct encapsulated information about the process in order to be able to switch between jobs, thus is holds stack and process information.
+ *					A new job starts on its own start stack from a frame that switch_to returns into job_entry.
  *
  * 	pending_t	:	This struct encapsulated information about the pending jobs in order to be able to execute them later
  *
  * 	running_jobs:	Array of jobs that are currently running, each points to an individual running_t
  *
  *  pending_jobs:	Array of jobs that are scheduled to run, each points to an individual pending_t
+ *
+ *  kthread_jobs:	Kernel threads, jobs that run a kernel function on their own stack and never
+ *					enter user space. One can work for a process (see get_current_pcb), then it
+ *					runs with that process' memory mapped.
+ *
+ *  Jobs are picked with a multilevel feedback queue: the lowest level that has a runnable
+ *  job wins, round robin inside a level. Using up a whole quantum (cpu time, measured on
+ *  clock_ns) moves a job down a level, blocking on I/O moves it back up, and every
+ *  MLFQ_BOOST_TICKS everyone goes back up so nothing starves. A process' nice value is
+ *  the highest level it can reach. In tickless mode the timer is armed for the end of
+ *  the current job's quantum, not every tick, and only while another job waits.
+ *
+ *  Every cpu has its own run queues, current and idle job (cpu_sched). A job goes back on
+ *  the queues of the cpu it last ran on, as long as its affinity allows, new jobs go to
+ *  the least loaded cpu. A cpu with nothing queued steals from the busiest other one.
+ *  Every cpu ticks on its own local APIC timer (see apic.c). Without one only the BSP gets
+ *  the PIT, and passes its ticks on to the others with an IPI. Each cpu boosts its own
+ *  jobs, and a tick that lets the current job keep going only touches the cpu's own
+ *  queues, so it doesn't take the big kernel lock (see timer_tick).
+ *
+ *  Each cpu's run queues have their own lock, jobs_lock covers the pending FIFO and the
+ *  free slots. A cpu only ever holds one run queue lock, and takes jobs_lock first when
+ *  it needs both. A wait queue's lock comes before either. Everything here runs with
+ *  interrupts off.
 
  */
 
-typedef struct {
+typedef struct pending {
+    uint8_t command[MAX_COMMAND_SIZE];
+	int32_t* return_status;
+	int32_t tid;
+	bool haltable;
+	bool in_use;
+	bool has_stdio;
+	file_t stdio[2];	// fd 0 and 1 handed to the job, when has_stdio
+	struct pending* next;	// Next job in the pending FIFO (or free list)
+} pending_t;
+
+typedef struct running {
 	uint32_t pid;
-	uint32_t ebp;
-    uint32_t esp;
+    volatile uint32_t esp;		// Kernel esp saved by switch_to, 0 while on a cpu
     uint32_t esp0;
     uint32_t ss0;
 	bool in_use;
+	bool fresh;					// Hasn't started its program yet, no pid or tss to restore
+	bool kthread;				// Kernel thread, pid is who it works for or KTHREAD_NO_PID
+	pending_t start;			// What a fresh job runs
+	volatile uint32_t blocked;	// JOB_AWAKE, or sleeping on a wait queue (see sleep_on_locked)
+	volatile bool cancelled;	// Kernel thread whose process is gone, sleeps fail right away
+	wait_queue_t* waiting_on;	// Wait queue it sleeps on, while blocked
+	struct running* wait_next;	// Next job on the same wait queue
+	struct running* next;		// Next job on the same run queue (or free list)
+	struct running* prev;		// Previous job on the same run queue
+	uint32_t woken_tsc;			// Low half of the TSC when wake_up ran, for latency stats
+	uint32_t level;				// MLFQ level, 0 runs first
+	uint64_t used_ns;			// Cpu time used out of this level's quantum, see charge_running
+	uint32_t lock_depth;		// Big kernel lock nesting while switched out, see kernel_lock
+	uint32_t cpu;				// Cpu whose run queues it is on or last ran on, NO_CPU if new
 	int32_t* return_status;
 } running_t;
 
-typedef struct{
-    uint8_t command[MAX_COMMAND_SIZE];
-	int32_t* return_status;
-	int32_t tid;
-	bool haltable;
-	bool in_use;
-} pending_t;
+
+/*
+ * run_queue_t : FIFO of runnable jobs on one MLFQ level, linked through running_t.next.
+ *				 The job on the cpu is never on a run queue.
+ */
+typedef struct {
+	running_t* head;
+	running_t* tail;
+} run_queue_t;
+
+/*
+ * cpu_sched_t : what the scheduler keeps per processor
+ */
+typedef struct {
+	running_t* running;		// Job on this cpu
+	running_t idle;			// This cpu's boot context, parked in idle_loop. Runs whenever no job can.
+	volatile bool kicked;	// A RESCHED_VECTOR IPI is on its way to pick up a job or start the timer
+	volatile bool tick_armed;	// This cpu's one shot APIC timer tick is on its way (tickless mode)
+	uint64_t tick_at;		// clock_ns it was armed for
+	uint64_t slice_start;	// clock_ns running was last charged at
+	spinlock_t lock;		// Covers queues, queued and the level of the jobs on them
+	run_queue_t queues[MLFQ_LEVELS];	// Runnable jobs placed on this cpu, one queue per MLFQ level
+	uint32_t queued;		// Jobs on queues
+	uint64_t boost_at;		// clock_ns this cpu's jobs get boosted at
+	uint32_t timer_irqs;	// Timer interrupts since the stats were last printed
+} cpu_sched_t;
+
+// running_t.blocked, see sleep_on_locked
+#define JOB_AWAKE		(0)		// Runnable or running
+#define JOB_SLEEPING	(1)		// On a wait queue, still on its cpu
+#define JOB_ASLEEP		(2)		// On a wait queue and off its cpu, only wake_job puts it back
 
 running_t running_jobs[MAX_PIDS];
 pending_t pending_jobs[MAX_PIDS];
 
-running_t* curr_running;
+static cpu_sched_t cpu_sched[MAX_CPUS];
+#define curr_running	(cpu_sched[this_cpu_id()].running)
+#define idle_job		(cpu_sched[this_cpu_id()].idle)
+
 int running_size; 	//Amount of Running and Pending Jobs
 int pending_size;
 
+// Jobs waiting to be started, oldest first
+static pending_t* pending_head;
+static pending_t* pending_tail;
+// Unused slots of running_jobs and pending_jobs
+static running_t* free_running;
+static pending_t* free_pending;
+static lock_stats_t jobs_lock_stats = LOCK_STATS_INIT("jobs");
+static spinlock_t jobs_lock = SPINLOCK_INIT(jobs_lock_stats);
+static lock_stats_t run_queue_stats = LOCK_STATS_INIT("runqueue");
+
+// Stack a new job starts its program from, per running_jobs slot. Once the program
+// runs the job lives on its process' kernel stack instead.
+static uint32_t start_stacks[MAX_PIDS][START_STACK_SIZE / sizeof(uint32_t)];
+
+// Kernel threads and their stacks, a pcb_t header at the bottom of each like a process'
+static running_t kthread_jobs[MAX_KTHREADS];
+static uint8_t kthread_stacks[MAX_KTHREADS][KTHREAD_STACK_SIZE] __attribute__((aligned(KTHREAD_STACK_SIZE)));
+
+// Quantum of each MLFQ level, in timer ticks
+static const uint32_t mlfq_quantum[MLFQ_LEVELS] = {1, 2, 4};
+#define SCHED_TICK_NS	(NSEC_PER_SEC / PIT_SPEED_HZ)
+// Timers aren't exact to the ns, a quantum with less than this left is used up
+#define MLFQ_SLACK_NS	(NSEC_PER_MSEC)
+
+// Cycles between wake_up and the woken job running again
+static uint32_t wakeup_count;
+static uint64_t wakeup_total;
+static uint32_t wakeup_max;
+// Jobs idle cpus took off another cpu's run queues
+static uint32_t steal_count;
+// Cycles schedule spends deciding who runs next
+static uint32_t decision_count;
+static uint64_t decision_total;
+static uint32_t decision_max;
+static uint32_t decision_start;	// TSC when the current decision started, 0 if none
+// timer_now when the stats were last printed
+static unsigned long stats_since;
+// Whether a one shot PIT tick is on its way (tickless mode), and its clock_ns
+static bool tick_armed = FALSE;
+static uint64_t tick_at;
+
 // Helper Functions
 
-/*  pending_job_helper
-	description: finds next pending job that is free or in use
-	inputs: used - tells the function whether to find the first
-				   job that is in_use or not
-	output: the desired pending job
+/*  get_next_pending_job
+	description: takes the oldest job off the pending FIFO
+	inputs: none
+	output: next pending job to be executed, NULL if there is none
+	side effect: the job is no longer pending
+*/
+pending_t* get_next_pending_job(void) {
+	pending_t* job = pending_head;
+	if (job == NULL) return (pending_t*) NULL;
+	pending_head = job->next;
+	if (pending_head == NULL) pending_tail = NULL;
+	job->next = NULL;
+	return job;
+}
+
+/*  get_available_pending_job
+	description: takes a free pending slot
+	inputs: none
+	output: a slot that can be overwritten, NULL if all are used
+	side effect: the slot leaves the free list
+*/
+pending_t* get_available_pending_job(void) {
+	pending_t* job = free_pending;
+	if (job == NULL) return (pending_t*) NULL;
+	free_pending = job->next;
+	job->next = NULL;
+	return job;
+}
+
+/*  job_nice
+	description: gets the nice value of the process a job is currently running
+	inputs: job - some running job
+	output: its nice value, the highest MLFQ level it may be at
 	side effect: none
 */
-pending_t* pending_job_helper(bool used) {
-	int i;
-	for (i = 0; i < MAX_PIDS; i++) {
-		if (pending_jobs[i].in_use == used){
-			return &pending_jobs[i];
+uint32_t job_nice(running_t* job) {
+	if (job->fresh || job->kthread) return 0;
+	return get_nth_pcb(job->pid)->nice;
+}
+
+/*  job_affinity
+	description: gets the cpus a job may run on, set by the process it is currently running
+	inputs: job - some running job
+	output: bit i set if it may run on cpus[i], never 0
+	side effect: none
+*/
+uint32_t job_affinity(running_t* job) {
+	uint32_t mask = smp_online_mask();
+	if (job->fresh || job->kthread) return mask;
+	mask &= get_nth_pcb(job->pid)->cpu_mask;
+	// Set while more cpus were around, the BSP always is
+	return (mask == 0) ? 1 : mask;
+}
+
+/*  cpu_load
+	description: counts the jobs on a cpu, queued or running
+	inputs: cpu - index in cpus
+	output: number of jobs, the idle job doesn't count
+	side effect: none
+*/
+uint32_t cpu_load(uint32_t cpu) {
+	cpu_sched_t* sched = &cpu_sched[cpu];
+	return sched->queued + ((sched->running != &sched->idle) ? 1 : 0);
+}
+
+/*  select_cpu
+	description: picks the cpu whose run queues a job goes on: the one it last ran on,
+				 its cache is still warm there, or else the least loaded one it may run on
+	inputs: job - job about to be queued
+	output: index in cpus
+	side effect: none
+*/
+uint32_t select_cpu(running_t* job) {
+	uint32_t allowed = job_affinity(job);
+	uint32_t i, best = NO_CPU;
+	if (job->cpu != NO_CPU && (allowed & (1 << job->cpu))) return job->cpu;
+	for (i = 0; i < num_cpus; i++) {
+		if (!(allowed & (1 << i))) continue;
+		if (best == NO_CPU || cpu_load(i) < cpu_load(best)) best = i;
+	}
+	return best;
+}
+
+/*  enqueue_running_job
+	description: puts a runnable job at the back of its level's run queue, on the cpu
+				 select_cpu picks
+	inputs: job - job to queue, must not be on a run queue already
+	output: none
+	side effect: changes that cpu's run queues and the job's cpu
+*/
+void enqueue_running_job(running_t* job) {
+	job->cpu = select_cpu(job);
+	cpu_sched_t* sched = &cpu_sched[job->cpu];
+	run_queue_t* queue = &sched->queues[job->level];
+	spin_lock(&sched->lock);
+	job->next = NULL;
+	job->prev = queue->tail;
+	if (queue->tail == NULL)
+		queue->head = job;
+	else
+		queue->tail->next = job;
+	queue->tail = job;
+	sched->queued++;
+	spin_unlock(&sched->lock);
+}
+
+/*  unlink_job
+	description: takes a job off the run queue it is on, wherever in it. O(1).
+	inputs: sched - cpu whose queues the job is on, its lock held
+			job - the queued job, its level is the queue it is on
+	output: none
+	side effect: changes the cpu's run queues
+*/
+void unlink_job(cpu_sched_t* sched, running_t* job) {
+	run_queue_t* queue = &sched->queues[job->level];
+	if (job->prev == NULL)
+		queue->head = job->next;
+	else
+		job->prev->next = job->next;
+	if (job->next == NULL)
+		queue->tail = job->prev;
+	else
+		job->next->prev = job->prev;
+	job->next = NULL;
+	job->prev = NULL;
+	sched->queued--;
+}
+
+/*  dequeue_job
+	description: takes the job at the front of a cpu's lowest non empty level,
+				 i.e: round robin within a level
+	inputs: sched - cpu to take it from
+	output: the job, NULL if nothing is queued there
+	side effect: the job leaves its run queue
+*/
+running_t* dequeue_job(cpu_sched_t* sched) {
+	uint32_t level;
+	running_t* job = NULL;
+	spin_lock(&sched->lock);
+	for (level = 0; level < MLFQ_LEVELS; level++) {
+		job = sched->queues[level].head;
+		if (job != NULL) {
+			unlink_job(sched, job);
+			break;
 		}
 	}
-	return (pending_t*) NULL;
+	spin_unlock(&sched->lock);
+	return job;
 }
 
-/*  get_next_pending_job
-	description: finds next pending job that needs to be executed
+/*  get_next_running_job
+	description: takes the next job off this cpu's run queues
 	inputs: none
-	output: next pending job to be executed
+	output: next job to run... duh, NULL if none is queued here
+	side effect: the job leaves its run queue
+*/
+running_t* get_next_running_job(void) {
+	return dequeue_job(&cpu_sched[this_cpu_id()]);
+}
+
+/*  first_stealable
+	description: finds the most important job queued on a cpu that another one may run
+	inputs: sched - cpu the job is queued on, its lock held
+			cpu - the cpu that would run it
+	output: the job, NULL if none
 	side effect: none
 */
-pending_t* get_next_pending_job(void) {
-	return pending_job_helper(TRUE);
+running_t* first_stealable(cpu_sched_t* sched, uint32_t cpu) {
+	running_t* job;
+	uint32_t level;
+	for (level = 0; level < MLFQ_LEVELS; level++) {
+		for (job = sched->queues[level].head; job != NULL; job = job->next) {
+			if (job_affinity(job) & (1 << cpu)) return job;
+		}
+	}
+	return (running_t*) NULL;
 }
 
-/*  get_available_pending_job
-	description: finds next pending job that is free to overwrite
+/*  find_stealable
+	description: looks for the busiest other cpu with a job queued that a cpu could
+				 take, i.e: one whose affinity lets it go
+	inputs: cpu - the cpu that would run it
+	output: index in cpus, NO_CPU if there is none
+	side effect: none
+*/
+uint32_t find_stealable(uint32_t cpu) {
+	uint32_t i, victim = NO_CPU;
+	bool found;
+	for (i = 0; i < num_cpus; i++) {
+		// Unlocked peeks, steal_job looks again with the lock held
+		if (i == cpu || cpu_sched[i].queued == 0) continue;
+		if (victim != NO_CPU && cpu_sched[i].queued <= cpu_sched[victim].queued) continue;
+		spin_lock(&cpu_sched[i].lock);
+		found = (first_stealable(&cpu_sched[i], cpu) != NULL);
+		spin_unlock(&cpu_sched[i].lock);
+		if (found) victim = i;
+	}
+	return victim;
+}
+
+/*  steal_job
+	description: takes a job off the busiest other cpu for this one, when it ran out
 	inputs: none
-	output: next job that can be overwritten
+	output: the job, NULL if there is nothing to steal
+	side effect: the job moves to this cpu
+*/
+running_t* steal_job(void) {
+	uint32_t self = this_cpu_id();
+	uint32_t victim = find_stealable(self);
+	running_t* job;
+	if (victim == NO_CPU) return (running_t*) NULL;
+	spin_lock(&cpu_sched[victim].lock);
+	// Its own cpu may have picked it in the meantime
+	job = first_stealable(&cpu_sched[victim], self);
+	if (job != NULL) {
+		unlink_job(&cpu_sched[victim], job);
+		job->cpu = self;
+		steal_count++;
+	}
+	spin_unlock(&cpu_sched[victim].lock);
+	return job;
+}
+
+/*  higher_level_runnable
+	description: checks if some job queued on this cpu sits on a lower (better) level
+				 than the given one
+	inputs: level - level to compare against
+	output: TRUE if such a job exists
 	side effect: none
 */
-pending_t* get_available_pending_job(void) {
-	return pending_job_helper(FALSE);
+bool higher_level_runnable(uint32_t level) {
+	cpu_sched_t* sched = &cpu_sched[this_cpu_id()];
+	uint32_t i;
+	for (i = 0; i < level; i++) {
+		if (sched->queues[i].head != NULL) return TRUE;
+	}
+	return FALSE;
 }
 
-/*  get_next_running_job
-	description: read the function name dammit
+/*  boost_cpu_jobs
+	description: moves every job on a cpu, queued or running, back up to the top level
+				 its nice value allows. Blocked jobs go back up when they are woken.
+	inputs: sched - this cpu's
+	output: none
+	side effect: rebuilds the cpu's run queues, keeping the order within the old levels
+*/
+void boost_cpu_jobs(cpu_sched_t* sched) {
+	run_queue_t* queue;
+	running_t* queued = NULL;
+	running_t* last = NULL;
+	running_t* job;
+	uint32_t level;
+	spin_lock(&sched->lock);
+	// Chain every queued job, in level then queue order
+	for (level = 0; level < MLFQ_LEVELS; level++) {
+		queue = &sched->queues[level];
+		if (queue->head == NULL) continue;
+		if (last == NULL) queued = queue->head;
+		else last->next = queue->head;
+		queue->head->prev = last;
+		last = queue->tail;
+		queue->head = queue->tail = NULL;
+	}
+	// And put them back at their new level, in the same order
+	while (queued != NULL) {
+		job = queued;
+		queued = job->next;
+		job->level = job_nice(job);
+		job->used_ns = 0;
+		queue = &sched->queues[job->level];
+		job->next = NULL;
+		job->prev = queue->tail;
+		if (queue->tail == NULL)
+			queue->head = job;
+		else
+			queue->tail->next = job;
+		queue->tail = job;
+	}
+	spin_unlock(&sched->lock);
+	if (sched->running != &sched->idle) {
+		sched->running->level = job_nice(sched->running);
+		sched->running->used_ns = 0;
+	}
+}
+
+/*  charge_running
+	description: charges the cpu time since the last charge to the job on this cpu
+	inputs: sched - this cpu's
+	output: none
+	side effect: starts the next charge from now
+*/
+static void charge_running(cpu_sched_t* sched) {
+	uint64_t now = clock_ns();
+	if (sched->running != &sched->idle)
+		sched->running->used_ns += now - sched->slice_start;
+	sched->slice_start = now;
+}
+
+/*  tick_deadline
+	description: picks when the next tick should come: at the end of the running
+				 job's quantum, or a tick from now while it has to round robin with
+				 a more important job (or the cpu idles), which an already armed tick
+				 that comes sooner beats
+	inputs: sched - this cpu's
+			now - clock_ns
+			armed, at - the tick on its way, if any
+	output: clock_ns to tick at
+	side effect: none
+*/
+static uint64_t tick_deadline(cpu_sched_t* sched, uint64_t now, bool armed, uint64_t at) {
+	running_t* job = sched->running;
+	uint64_t quantum;
+	if (job == &sched->idle || higher_level_runnable(job->level)) {
+		if (armed && at < now + SCHED_TICK_NS) return at;
+		return now + SCHED_TICK_NS;
+	}
+	quantum = (uint64_t)mlfq_quantum[job->level] * SCHED_TICK_NS;
+	if (job->used_ns >= quantum) return now;
+	return sched->slice_start + (quantum - job->used_ns);
+}
+
+/*  mlfq_tick
+	description: charges the current job's cpu time and handles quantum expiry
 	inputs: none
-	output: next job to run... duh
+	output: TRUE if the current job should keep the cpu
+	side effect: may demote the current job
+*/
+bool mlfq_tick(void) {
+	if (curr_running == &idle_job || curr_running->blocked != JOB_AWAKE) return FALSE;
+	charge_running(&cpu_sched[this_cpu_id()]);
+
+	// Used up the whole quantum, move down a level and let others have a go
+	if (curr_running->used_ns + MLFQ_SLACK_NS >= (uint64_t)mlfq_quantum[curr_running->level] * SCHED_TICK_NS) {
+		curr_running->used_ns = 0;
+		if (curr_running->level < MLFQ_LEVELS - 1)
+			curr_running->level++;
+		return FALSE;
+	}
+	return !higher_level_runnable(curr_running->level);
+}
+
+/*  get_available_running_job
+	description: takes a free running slot, i.e: we can overwrite it with a new job
+	inputs: none
+	output: job we can overwrite, NULL if all are used
+	side effect: the slot leaves the free list
+*/
+running_t* get_available_running_job(void) {
+	running_t* job = free_running;
+	if (job == NULL) return (running_t*) NULL;
+	free_running = job->next;
+	job->next = NULL;
+	return job;
+}
+
+/*  release_running_job
+	description: gives a running slot back once its job is done
+	inputs: job - the finished job
+	output: none
+	side effect: changes the free list and running_size
+*/
+void release_running_job(running_t* job) {
+	spin_lock(&jobs_lock);
+	job->in_use = FALSE;
+	job->next = free_running;
+	free_running = job;
+	running_size--;
+	spin_unlock(&jobs_lock);
+}
+
+/*  has_runnable_job
+	description: checks if the scheduler has anything to switch to besides idle
+	inputs: none
+	output: TRUE if a job is pending or queued on some cpu
 	side effect: none
 */
-running_t* get_next_running_job(void) {
-	static int runningIdx = NO_JOBS;
-	int i;
-	for(i = 0; i < MAX_PIDS; i++) {
-		runningIdx++;
-		runningIdx %= MAX_PIDS;
-		if(running_jobs[runningIdx].in_use == TRUE) {
-			return &running_jobs[runningIdx];
+bool has_runnable_job(void) {
+	uint32_t i;
+	if (pending_size > 0) return TRUE;
+	for (i = 0; i < num_cpus; i++) {
+		if (cpu_sched[i].queued > 0) return TRUE;
+	}
+	return FALSE;
+}
+
+/*  cpu_has_work
+	description: checks if a cpu would find a job to switch to, on its own run queues,
+				 by stealing or by starting a pending job
+	inputs: cpu - index in cpus
+	output: TRUE if so
+	side effect: none
+*/
+bool cpu_has_work(uint32_t cpu) {
+	return pending_size > 0 || cpu_sched[cpu].queued > 0 || find_stealable(cpu) != NO_CPU;
+}
+
+/*  requeue_current_job
+	description: puts the job we are switching away from back on a run queue, unless
+				 it is going to sleep, finished or the idle job
+	inputs: none
+	output: none
+	side effect: changes run_queues, a sleeping job is marked JOB_ASLEEP
+*/
+void requeue_current_job(void) {
+	if (curr_running == &idle_job || !curr_running->in_use) return;
+	// Off the cpu for good, unless a wake_up got to it first
+	if (cmpxchg(&curr_running->blocked, JOB_SLEEPING, JOB_ASLEEP) == JOB_SLEEPING) return;
+	enqueue_running_job(curr_running);
+}
+
+/*  count_decision
+	description: records how long the decision started by schedule took
+	inputs: none
+	output: none
+	side effect: updates the overhead stats
+*/
+void count_decision(void) {
+	if (decision_start == 0) return;
+	uint32_t cycles = (uint32_t)rdtsc() - decision_start;
+	decision_start = 0;
+	decision_count++;
+	decision_total += cycles;
+	if (cycles > decision_max) decision_max = cycles;
+}
+
+/*  kick_idle_cpus
+	description: wakes the other processors sitting in their idle job that have a job
+				 waiting for them, on their own run queues or to steal. Ones that
+				 couldn't run any of them (affinity) are left alone.
+	inputs: none
+	output: none
+	side effect: sends RESCHED_VECTOR IPIs
+*/
+static void kick_idle_cpus(void) {
+	uint32_t self = this_cpu_id();
+	uint32_t i;
+	for (i = 0; i < num_cpus; i++) {
+		if (i == self || !cpus[i].online || cpu_sched[i].kicked) continue;
+		if (cpu_sched[i].running == &cpu_sched[i].idle && cpu_has_work(i)) {
+			cpu_sched[i].kicked = TRUE;
+			smp_send_ipi(i, RESCHED_VECTOR);
 		}
 	}
-	return (running_t*) NULL;
 }
 
-/*  get_available_running_job
-	description: gets next free job, i.e: we can overwrite it with a new job
+/*  tick_other_cpus
+	description: passes a PIT tick on to the other processors running a job, only the
+				 BSP gets the PIT
 	inputs: none
-	output: job we can overwrite
+	output: none
+	side effect: sends RESCHED_VECTOR IPIs
+*/
+static void tick_other_cpus(void) {
+	uint32_t self = this_cpu_id();
+	uint32_t i;
+	for (i = 0; i < num_cpus; i++) {
+		if (i == self || !cpus[i].online) continue;
+		if (cpu_sched[i].running != &cpu_sched[i].idle)
+			smp_send_ipi(i, RESCHED_VECTOR);
+	}
+}
+
+/*  ns_to_usecs
+	description: converts a delay for the timers, rounded up so they don't come early
+	inputs: ns - delay
+	output: usecs, at most 0xFFFFFFFF
 	side effect: none
 */
-running_t* get_available_running_job(void) {
-	int i;
-	for (i = 0; i < MAX_PIDS; i++) {
-		if (running_jobs[i].in_use == FALSE){
-			return &running_jobs[i];
+static uint32_t ns_to_usecs(uint64_t ns) {
+	ns += NSEC_PER_USEC - 1;
+	div64_32(&ns, NSEC_PER_USEC);
+	return (ns > 0xFFFFFFFF) ? 0xFFFFFFFF : (uint32_t)ns;
+}
+
+/*  update_apic_tick
+	description: update_tick with a local APIC timer per cpu. This cpu's tick is armed
+				 exactly when a job waits on its run queues (or to be started), for
+				 tick_deadline. Busy cpus that had a job queued by someone else are
+				 told to arm theirs.
+	inputs: none
+	output: none
+	side effect: arms or stops this cpu's APIC timer, may send IPIs
+*/
+static void update_apic_tick(void) {
+	uint32_t self = this_cpu_id();
+	cpu_sched_t* sched = &cpu_sched[self];
+	bool needed = sched->queued > 0 || pending_size > 0;
+	uint64_t now, deadline;
+	uint32_t i;
+	if (needed) {
+		now = clock_ns();
+		deadline = tick_deadline(sched, now, sched->tick_armed, sched->tick_at);
+		if (!sched->tick_armed || deadline != sched->tick_at) {
+			// Past the counter's range it comes early, and mlfq_tick re-arms it
+			apic_timer_arm(deadline > now ? ns_to_usecs(deadline - now) : 0);
+			sched->tick_at = deadline;
+			sched->tick_armed = TRUE;
 		}
+	} else if (sched->tick_armed) {
+		apic_timer_stop();
+		sched->tick_armed = FALSE;
 	}
-	return (running_t*) NULL;
+	if (!smp_active) return;
+	for (i = 0; i < num_cpus; i++) {
+		if (i == self || !cpus[i].online || cpu_sched[i].kicked) continue;
+		if (cpu_sched[i].running != &cpu_sched[i].idle && cpu_sched[i].queued > 0 &&
+			!cpu_sched[i].tick_armed) {
+			cpu_sched[i].kicked = TRUE;
+			smp_send_ipi(i, RESCHED_VECTOR);
+		}
+	}
+}
+
+/*  update_tick
+	description: in tickless mode, makes sure a timer tick is armed exactly when some
+				 job is waiting for the cpu, so a lone job or the idle job runs undisturbed.
+				 It comes at the end of the running job's quantum (see tick_deadline).
+				 Idle processors are woken for waiting jobs right away.
+	inputs: none
+	output: none
+	side effect: arms or stops the PIT or APIC timer, may send IPIs
+*/
+void update_tick(void) {
+	bool needed = has_runnable_job();
+	uint64_t now, deadline;
+	if (needed && smp_active) kick_idle_cpus();
+	if (!PIT_TICKLESS) return;
+	if (apic_timer_active) {
+		update_apic_tick();
+		return;
+	}
+	if (!needed) {
+		if (tick_armed) pit_set_deadline(PIT_EVENT_SCHED, PIT_NO_DEADLINE);
+		tick_armed = FALSE;
+		return;
+	}
+	now = clock_ns();
+	// The other cpus only get the ticks the BSP passes on, those stay a tick apart.
+	// The PIT is shared with the timer wheel, whichever is due first gets it.
+	if (smp_active)
+		deadline = tick_armed ? tick_at : now + SCHED_TICK_NS;
+	else
+		deadline = tick_deadline(&cpu_sched[this_cpu_id()], now, tick_armed, tick_at);
+	pit_set_deadline(PIT_EVENT_SCHED, deadline);
+	tick_at = deadline;
+	tick_armed = TRUE;
+}
+
+/*  kthread_tty
+	description: gets the terminal putc goes to while a kernel thread runs, the one of
+				 the process it works for or else the one in its own pcb header
+	inputs: job - a kernel thread
+	output: terminal id, HEADLESS_TTY if it doesn't print
+	side effect: none
+*/
+static int32_t kthread_tty(running_t* job) {
+	if (job->pid != KTHREAD_NO_PID) return get_nth_pcb(job->pid)->tid;
+	return ((pcb_t*)kthread_stacks[job - kthread_jobs])->tid;
+}
+
+/*  resume_next_running_job
+	description: context switches to the next running job, or the idle job if none
+				 can run
+	inputs: none
+	output: none, returns once the current job is picked again (right away if
+			nobody else can run)
+	side effect: changes curr_running, paging, vidmem and this cpu's tss
+*/
+void resume_next_running_job(void) {
+	charge_running(&cpu_sched[this_cpu_id()]);
+	requeue_current_job();
+	running_t* next = get_next_running_job();
+	// Ran out here, help out the busiest cpu instead of idling
+	if (next == NULL) next = steal_job();
+	if (next == NULL) next = &idle_job;
+	else next->cpu = this_cpu_id();
+	if (next == curr_running) {
+		update_tick();
+		count_decision();
+		return;
+	}
+	running_t* prev = curr_running;
+	cpu_t* cpu = this_cpu();
+	uint32_t next_esp;
+	// Woken on another cpu right as it went to sleep, it may not be all the way off
+	// that one yet (see sleep_on_locked)
+	while (next->esp == 0)
+		asm volatile("pause");
+	next_esp = next->esp;
+	next->esp = 0;
+	curr_running = next;
+	// Armed for next's quantum
+	update_tick();
+	count_decision();
+	// The cpu keeps holding the kernel lock, at whatever depth next left it
+	prev->lock_depth = cpu->lock_depth;
+	cpu->lock_depth = next->lock_depth;
+	// The idle job only touches kernel memory and never leaves ring 0,
+	// a fresh job sets all of this up itself when it starts its program
+	if (curr_running->kthread) {
+		// Never leaves ring 0 either, but may be working on a process' memory
+		if (curr_running->pid != KTHREAD_NO_PID)
+			add_process_page(curr_running->pid);
+		if (kthread_tty(curr_running) != HEADLESS_TTY)
+			set_vidmem(kthread_tty(curr_running));
+	} else if (curr_running != &idle_job && !curr_running->fresh) {
+		add_process_page(curr_running->pid);
+		set_vidmem(get_nth_pcb(curr_running->pid)->tid);
+		cpu->tss->esp0 = curr_running->esp0;
+		cpu->tss->ss0 = curr_running->ss0;
+	}
+	// The interrupt we got here from stops counting as handler time
+	irq_stats_switch();
+	// Comes back here once prev gets picked again
+	switch_to((uint32_t*)&prev->esp, next_esp);
 }
 
 
 // Core Functions
 
+/*  restore_job_vidmem
+	description: loads the terminal globals for the job on this cpu, another cpu may
+				 have left them on its own job's terminal (see kernel_lock)
+	inputs: none
+	output: none
+	side effect: set_vidmem
+*/
+void restore_job_vidmem(void) {
+	int32_t tty;
+	// Kernel threads drop the lock between the parts that need it
+	if (curr_running != &idle_job && curr_running->kthread) {
+		tty = kthread_tty(curr_running);
+		if (tty != HEADLESS_TTY) set_vidmem(tty);
+		return;
+	}
+	// Fresh jobs never leave the kernel, so never come back in
+	if (curr_running == &idle_job || curr_running->fresh) return;
+	tty = get_current_pcb()->tid;
+	if (tty >= 0 && tty < MAX_TERMINALS)
+		set_vidmem(tty);
+}
+
+/*  init_cpu_scheduling
+	description: makes the calling processor's boot context its idle job, with nothing
+				 on its run queues
+	inputs: none
+	output: none
+	side effect: none
+*/
+void init_cpu_scheduling(void) {
+	cpu_sched_t* sched = &cpu_sched[this_cpu_id()];
+	int32_t i;
+	sched->running = &sched->idle;
+	sched->kicked = FALSE;
+	sched->tick_armed = FALSE;
+	sched->queued = 0;
+	sched->slice_start = clock_ns();
+	sched->boost_at = sched->slice_start + (uint64_t)MLFQ_BOOST_TICKS * SCHED_TICK_NS;
+	sched->timer_irqs = 0;
+	spin_lock_init(&sched->lock, &run_queue_stats);
+	for (i = 0; i < MLFQ_LEVELS; i++) {
+		sched->queues[i].head = NULL;
+		sched->queues[i].tail = NULL;
+	}
+}
+
 /*  init_scheduling
 	description: initializes scheduling by setting all global variables to zero as no jobs have been scheduled yet
 	inputs: none
@@ -123,119 +837,281 @@ running_t* get_available_running_job(void) {
 	side effect: none
 */
 void init_scheduling(void) {
-	curr_running = NULL;
+	init_cpu_scheduling();
 	running_size = 0;
 	pending_size = 0;
-	uint32_t i;
-	for (i = 0; i < MAX_PIDS; i++) {
+	pending_head = NULL;
+	pending_tail = NULL;
+	free_running = NULL;
+	free_pending = NULL;
+	int32_t i;
+	// Build the free lists so the first slots get handed out first
+	for (i = 0; i < MAX_KTHREADS; i++)
+		kthread_jobs[i].in_use = FALSE;
+	for (i = MAX_PIDS - 1; i >= 0; i--) {
 		running_jobs[i].in_use = FALSE;
+		running_jobs[i].next = free_running;
+		free_running = &running_jobs[i];
 		pending_jobs[i].in_use = FALSE;
+		pending_jobs[i].next = free_pending;
+		free_pending = &pending_jobs[i];
 	}
 }
 
+/*  init_job_frame
+	description: lays out the frame a new job is first switched to: zeroed callee-saved
+				 registers and a return into job_entry, on the job's start stack
+	inputs: job - the new job
+	output: none
+	side effect: sets the job's saved esp
+*/
+void init_job_frame(running_t* job) {
+	uint32_t* top = &start_stacks[job - running_jobs][START_STACK_SIZE / sizeof(uint32_t)];
+	int i;
+	*(--top) = (uint32_t)job_entry;
+	// ebp, ebx, esi, edi as switch_to pops them
+	for (i = 0; i < SWITCH_SAVED_REGS; i++)
+		*(--top) = 0;
+	job->esp = (uint32_t)top;
+}
+
 /*  execute_pending_job
-	description: takes a job off of pending_jobs and tries to execute it.
+	description: takes a job off of pending_jobs and makes it runnable, it starts its
+				 program the first time it gets picked
 	inputs: none
 	output: 0 if success, -1 on error
 	side effect: changs both queues
 */
 int32_t execute_pending_job(void) {
+	spin_lock(&jobs_lock);
 	// Get pendng job and get a free running job
+	if (pending_head == NULL || free_running == NULL) {
+		spin_unlock(&jobs_lock);
+		return -1;
+	}
 	pending_t* to_execute = get_next_pending_job();
-	running_t* next_running = get_available_running_job();
-	if (to_execute == NULL) return -1;
-	if (next_running == NULL) return -1;
-	// If possible execute the pending job
-	curr_running = next_running;
-	running_size++;
+	running_t* job = get_available_running_job();
 	pending_size--;
-	to_execute->in_use = FALSE;
-	curr_running->return_status = to_execute->return_status;
-	curr_running->in_use = TRUE;
-	int32_t retval = system_execute_helper(to_execute->command, to_execute->tid, FALSE, to_execute->haltable);
-	// Return the exit status code to the process that scheduled this job
-	if (curr_running->return_status != NULL)
-		*(curr_running->return_status) = retval;
-	// Remove from running
-	curr_running->in_use = FALSE;
-	running_size--;
+	running_size++;
 
-	// Context switch to next running
-	curr_running = get_next_running_job();
-	add_process_page(curr_running->pid);
-	set_vidmem(get_nth_pcb(curr_running->pid)->tid);
-	tss.esp0 = curr_running->esp0;
-	tss.ss0 = curr_running->ss0;
-	asm volatile(
-		"movl %1, %%ebp;"
-		"movl %0, %%esp;"
-		"sti;"
-		"leave;"
-		"ret;"
-		:
-		:"r"(curr_running->esp), "r"(curr_running->ebp)
-	);
+	// Copy the job out, its slot goes straight back on the free list
+	job->start = *to_execute;
+	to_execute->in_use = FALSE;
+	to_execute->next = free_pending;
+	free_pending = to_execute;
+	spin_unlock(&jobs_lock);
 
+	job->in_use = TRUE;
+	job->fresh = TRUE;
+	job->kthread = FALSE;
+	job->blocked = JOB_AWAKE;
+	job->cancelled = FALSE;
+	job->wait_next = NULL;
+	job->level = 0;
+	job->used_ns = 0;
+	job->lock_depth = 1;	// In the kernel until start_job's iret
+	job->cpu = NO_CPU;
+	job->return_status = job->start.return_status;
+	init_job_frame(job);
+	enqueue_running_job(job);
 	return 0;
 }
 
-/*  schedulerHandler
-	description: The function that executes on receiving a PIT interrupt, it performs a context switch and executes the next process until an interrupt
+/*  start_job
+	description: runs on a new job's start stack (see job_entry) and starts its program
 	inputs: none
+	output: none, never returns
+	side effect: the job becomes a process, or finishes right away if that fails
+*/
+void start_job(void) {
+	running_t* self = curr_running;
+	pending_t* job = &self->start;
+	self->fresh = FALSE;
+	// The new process takes over the snapshot's pipe references, we only drop them if it never starts
+	file_t* stdio = (job->has_stdio) ? job->stdio : NULL;
+	int32_t retval = system_execute_helper(job->command, job->tid, FALSE, job->haltable, stdio);
+
+	// Only get here if the program couldn't be started
+	if (stdio != NULL) {
+		pipe_release(&stdio[0]);
+		pipe_release(&stdio[1]);
+	}
+	finish_running_job(retval);
+}
+
+/*  schedule
+	description: the scheduler proper, saves the current job and picks who runs next
+				 on this cpu
+	inputs: from_timer - TRUE for a tick (timer or passed on by the BSP), charged to the
+						 current job, FALSE for a yield or a tick timer_tick charged already
 	output: none
 	side effect: switches between processes which involves manipulating the stack and paging
 */
-
-void schedulerHandler(void) {
-	/* Assume that the current running job is at index curr_running */
+static void schedule(bool from_timer) {
+	cpu_t* cpu = this_cpu();
+	// Device handlers run on the cpu's interrupt stack, nothing to switch away from
+	// there. do_IRQ calls irq_resched once they're done.
+	if (cpu->irq_depth > 0) {
+		cpu->need_resched = TRUE;
+		return;
+	}
 	/* Assume that sys_execute for root shells never returns, i.e: shell can't exit */
-
+	cpu_sched[this_cpu_id()].kicked = FALSE;
 	// if no running and no pending return.
 	if (pending_size == 0 && running_size == 0) return;
-	// if curr_running == NULL: nothing ever ran,
-	cli();
-	send_eoi(PIT_PIC_LINE);
-	if (curr_running == NULL) {
-		// see if pending, sys_execute pending
-		execute_pending_job();
-		return;
-	} else {
+	decision_start = (uint32_t)rdtsc();
+	if (curr_running->kthread) {
+		// Nothing to save but the state of the terminal it prints to
+		if (kthread_tty(curr_running) != HEADLESS_TTY)
+			get_vidmem(kthread_tty(curr_running));
+	} else if (curr_running != &idle_job) {
 		// Save job data at curr_running, assume we're in a process.
 		pcb_t* pcb = get_current_pcb();
 		get_vidmem(pcb->tid);
 		curr_running->pid = pcb->process_id;
 		curr_running->in_use = TRUE;
-		curr_running->esp0 = tss.esp0;
-		curr_running->ss0 = tss.ss0;
-		// save esp and ebp into the structs
-		asm volatile(
-			"movl %%esp, %0;"
-			"movl %%ebp, %1;"
-			:"=rm"(curr_running->esp),"=rm"(curr_running->ebp)
-		);
-		// if there are pending task and we can schedule them do it
-		if (running_size < MAX_PIDS && pending_size > 0) {
-			// Try to execute a pending job
-			execute_pending_job();
+		curr_running->esp0 = this_cpu()->tss->esp0;
+		curr_running->ss0 = this_cpu()->tss->ss0;
+	}
+	// if there are pending task and we can schedule them do it
+	if (free_running != NULL && pending_size > 0) {
+		// The new job waits on the run queue like everyone else
+		execute_pending_job();
+	}
+	if (from_timer && mlfq_tick()) {
+		// Quantum not used up and nobody more important, keep going
+		update_tick();
+		count_decision();
+		return;
+	} else {
+		// Context switch to next running
+		resume_next_running_job();
+	}
+}
+
+/*  timer_tick
+	description: a scheduler tick on this cpu, from its own timer or passed on by the
+				 BSP. Boosting this cpu's jobs and charging the tick to the current job
+				 only touch this cpu's run queues (under their own lock), so with APIC
+				 timers a tick that lets the job keep going never takes the big kernel
+				 lock. Switching jobs or starting pending ones takes it.
+	inputs: none
+	output: none
+	side effect: see schedule
+*/
+static void timer_tick(void) {
+	cpu_t* cpu = this_cpu();
+	cpu_sched_t* sched = &cpu_sched[this_cpu_id()];
+	bool charged = FALSE;
+	uint64_t now = clock_ns();
+	if (now >= sched->boost_at) {
+		sched->boost_at = now + (uint64_t)MLFQ_BOOST_TICKS * SCHED_TICK_NS;
+		boost_cpu_jobs(sched);
+	}
+	// Device handlers run on the cpu's interrupt stack, see schedule
+	if (cpu->irq_depth > 0) {
+		cpu->need_resched = TRUE;
+		return;
+	}
+	// Without APIC timers update_tick programs the PIT, which every cpu shares
+	if (apic_timer_active && pending_size == 0) {
+		// Idle with nothing to pick up, a tick that was already on its way
+		if (sched->running == &sched->idle && sched->queued == 0) {
+			update_tick();
 			return;
-		} else {
-			// Context switch to next running
-			curr_running = get_next_running_job();
-			add_process_page(curr_running->pid);
-			set_vidmem(get_nth_pcb(curr_running->pid)->tid);
-			tss.esp0 = curr_running->esp0;
-			tss.ss0 = curr_running->ss0;
-			asm volatile(
-				"movl %1, %%ebp;"
-				"movl %0, %%esp;"
-				"sti;"
-				"leave;"
-				"ret;"
-				:
-				:"r"(curr_running->esp), "r"(curr_running->ebp)
-			);
 		}
+		if (mlfq_tick()) {
+			update_tick();
+			return;
+		}
+		charged = TRUE;
 	}
+	kernel_lock();
+	schedule(!charged);
+	kernel_unlock();
+}
+
+/*  schedulerHandler
+	description: The function that executes on receiving a PIT interrupt (only the BSP
+				 gets them), it performs a context switch and executes the next process
+				 until an interrupt. Its one shots are shared with the timer wheel, with
+				 APIC timers they are only the wheel's.
+	inputs: none
+	output: none
+	side effect: passes the tick on to the other cpus, runs due kernel timers
+*/
+void schedulerHandler(void) {
+	uint32_t events = PIT_EVENT_MASK(PIT_EVENT_SCHED);
+	send_eoi(PIT_PIC_LINE);
+	cpu_sched[this_cpu_id()].timer_irqs++;
+	if (PIT_TICKLESS || apic_timer_active) events = pit_expired_events();
+	if (events & PIT_EVENT_MASK(PIT_EVENT_WHEEL)) timer_interrupt();
+	if (apic_timer_active || !(events & PIT_EVENT_MASK(PIT_EVENT_SCHED))) return;
+	// A one shot tick only fires once
+	tick_armed = FALSE;
+	if (smp_active) tick_other_cpus();
+	timer_tick();
+}
+
+/*  apicTimerHandler
+	description: TIMER_VECTOR, this cpu's local APIC timer, the tick schedulerHandler
+				 gets from the PIT otherwise. Comes in without the big kernel lock
+				 (tick_interrupt in idt.S).
+	inputs: none
+	output: none
+	side effect: see timer_tick
+*/
+void apicTimerHandler(void) {
+	lapic_eoi();
+	cpu_sched[this_cpu_id()].tick_armed = FALSE;
+	cpu_sched[this_cpu_id()].timer_irqs++;
+	timer_tick();
+}
+
+/*  reschedHandler
+	description: RESCHED_VECTOR, the BSP passing on a PIT tick or waking this cpu
+				 from idle for a job that became runnable. With APIC timers a busy
+				 cpu only has to start its own for a job queued on it. Comes in
+				 without the big kernel lock (tick_interrupt in idt.S).
+	inputs: none
+	output: none
+	side effect: see schedule
+*/
+void reschedHandler(void) {
+	lapic_eoi();
+	if (!apic_timer_active) {
+		timer_tick();
+		return;
+	}
+	cpu_sched[this_cpu_id()].kicked = FALSE;
+	if (curr_running != &idle_job) {
+		update_tick();
+		return;
+	}
+	kernel_lock();
+	schedule(TRUE);
+	kernel_unlock();
+}
+
+/*  irq_resched
+	description: the tick (or IPI) that came in while device handlers ran on this cpu,
+				 once they're done and we're back on the job's stack
+	inputs: none
+	output: none
+	side effect: see schedule
+*/
+void irq_resched(void) {
+	schedule(TRUE);
+}
+
+/*  yieldHandler
+	description: YIELD_VECTOR, the current job giving up the cpu (scheduler_yield)
+	inputs: none
+	output: none
+	side effect: see schedule
+*/
+void yieldHandler(void) {
+	schedule(FALSE);
 }
 
 
@@ -245,15 +1121,400 @@ void schedulerHandler(void) {
 	output: 0 if success, -1 on error
 	side effect: changes pending_jobs
 */
-int32_t schedule_job(const uint8_t* command, int32_t* retval, int32_t tid, uint8_t haltable) {
+int32_t schedule_job(const uint8_t* command, int32_t* retval, int32_t tid, uint8_t haltable, file_t* stdio) {
+	if (tid < 0 || tid >= MAX_TERMINALS) return -1;
+	uint32_t flags;
+	spin_lock_irqsave(&jobs_lock, flags);
 	pending_t* to_schedule = get_available_pending_job();
-	if (to_schedule == NULL || tid < 0 || tid >= MAX_TERMINALS) return -1;
+	if (to_schedule == NULL) {
+		spin_unlock_irqrestore(&jobs_lock, flags);
+		return -1;
+	}
 	// Add to pending_jobs to be executed later
 	strncpy((int8_t*)to_schedule->command, (int8_t*)command, MAX_COMMAND_SIZE);
 	to_schedule->in_use = TRUE;
+	to_schedule->next = NULL;
 	to_schedule->return_status = retval;
 	to_schedule->tid = tid;
 	to_schedule->haltable = haltable;
+	to_schedule->has_stdio = (stdio != NULL);
+	if (stdio != NULL) {
+		// Snapshot stdin/stdout, the pipe ends stay referenced until the job starts
+		to_schedule->stdio[0] = stdio[0];
+		to_schedule->stdio[1] = stdio[1];
+		pipe_dup(&to_schedule->stdio[0]);
+		pipe_dup(&to_schedule->stdio[1]);
+	}
+	// Append to the FIFO so jobs start in the order they were scheduled
+	if (pending_tail == NULL)
+		pending_head = to_schedule;
+	else
+		pending_tail->next = to_schedule;
+	pending_tail = to_schedule;
 	pending_size++;
+	spin_unlock(&jobs_lock);
+	update_tick();
+	restore_flags(flags);
 	return 0;
 }
+
+/*  finish_running_job
+	description: called by a haltable job with no parent when it halts, hands its
+				 exit status to whoever scheduled it and switches to the next job
+	inputs: status - exit status of the job
+	output: none, never returns
+	side effect: frees the current running job, abandons the current kernel stack
+*/
+void finish_running_job(int32_t status) {
+	cli();
+	if (curr_running->return_status != NULL)
+		*(curr_running->return_status) = status;
+	release_running_job(curr_running);
+	// Never comes back, at worst we switch to the idle job
+	resume_next_running_job();
+}
+
+/*  kthread_create
+	description: starts a kernel thread, it runs fn(arg) with interrupts on and exits
+				 when fn returns (or calls kthread_exit). fn runs without the big kernel
+				 lock, so a thread busy on one cpu doesn't hold up interrupts on the
+				 others. It takes the lock (kernel_lock) around anything that isn't
+				 covered by a lock of its own, sleeping and waking need none.
+	inputs: fn - thread body
+			arg - passed to fn
+			pid - process the thread works for, its files, memory and terminal are the
+				  thread's (get_current_pcb returns its pcb), KTHREAD_NO_PID for none.
+				  Without one get_current_pcb is the thread's own header, headless
+				  until the thread sets its tid (with interrupts off, along with
+				  set_vidmem) to print somewhere.
+	output: 0 on success, -1 if all MAX_KTHREADS are in use
+	side effect: the thread is runnable right away
+*/
+int32_t kthread_create(kthread_fn_t fn, void* arg, uint32_t pid) {
+	uint32_t flags;
+	int32_t i;
+	spin_lock_irqsave(&jobs_lock, flags);
+	for (i = 0; i < MAX_KTHREADS; i++) {
+		if (!kthread_jobs[i].in_use) break;
+	}
+	if (i == MAX_KTHREADS) {
+		spin_unlock_irqrestore(&jobs_lock, flags);
+		return -1;
+	}
+	running_t* job = &kthread_jobs[i];
+	// Claimed, the rest is ours alone
+	job->in_use = TRUE;
+	running_size++;
+	spin_unlock(&jobs_lock);
+	// Where a process keeps its pcb, see get_current_pcb
+	pcb_t* header = (pcb_t*)kthread_stacks[i];
+	memset(header, 0, sizeof(pcb_t));
+	header->process_id = KTHREAD_PCB_MARK;
+	header->parent_id = (pid == KTHREAD_NO_PID) ? -1 : (int32_t)pid;
+	header->tid = HEADLESS_TTY;
+
+	// switch_to pops edi, esi, ebx, ebp and returns into kthread_entry, which
+	// calls ebx with esi
+	uint32_t* top = (uint32_t*)&kthread_stacks[i][KTHREAD_STACK_SIZE];
+	*(--top) = (uint32_t)kthread_entry;
+	*(--top) = 0;
+	*(--top) = (uint32_t)fn;
+	*(--top) = (uint32_t)arg;
+	*(--top) = 0;
+	job->esp = (uint32_t)top;
+
+	job->pid = pid;
+	job->fresh = FALSE;
+	job->kthread = TRUE;
+	job->blocked = JOB_AWAKE;
+	job->cancelled = FALSE;
+	job->wait_next = NULL;
+	job->level = 0;
+	job->used_ns = 0;
+	job->lock_depth = 1;	// The switch's, kthread_entry drops it
+	job->cpu = NO_CPU;
+	job->return_status = NULL;
+	enqueue_running_job(job);
+	update_tick();
+	restore_flags(flags);
+	return 0;
+}
+
+/*  kthread_exit
+	description: ends the current kernel thread
+	inputs: none
+	output: none, never returns
+	side effect: frees its slot and stack once we have switched away
+*/
+void kthread_exit(void) {
+	// Switching needs the big kernel lock, the next job inherits it
+	kernel_lock();
+	cli();
+	spin_lock(&jobs_lock);
+	curr_running->in_use = FALSE;
+	running_size--;
+	spin_unlock(&jobs_lock);
+	resume_next_running_job();
+}
+
+/*  init_wait_queue
+	description: sets up a wait queue that isn't zero initialized
+	inputs: queue - the queue
+	output: none
+	side effect: the queue is empty
+*/
+void init_wait_queue(wait_queue_t* queue) {
+	spin_lock_init(&queue->lock, NULL);
+	queue->head = NULL;
+}
+
+/*  sleep_on
+	description: blocks the current job on a wait queue until wake_up is called on it.
+				 Must be called with interrupts off, after checking the condition being
+				 waited on, and the caller should check it again once this returns.
+	inputs: queue - queue to wait on
+	output: 0 once woken, -1 if the sleep was cancelled (see kthread_cancel), the
+			caller should give up then instead of checking again
+	side effect: other jobs run in the meantime, the idle job if none can
+*/
+int32_t sleep_on(wait_queue_t* queue) {
+	return sleep_on_locked(queue, NULL);
+}
+
+/*  sleep_on_locked
+	description: sleep_on for a condition a spinlock protects, the lock is let go while
+				 we sleep, so a wake_up under the same lock can't slip in between
+				 checking and sleeping. The wait queue has a lock of its own, nothing
+				 else has to be held.
+				 Going to sleep is in two steps: JOB_SLEEPING once we are on the queue,
+				 JOB_ASLEEP once requeue_current_job takes us off the cpu. A wake_up
+				 before that only marks us JOB_AWAKE, so we never go off the cpu, after
+				 that it puts us on a run queue (wake_job). Whoever picks us then waits
+				 for switch_to to have saved our stack, see resume_next_running_job.
+	inputs: queue - queue to wait on
+			lock - held by the caller with interrupts off, NULL for none
+	output: 0 once woken, -1 if cancelled, see sleep_on
+	side effect: the lock is held again once this returns
+*/
+int32_t sleep_on_locked(wait_queue_t* queue, spinlock_t* lock) {
+	running_t* self = curr_running;
+	uint32_t latency;
+	// Not a scheduled job (still booting), just wait for the next interrupt
+	if (self == &idle_job) {
+		if (lock != NULL) spin_unlock(lock);
+		asm volatile("sti; hlt; cli;");
+		if (lock != NULL) spin_lock(lock);
+		return 0;
+	}
+	// Nobody is left to hand the result to
+	if (self->cancelled) return -1;
+	spin_lock(&queue->lock);
+	self->waiting_on = queue;
+	self->wait_next = queue->head;
+	queue->head = self;
+	self->blocked = JOB_SLEEPING;
+	spin_unlock(&queue->lock);
+	// Never hold a lock across a switch
+	if (lock != NULL) spin_unlock(lock);
+	// The scheduler won't pick us again until we are woken
+	while (self->blocked != JOB_AWAKE)
+		scheduler_yield();
+	if (lock != NULL) spin_lock(lock);
+	if (self->cancelled) return -1;
+
+	latency = (uint32_t)rdtsc() - self->woken_tsc;
+	wakeup_count++;
+	wakeup_total += latency;
+	if (latency > wakeup_max) wakeup_max = latency;
+	return 0;
+}
+
+/*  wake_job
+	description: makes a job just taken off a wait queue runnable again. Interrupts
+				 must be off.
+	inputs: job - the job, on no wait queue anymore
+	output: none
+	side effect: queues the job if it already went off its cpu, see sleep_on_locked
+*/
+static void wake_job(running_t* job) {
+	job->woken_tsc = (uint32_t)rdtsc();
+	// Still on its cpu, it will see this and keep going
+	if (xchg(&job->blocked, JOB_AWAKE) != JOB_ASLEEP) return;
+	// Gave up the cpu for I/O, back to the top (as far as nice allows)
+	job->level = job_nice(job);
+	job->used_ns = 0;
+	enqueue_running_job(job);
+}
+
+/*  kthread_cancel
+	description: cancels what the kernel threads working for a process wait for, once
+				 the process is gone. Their current sleep and any later one return -1.
+	inputs: pid - the process
+	output: none
+	side effect: sleeping threads are taken off their wait queue and made runnable
+*/
+void kthread_cancel(uint32_t pid) {
+	running_t* job;
+	running_t** link;
+	wait_queue_t* queue;
+	uint32_t flags;
+	int32_t i;
+	bool found;
+	cli_and_save(flags);
+	for (i = 0; i < MAX_KTHREADS; i++) {
+		job = &kthread_jobs[i];
+		if (!job->in_use || job->pid != pid) continue;
+		job->cancelled = TRUE;
+		if (job->blocked == JOB_AWAKE) continue;
+		// A wake_up may have taken it off the queue already, then that wakes it
+		queue = job->waiting_on;
+		found = FALSE;
+		spin_lock(&queue->lock);
+		for (link = &queue->head; *link != NULL; link = &(*link)->wait_next) {
+			if (*link == job) {
+				*link = job->wait_next;
+				job->wait_next = NULL;
+				found = TRUE;
+				break;
+			}
+		}
+		spin_unlock(&queue->lock);
+		if (found) wake_job(job);
+	}
+	update_tick();
+	restore_flags(flags);
+}
+
+/*  wake_up
+	description: makes every job sleeping on a queue runnable again, called from
+				 interrupt handlers
+	inputs: queue - queue to empty
+	output: none
+	side effect: woken jobs get picked by the scheduler again
+*/
+void wake_up(wait_queue_t* queue) {
+	running_t* job;
+	running_t* next;
+	uint32_t flags;
+	// Device handlers run with interrupts on, and one may wake a job on top of another
+	cli_and_save(flags);
+	spin_lock(&queue->lock);
+	job = queue->head;
+	queue->head = NULL;
+	spin_unlock(&queue->lock);
+	while (job != NULL) {
+		next = job->wait_next;
+		job->wait_next = NULL;
+		wake_job(job);
+		job = next;
+	}
+	// Someone may have to be preempted for the jobs we just woke
+	update_tick();
+	restore_flags(flags);
+}
+
+/*  scheduler_yield
+	description: gives up the rest of the current time slice, used by blocking kernel
+				 calls instead of spinning. Goes through its own interrupt vector so the
+				 context is saved exactly as if the timer had fired.
+	inputs: none
+	output: none
+	side effect: other jobs run before this returns
+*/
+void scheduler_yield(void) {
+	asm volatile("int %0;" : : "i"(YIELD_VECTOR));
+}
+
+/*  idle_loop
+	description: the idle job, what the boot context of each cpu turns into once
+				 everything is set up. Halts until the next interrupt and hands the cpu back as soon
+				 as that interrupt made a job runnable, instead of waiting for the PIT.
+	inputs: none
+	output: none, never returns
+	side effect: none
+*/
+void idle_loop(void) {
+	while (1) {
+		asm volatile("sti; hlt;");
+		cli();
+		if (cpu_has_work(this_cpu_id()))
+			scheduler_yield();
+	}
+}
+
+/*  print_sched_stats
+	description: prints how long woken jobs waited before running again, how long
+				 scheduling decisions take (in TSC cycles) and interrupts per second,
+				 then starts counting over
+	inputs: none
+	output: none
+	side effect: writes to the current terminal, resets the stats
+*/
+void print_sched_stats(void) {
+	uint32_t i, timer_irqs = 0;
+	// No 64 bit division in the kernel, wakeup average in units of 1024 cycles
+	uint32_t avg = (wakeup_count == 0) ? 0 : (uint32_t)(wakeup_total >> 10) / wakeup_count;
+	printf("wakeups: %u, avg latency: %u kcycles, max latency: %u cycles\n",
+		wakeup_count, avg, wakeup_max);
+	// Decisions are short, the total fits in 32 bits for a good while
+	avg = (decision_count == 0) ? 0 : (uint32_t)decision_total / decision_count;
+	printf("decisions: %u, avg: %u cycles, max: %u cycles, runnable: %d jobs\n",
+		decision_count, avg, decision_max, running_size);
+	// timer_now counts MAX_FREQ ticks a second, use it as the clock for the rates
+	unsigned long elapsed = timer_now() - stats_since;
+	if (elapsed == 0) elapsed = 1;
+	printf("steals: %u, queued:", steal_count);
+	for (i = 0; i < num_cpus; i++)
+		printf(" %u", cpu_sched[i].queued);
+	printf("\n");
+	for (i = 0; i < num_cpus; i++) {
+		timer_irqs += cpu_sched[i].timer_irqs;
+		cpu_sched[i].timer_irqs = 0;
+	}
+	printf("over %u ms: %u timer interrupts/s, %u device, %u interrupts/s in all (%s %s)\n",
+		(uint32_t)(elapsed * 1000 / MAX_FREQ), (uint32_t)(timer_irqs * MAX_FREQ / elapsed),
+		(uint32_t)(device_irqs * MAX_FREQ / elapsed), (uint32_t)(all_irqs * MAX_FREQ / elapsed),
+		PIT_TICKLESS ? "tickless" : "periodic", apic_timer_active ? "apic" : "pit");
+	wakeup_count = wakeup_total = wakeup_max = 0;
+	decision_count = decision_total = decision_max = 0;
+	steal_count = 0;
+	device_irqs = 0;
+	all_irqs = 0;
+	stats_since = timer_now();
+}
+
+/*  system_nice
+	description: sets the nice value of the calling process, i.e: the highest MLFQ level
+				 it can be at. Children started with execute inherit it.
+	inputs: nice - 0 (default, most important) to MLFQ_LEVELS-1
+	output: the previous nice value, -1 on error
+	side effect: may move the current job down right away
+*/
+int32_t system_nice(int32_t nice) {
+	if (nice < 0 || nice >= MLFQ_LEVELS) return -1;
+	pcb_t* pcb = get_current_pcb();
+	int32_t old = pcb->nice;
+	pcb->nice = nice;
+	if (curr_running != &idle_job && curr_running->level < nice)
+		curr_running->level = nice;
+	return old;
+}
+
+/*  system_set_affinity
+	description: sets the cpus the calling process may run on. Children started with
+				 execute inherit it.
+	inputs: mask - bit i set if it may run on the i-th cpu, only online ones count
+	output: the previous mask (limited to online cpus), -1 if mask has no online cpu
+	side effect: moves the current job to another cpu right away if it has to
+*/
+int32_t system_set_affinity(uint32_t mask) {
+	uint32_t online = smp_online_mask();
+	if ((mask & online) == 0) return -1;
+	pcb_t* pcb = get_current_pcb();
+	int32_t old = pcb->cpu_mask & online;
+	pcb->cpu_mask = mask & CPU_MASK_ALL;
+	// Requeueing puts us on a cpu we may run on
+	if (!(mask & (1 << this_cpu_id())))
+		scheduler_yield();
+	return old;
+}
@@ -6,13 +6,64 @@
 #include "paging.h"
 #include "i8259.h"
 #include "terminal.h"
+#include "fs.h"
+#include "spinlock.h"
 
 #define NO_JOBS		(-1)
 #define PIT_PIC_LINE	(0)
+#define MLFQ_LEVELS		(3)
+#define MLFQ_BOOST_TICKS	(50)	// 1 second at PIT_SPEED_HZ
+#define START_STACK_SIZE	(4096)	// Enough for system_execute_helper
+#define SWITCH_SAVED_REGS	(4)		// ebp, ebx, esi, edi
+#define MAX_KTHREADS		(8)
+#define KTHREAD_STACK_SIZE	(8192)	// Same size and alignment as a process' kernel stack
+#define KTHREAD_NO_PID		(0xFFFFFFFF)
+#define NO_CPU				(0xFFFFFFFF)	// A job that hasn't been placed on a cpu yet
+
+struct running;
+
+/*
+ * wait_queue_t : jobs blocked until an interrupt handler calls wake_up on the queue,
+ *				  linked through the jobs themselves. Zero initialized is empty.
+ */
+typedef struct {
+	spinlock_t lock;		// Covers head, sleep_on and wake_up need nothing else held
+	struct running* head;
+} wait_queue_t;
+
+// Assembly linkage in switch.S
+extern void switch_to(uint32_t* prev_esp, uint32_t next_esp);
+extern void job_entry(void);
+extern void kthread_entry(void);
+
+typedef void (*kthread_fn_t)(void* arg);
 
 // Core Functions
 void init_scheduling(void);
+void init_cpu_scheduling(void);
 void schedulerHandler(void);
-int32_t schedule_job(const uint8_t* command, int32_t* retval, int32_t tid, uint8_t haltable);
+void reschedHandler(void);
+void apicTimerHandler(void);
+void irq_resched(void);
+void yieldHandler(void);
+int32_t schedule_job(const uint8_t* command, int32_t* retval, int32_t tid, uint8_t haltable, file_t* stdio);
+void finish_running_job(int32_t status);
+void start_job(void);
+void scheduler_yield(void);
+void init_wait_queue(wait_queue_t* queue);
+int32_t sleep_on(wait_queue_t* queue);
+int32_t sleep_on_locked(wait_queue_t* queue, spinlock_t* lock);
+void wake_up(wait_queue_t* queue);
+void idle_loop(void);
+void update_tick(void);
+void restore_job_vidmem(void);
+int32_t kthread_create(kthread_fn_t fn, void* arg, uint32_t pid);
+void kthread_exit(void);
+void kthread_cancel(uint32_t pid);
+void print_sched_stats(void);
+
+// Syscall handler
+int32_t system_nice(int32_t nice);
+int32_t system_set_affinity(uint32_t mask);
 
 #endif
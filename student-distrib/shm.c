@@ -0,0 +1,154 @@
+#include "shm.h"
+
+// Physical backing for every segment, lives in the kernel's 4MB page
+static uint8_t shm_pool[SHM_MAX_SEGMENTS][SHM_SEGMENT_SIZE] __attribute__((aligned(FOUR_KILOBYTES)));
+
+static shm_segment_t segments[SHM_MAX_SEGMENTS];
+// Covers segments
+static lock_stats_t shm_lock_stats = LOCK_STATS_INIT("shm");
+static spinlock_t shm_lock = SPINLOCK_INIT(shm_lock_stats);
+
+/* shm_find
+ * description: finds the segment that holds a given key, shm_lock must be held
+ * input:
+ * 	key - key to look for
+ * output:
+ *	index of the segment, -1 if the key does not exist
+ * side effects: none
+ */
+static int32_t shm_find(int32_t key) {
+    int32_t i;
+    for (i = 0; i < SHM_MAX_SEGMENTS; i++) {
+        if (segments[i].key == key) return i;
+    }
+    return -1;
+}
+
+/* init_shm
+ * description: marks all shared memory segments as free
+ * input: none
+ * output: none
+ * side effects: resets the segment table
+ */
+void init_shm(void) {
+    int32_t i, j;
+    for (i = 0; i < SHM_MAX_SEGMENTS; i++) {
+        segments[i].key = SHM_NO_KEY;
+        segments[i].num_pages = 0;
+        segments[i].refcount = 0;
+        segments[i].creator = -1;
+        for (j = 0; j < MAX_PIDS; j++)
+            segments[i].attached[j] = FALSE;
+    }
+}
+
+/* shm_detach
+ * description: unmaps segment idx from a process and frees the segment once nobody uses it,
+ *              shm_lock must be held
+ * input:
+ * 	idx - segment index
+ *  pid - process to detach
+ * output: none
+ * side effects: changes the process' shared memory page table
+ */
+static void shm_detach(int32_t idx, int32_t pid) {
+    uint32_t page;
+    uint32_t base = SHM_VIRT_BASE + idx*SHM_SEGMENT_SIZE;
+    if (!segments[idx].attached[pid]) return;
+    for (page = 0; page < segments[idx].num_pages; page++)
+        unmap_shm_page(pid, base + page*FOUR_KILOBYTES);
+    segments[idx].attached[pid] = FALSE;
+    // Last one out frees the key
+    if (--segments[idx].refcount == 0)
+        segments[idx].key = SHM_NO_KEY;
+}
+
+/* shm_detach_all
+ * description: detaches every segment a process had attached, called on halt. Segments
+ *              it created that nobody attached go too, or a producer that dies early
+ *              would keep its key and pages forever.
+ * input:
+ * 	pid - process that is going away
+ * output: none
+ * side effects: may free segments
+ */
+void shm_detach_all(int32_t pid) {
+    int32_t i;
+    uint32_t flags;
+    if (pid < 0 || pid >= MAX_PIDS) return;
+    spin_lock_irqsave(&shm_lock, flags);
+    for (i = 0; i < SHM_MAX_SEGMENTS; i++) {
+        shm_detach(i, pid);
+        if (segments[i].key == SHM_NO_KEY || segments[i].creator != pid) continue;
+        segments[i].creator = -1;
+        if (segments[i].refcount == 0)
+            segments[i].key = SHM_NO_KEY;
+    }
+    spin_unlock_irqrestore(&shm_lock, flags);
+}
+
+/* system_shm_create
+ * description: creates a shared memory segment identified by key
+ * input:
+ * 	key - non negative identifier that other processes will attach with
+ *  nbytes - size of the segment, rounded up to 4kb pages
+ * output:
+ *	0 on success (or if the key already exists with at least nbytes), -1 on error
+ * side effects: zeroes the backing pages of a new segment
+ */
+int32_t system_shm_create(int32_t key, int32_t nbytes) {
+    if (key < 0 || nbytes <= 0 || nbytes > SHM_SEGMENT_SIZE) return -1;
+    uint32_t num_pages = (nbytes + FOUR_KILOBYTES - 1) / FOUR_KILOBYTES;
+    uint32_t flags;
+    spin_lock_irqsave(&shm_lock, flags);
+    int32_t idx = shm_find(key);
+    if (idx != -1) {
+        // Creating an existing key is fine as long as it is big enough
+        spin_unlock_irqrestore(&shm_lock, flags);
+        return (segments[idx].num_pages >= num_pages) ? 0 : -1;
+    }
+    idx = shm_find(SHM_NO_KEY);
+    if (idx == -1) {
+        spin_unlock_irqrestore(&shm_lock, flags);
+        return -1;
+    }
+    segments[idx].key = key;
+    segments[idx].num_pages = num_pages;
+    segments[idx].refcount = 0;
+    segments[idx].creator = get_current_pcb()->process_id;
+    memset(shm_pool[idx], 0, num_pages*FOUR_KILOBYTES);
+    spin_unlock_irqrestore(&shm_lock, flags);
+    return 0;
+}
+
+/* system_shm_attach
+ * description: maps the pages of the segment identified by key into the calling process
+ * input:
+ * 	key - key given to shm_create
+ *  addr - user pointer filled with the start of the segment
+ * output:
+ *	0 on success, -1 on error
+ * side effects: changes the process' shared memory page table
+ */
+int32_t system_shm_attach(int32_t key, uint8_t** addr) {
+    if ((uint32_t)addr < IN_MB(8) || addr == NULL) return -1;
+    pcb_t* pcb = get_current_pcb();
+    uint32_t flags;
+    spin_lock_irqsave(&shm_lock, flags);
+    int32_t idx = shm_find(key);
+    if (key < 0 || idx == -1) {
+        spin_unlock_irqrestore(&shm_lock, flags);
+        return -1;
+    }
+    uint32_t base = SHM_VIRT_BASE + idx*SHM_SEGMENT_SIZE;
+    if (!segments[idx].attached[pcb->process_id]) {
+        uint32_t page;
+        for (page = 0; page < segments[idx].num_pages; page++)
+            map_shm_page(pcb->process_id, base + page*FOUR_KILOBYTES, (uint32_t)&shm_pool[idx][page*FOUR_KILOBYTES]);
+        segments[idx].attached[pcb->process_id] = TRUE;
+        segments[idx].refcount++;
+    }
+    spin_unlock_irqrestore(&shm_lock, flags);
+    *addr = (uint8_t*)base;
+    return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef _SHM_H
+#define _SHM_H
+
+#include "types.h"
+#include "lib.h"
+#include "paging.h"
+#include "syscall.h"
+
+#define SHM_MAX_SEGMENTS    (16)    // Number of keys that can exist at once
+#define SHM_MAX_PAGES       (16)    // Biggest segment is 16 * 4kb = 64kb
+#define SHM_SEGMENT_SIZE    (SHM_MAX_PAGES * FOUR_KILOBYTES)
+#define SHM_NO_KEY          (-1)
+
+/*
+ * shm_segment_t : One shared memory segment. Segment i is always backed by the same
+ *                 physical pages and always mapped at SHM_VIRT_BASE + i*SHM_SEGMENT_SIZE,
+ *                 so every process that attaches a key sees it at the same address.
+ */
+typedef struct {
+    int32_t key;                // User chosen identifier, SHM_NO_KEY when free
+    uint32_t num_pages;         // Pages actually mapped on attach
+    uint32_t refcount;          // Number of processes currently attached
+    int32_t creator;            // Pid that created it while it is running, -1 after
+    uint8_t attached[MAX_PIDS]; // TRUE if pid has this segment mapped
+} shm_segment_t;
+
+void init_shm(void);
+void shm_detach_all(int32_t pid);
+
+// Syscall handlers
+int32_t system_shm_create(int32_t key, int32_t nbytes);
+int32_t system_shm_attach(int32_t key, uint8_t** addr);
+
+#endif
@@ -0,0 +1,541 @@
+#include "smp.h"
+#include "paging.h"
+#include "idt_common.h"
+#include "scheduler.h"
+#include "clock.h"
+#include "spinlock.h"
+#include "apic.h"
+
+/*
+ * Symmetric multiprocessing. The processors are found in the MP tables (or the ACPI
+ * MADT when there are none), and started with INIT-SIPI-SIPI from the real mode
+ * trampoline in ap_boot.S. Each gets its own GDT, TSS, page directory and idle
+ * job, then runs jobs off its own run queues. The same tables say where the IOAPIC
+ * is and how the ISA interrupts are wired to it, apic.c drives both APICs.
+ *
+ * Most of the kernel is still written for one cpu, so it runs under one big kernel
+ * lock, taken on every entry (interrupt, exception, syscall) and dropped on the way
+ * back out. User code runs in parallel, kernel code takes turns. The lock belongs
+ * to the cpu while a job is switched out (the depth moves with the job, see
+ * resume_next_running_job), and is only spun on once smp_active is set.
+ * The scheduler tick is the one entry that skips it (see timer_tick), the run
+ * queues and wait queues it touches have spinlocks of their own. Kernel threads run
+ * without it too, and only take it around the driver code they call (see
+ * kthread_create), so a busy one doesn't hold up the BSP's device interrupts. The pid heap, ttys,
+ * fd tables, pipes, shm segments, timer wheel, iorings and sb16 have theirs too
+ * (no global cli/sti left), but everything using them still comes in under the big
+ * lock, so for now those only take turns like the rest.
+ */
+
+// MP floating pointer and configuration table (Intel MP spec 1.4, chapter 4)
+#define MP_SIGNATURE        (0x5F504D5F)    // "_MP_"
+#define MP_CONFIG_SIGNATURE (0x504D4350)    // "PCMP"
+#define MP_PARAGRAPH        (16)
+#define MP_ENTRY_PROCESSOR  (0)
+#define MP_ENTRY_BUS        (1)
+#define MP_ENTRY_IOAPIC     (2)
+#define MP_ENTRY_INTERRUPT  (3)
+#define MP_PROCESSOR_SIZE   (20)
+#define MP_OTHER_SIZE       (8)
+#define MP_CPU_ENABLED      (0x01)
+#define MP_IOAPIC_ENABLED   (0x01)
+#define MP_INT_VECTORED     (0)         // Interrupt entry type for a plain IOAPIC input
+#define MP_IMCR_PRESENT     (0x80)      // features[1], the board starts in PIC mode
+#define MP_BUS_ISA          (0x415349)  // "ISA", low 3 bytes of the bus type string
+#define MP_BUS_TYPE_MASK    (0xFFFFFF)
+#define MP_MAX_BUSES        (256)
+
+// ACPI root pointer and the MADT, which lists the local APICs
+#define RSDP_SIGNATURE_LOW  (0x20445352)    // "RSD "
+#define RSDP_SIGNATURE_HIGH (0x20525450)    // "PTR "
+#define RSDP_CHECKSUM_SIZE  (20)
+#define RSDT_SIGNATURE      (0x54445352)    // "RSDT"
+#define MADT_SIGNATURE      (0x43495041)    // "APIC"
+#define MADT_ENTRY_LAPIC    (0)
+#define MADT_ENTRY_IOAPIC   (1)
+#define MADT_ENTRY_OVERRIDE (2)
+#define MADT_LAPIC_ENABLED  (0x01)
+
+// Where the BIOS tables can be (BIOS data area, EBDA, ROM)
+#define BDA_EBDA_SEGMENT    (0x40E)
+#define BDA_BASE_MEM_KB     (0x413)
+#define SEGMENT_SHIFT       (4)
+#define BIOS_ROM_START      (0xE0000)
+#define BIOS_ROM_END        (0x100000)
+#define MP_ROM_START        (0xF0000)
+
+#define CPUID_EBX_APIC_SHIFT (24)
+
+typedef struct {
+    uint32_t signature;
+    uint32_t config;            // Physical address of the configuration table
+    uint8_t length;             // In paragraphs
+    uint8_t revision;
+    uint8_t checksum;
+    uint8_t features[5];
+} __attribute__((packed)) mp_float_t;
+
+typedef struct {
+    uint32_t signature;
+    uint16_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    uint8_t oem_id[8];
+    uint8_t product_id[12];
+    uint32_t oem_table;
+    uint16_t oem_table_size;
+    uint16_t entry_count;       // Entries right after this header
+    uint32_t lapic_addr;
+    uint16_t ext_length;
+    uint8_t ext_checksum;
+    uint8_t reserved;
+} __attribute__((packed)) mp_config_t;
+
+typedef struct {
+    uint32_t signature_low;
+    uint32_t signature_high;
+    uint8_t checksum;
+    uint8_t oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt;
+} __attribute__((packed)) rsdp_t;
+
+typedef struct {
+    uint32_t signature;
+    uint32_t length;            // Including this header
+    uint8_t revision;
+    uint8_t checksum;
+    uint8_t oem_id[6];
+    uint8_t oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_header_t;
+
+typedef struct {
+    acpi_header_t header;
+    uint32_t lapic_addr;
+    uint32_t flags;
+} __attribute__((packed)) madt_t;
+
+// The BSP keeps the boot descriptors, page directory and stack
+cpu_t cpus[MAX_CPUS] = {{ .online = TRUE, .tss = &tss, .pgdir = page_directory }};
+uint32_t num_cpus = 1;
+// Set once every processor that answered is up, from then on the lock is real
+volatile bool smp_active = FALSE;
+// Bumped whenever a mapping every cpu shares changes, see smp_flush_tlb_others
+volatile uint32_t tlb_gen = 0;
+
+// The big kernel lock, a ticket lock so no cpu waits forever for it
+static lock_stats_t big_lock_stats = LOCK_STATS_INIT("kernel");
+static ticket_lock_t big_lock = TICKET_LOCK_INIT(big_lock_stats);
+// Processor ap_main is running on, one comes up at a time
+static volatile uint32_t ap_booting;
+static uint8_t ap_stacks[MAX_CPUS][AP_STACK_SIZE] __attribute__((aligned(AP_STACK_SIZE)));
+
+// Address of a trampoline variable in the copy at AP_TRAMPOLINE
+#define TRAMPOLINE_VAR(sym)  (AP_TRAMPOLINE + ((uint32_t)&(sym) - (uint32_t)&ap_trampoline))
+
+/*  checksum_ok
+    description: checks a BIOS table, whose bytes add up to 0
+    inputs: addr - start of the table
+            len - its length in bytes
+    output: TRUE if the table is intact
+    side effect: none
+*/
+static bool checksum_ok(uint8_t* addr, uint32_t len) {
+    uint8_t sum = 0;
+    while (len-- > 0)
+        sum += *addr++;
+    return sum == 0;
+}
+
+/*  add_cpu
+    description: records a processor found in the tables, the BSP is already cpus[0]
+    inputs: apic_id - its local APIC id
+    output: none
+    side effect: grows num_cpus, processors past MAX_CPUS are left alone
+*/
+static void add_cpu(uint32_t apic_id) {
+    if (apic_id == cpus[0].apic_id || num_cpus == MAX_CPUS) return;
+    cpus[num_cpus].apic_id = apic_id;
+    num_cpus++;
+}
+
+/*  mp_scan
+    description: looks for the MP floating pointer, it sits on a paragraph boundary
+    inputs: start - physical address to start at
+            len - bytes to search
+    output: the floating pointer, NULL if it isn't there
+    side effect: none
+*/
+static mp_float_t* mp_scan(uint32_t start, uint32_t len) {
+    uint32_t addr;
+    mp_float_t* mpf;
+    for (addr = start; addr + sizeof(mp_float_t) <= start + len; addr += MP_PARAGRAPH) {
+        mpf = (mp_float_t*)addr;
+        if (mpf->signature == MP_SIGNATURE && checksum_ok((uint8_t*)mpf, mpf->length * MP_PARAGRAPH))
+            return mpf;
+    }
+    return NULL;
+}
+
+/*  parse_mp
+    description: finds the processors, the IOAPIC and the ISA interrupt wiring in the
+                 MP configuration table
+    inputs: none
+    output: TRUE if there was a table
+    side effect: fills in cpus, tells apic.c what it found
+*/
+static bool parse_mp(void) {
+    uint32_t ebda = *(uint16_t*)BDA_EBDA_SEGMENT << SEGMENT_SHIFT;
+    uint32_t base_mem = IN_KB(*(uint16_t*)BDA_BASE_MEM_KB);
+    mp_float_t* mpf = NULL;
+    mp_config_t* config;
+    uint8_t* entry;
+    uint32_t i;
+    // Which bus ids are ISA, interrupt entries name their source bus
+    bool isa_bus[MP_MAX_BUSES];
+    // First KB of the EBDA, last KB of base memory, then the BIOS ROM
+    if (ebda != 0) mpf = mp_scan(ebda, ONE_KILOBYTE);
+    if (mpf == NULL) mpf = mp_scan(base_mem - ONE_KILOBYTE, ONE_KILOBYTE);
+    if (mpf == NULL) mpf = mp_scan(MP_ROM_START, BIOS_ROM_END - MP_ROM_START);
+    // No table means one of the default configurations, not worth supporting
+    if (mpf == NULL || mpf->config == 0) return FALSE;
+
+    config = (mp_config_t*)mpf->config;
+    if (config->signature != MP_CONFIG_SIGNATURE || !checksum_ok((uint8_t*)config, config->length))
+        return FALSE;
+    apic_set_lapic_base(config->lapic_addr);
+    if (mpf->features[1] & MP_IMCR_PRESENT) apic_set_pic_mode();
+    memset(isa_bus, 0, sizeof(isa_bus));
+    entry = (uint8_t*)(config + 1);
+    for (i = 0; i < config->entry_count; i++) {
+        if (entry[0] == MP_ENTRY_PROCESSOR) {
+            // type, local APIC id, version, flags
+            if (entry[3] & MP_CPU_ENABLED) add_cpu(entry[1]);
+            entry += MP_PROCESSOR_SIZE;
+            continue;
+        }
+        if (entry[0] == MP_ENTRY_BUS) {
+            // type, bus id, type string
+            isa_bus[entry[1]] = ((*(uint32_t*)(entry + 2) & MP_BUS_TYPE_MASK) == MP_BUS_ISA);
+        } else if (entry[0] == MP_ENTRY_IOAPIC) {
+            // type, id, version, flags, address. The first one starts at input 0
+            if (entry[3] & MP_IOAPIC_ENABLED) apic_add_ioapic(*(uint32_t*)(entry + 4), 0);
+        } else if (entry[0] == MP_ENTRY_INTERRUPT && entry[1] == MP_INT_VECTORED && isa_bus[entry[4]]) {
+            // type, interrupt type, flags, source bus, source irq, IOAPIC id, IOAPIC input
+            apic_add_override(entry[5], entry[7], *(uint16_t*)(entry + 2));
+        }
+        entry += MP_OTHER_SIZE;
+    }
+    return TRUE;
+}
+
+/*  rsdp_scan
+    description: looks for the ACPI root pointer, it sits on a paragraph boundary
+    inputs: start - physical address to start at
+            len - bytes to search
+    output: the root pointer, NULL if it isn't there
+    side effect: none
+*/
+static rsdp_t* rsdp_scan(uint32_t start, uint32_t len) {
+    uint32_t addr;
+    rsdp_t* rsdp;
+    for (addr = start; addr + sizeof(rsdp_t) <= start + len; addr += MP_PARAGRAPH) {
+        rsdp = (rsdp_t*)addr;
+        if (rsdp->signature_low == RSDP_SIGNATURE_LOW && rsdp->signature_high == RSDP_SIGNATURE_HIGH &&
+            checksum_ok((uint8_t*)rsdp, RSDP_CHECKSUM_SIZE))
+            return rsdp;
+    }
+    return NULL;
+}
+
+/*  parse_acpi
+    description: finds the processors, the IOAPIC and the ISA interrupt overrides in
+                 the ACPI MADT
+    inputs: none
+    output: TRUE if there was a MADT
+    side effect: fills in cpus, tells apic.c what it found
+*/
+static bool parse_acpi(void) {
+    uint32_t ebda = *(uint16_t*)BDA_EBDA_SEGMENT << SEGMENT_SHIFT;
+    rsdp_t* rsdp = NULL;
+    acpi_header_t* rsdt;
+    madt_t* madt = NULL;
+    uint32_t* tables;
+    uint8_t* entry;
+    uint8_t* end;
+    uint32_t i;
+    if (ebda != 0) rsdp = rsdp_scan(ebda, ONE_KILOBYTE);
+    if (rsdp == NULL) rsdp = rsdp_scan(BIOS_ROM_START, BIOS_ROM_END - BIOS_ROM_START);
+    if (rsdp == NULL) return FALSE;
+
+    rsdt = (acpi_header_t*)rsdp->rsdt;
+    if (rsdt->signature != RSDT_SIGNATURE || !checksum_ok((uint8_t*)rsdt, rsdt->length))
+        return FALSE;
+    tables = (uint32_t*)(rsdt + 1);
+    for (i = 0; i < (rsdt->length - sizeof(acpi_header_t)) / sizeof(uint32_t); i++) {
+        if (((acpi_header_t*)tables[i])->signature == MADT_SIGNATURE) {
+            madt = (madt_t*)tables[i];
+            break;
+        }
+    }
+    if (madt == NULL || !checksum_ok((uint8_t*)madt, madt->header.length)) return FALSE;
+
+    apic_set_lapic_base(madt->lapic_addr);
+    entry = (uint8_t*)(madt + 1);
+    end = (uint8_t*)madt + madt->header.length;
+    // type, length, then for a local APIC: ACPI id, APIC id, flags
+    // an IOAPIC: id, reserved, address, first GSI
+    // an override: bus, source irq, GSI, flags
+    while (entry < end && entry[1] != 0) {
+        if (entry[0] == MADT_ENTRY_LAPIC && (*(uint32_t*)(entry + 4) & MADT_LAPIC_ENABLED))
+            add_cpu(entry[3]);
+        else if (entry[0] == MADT_ENTRY_IOAPIC)
+            apic_add_ioapic(*(uint32_t*)(entry + 4), *(uint32_t*)(entry + 8));
+        else if (entry[0] == MADT_ENTRY_OVERRIDE)
+            apic_add_override(entry[3], *(uint32_t*)(entry + 4), *(uint16_t*)(entry + 8));
+        entry += entry[1];
+    }
+    return TRUE;
+}
+
+/*  smp_detect
+    description: counts the processors and finds the APICs. Runs before paging so the
+                 tables can be read wherever the BIOS put them.
+    inputs: none
+    output: none
+    side effect: fills in cpus and num_cpus, just the BSP (and the 8259) without a
+                 local APIC
+*/
+void smp_detect(void) {
+    uint32_t ebx, eax = CPUID_FEATURES, ecx, edx;
+    asm volatile ("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    if (!(edx & CPUID_EDX_APIC)) return;
+    // Initial APIC id of the processor we boot on
+    cpus[0].apic_id = ebx >> CPUID_EBX_APIC_SHIFT;
+    apic_set_lapic_base(LAPIC_DEFAULT_BASE);
+    if (!parse_mp()) parse_acpi();
+}
+
+/*  smp_send_ipi
+    description: interrupts another processor
+    inputs: cpu - index in cpus
+            vector - IDT vector it takes
+    output: none
+    side effect: sends the IPI
+*/
+void smp_send_ipi(uint32_t cpu, uint32_t vector) {
+    lapic_send(cpus[cpu].apic_id, vector);
+}
+
+/*  ap_main
+    description: where an application processor lands after the trampoline, on its
+                 own idle stack with paging on. Loads its own descriptors and turns
+                 into its idle job.
+    inputs: none
+    output: none, never returns
+    side effect: the cpu starts running jobs once smp_active is set
+*/
+static void ap_main(void) {
+    cpu_t* cpu = &cpus[ap_booting];
+    gdt_reg_t gdtr;
+    gdtr.limit = sizeof(cpu->gdt) - 1;
+    gdtr.base = (uint32_t)cpu->gdt;
+    asm volatile ("lgdt %0" : : "m"(gdtr));
+    ltr(KERNEL_TSS);
+    lldt(KERNEL_LDT);
+    asm volatile ("lidt %0" : : "m"(idt_desc_ptr));
+
+    lapic_enable(FALSE);
+    init_sysenter();
+    init_cpu_scheduling();
+    cpu->tlb_gen = tlb_gen;
+    cpu->online = TRUE;
+    // Leave the scheduler alone until the BSP is done starting everyone
+    while (!smp_active)
+        asm volatile ("pause");
+    idle_loop();
+}
+
+/*  init_ap_descriptors
+    description: gives an application processor its GDT and TSS, a copy of the
+                 BSP's GDT with its id in entry 0 and its own TSS descriptor
+    inputs: id - index in cpus
+            gdtr - the BSP's GDT
+    output: none
+    side effect: sets cpus[id].gdt and tss
+*/
+static void init_ap_descriptors(uint32_t id, gdt_reg_t* gdtr) {
+    cpu_t* cpu = &cpus[id];
+    seg_desc_t* tss_desc = &cpu->gdt[KERNEL_TSS / sizeof(seg_desc_t)];
+    memcpy(cpu->gdt, (void*)gdtr->base, sizeof(cpu->gdt));
+    cpu->gdt[0].val[0] = id;
+    cpu->gdt[0].val[1] = 0;
+    // The BSP's descriptor is marked busy, ours starts out available
+    SET_TSS_PARAMS((*tss_desc), &cpu->tss_mem, tss_size);
+    tss_desc->type = 0x9;
+
+    memset(&cpu->tss_mem, 0, sizeof(tss_t));
+    cpu->tss_mem.ldt_segment_selector = KERNEL_LDT;
+    cpu->tss_mem.ss0 = KERNEL_DS;
+    cpu->tss_mem.esp0 = (uint32_t)&ap_stacks[id][AP_STACK_SIZE];
+    cpu->tss = &cpu->tss_mem;
+}
+
+/*  start_ap
+    description: starts one application processor with INIT-SIPI-SIPI (Intel MP spec
+                 B.4) and waits for it to come online
+    inputs: id - index in cpus
+    output: TRUE if it came up
+    side effect: the processor runs ap_main
+*/
+static bool start_ap(uint32_t id) {
+    cpu_t* cpu = &cpus[id];
+    uint32_t waited;
+    cpu->pgdir = init_cpu_page_directory(id);
+    *(uint32_t*)TRAMPOLINE_VAR(ap_cr3) = (uint32_t)cpu->pgdir;
+    *(uint32_t*)TRAMPOLINE_VAR(ap_esp) = (uint32_t)&ap_stacks[id][AP_STACK_SIZE];
+    *(uint32_t*)TRAMPOLINE_VAR(ap_entry) = (uint32_t)ap_main;
+    ap_booting = id;
+
+    lapic_send(cpu->apic_id, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+    clock_udelay(INIT_DELAY_USECS);
+    lapic_send(cpu->apic_id, ICR_INIT | ICR_LEVEL);
+    // The second STARTUP is for processors that missed the first
+    lapic_send(cpu->apic_id, ICR_STARTUP | (AP_TRAMPOLINE / FOUR_KILOBYTES));
+    clock_udelay(SIPI_DELAY_USECS);
+    if (!cpu->online)
+        lapic_send(cpu->apic_id, ICR_STARTUP | (AP_TRAMPOLINE / FOUR_KILOBYTES));
+    for (waited = 0; !cpu->online && waited < AP_ONLINE_USECS; waited += SIPI_DELAY_USECS)
+        clock_udelay(SIPI_DELAY_USECS);
+    return cpu->online;
+}
+
+/*  smp_init
+    description: starts every other processor the tables listed. Runs last at boot,
+                 with interrupts off, once everything the processors share is set up.
+    inputs: none
+    output: none
+    side effect: from here on the big kernel lock is taken for real
+*/
+void smp_init(void) {
+    gdt_reg_t gdtr;
+    uint32_t i, online = 0;
+    // apic_init turned on the BSP's local APIC already
+    if (num_cpus == 1) return;
+
+    // Real mode code has to run below 1MB, on a page boundary
+    map_low_page(AP_TRAMPOLINE);
+    memcpy((void*)AP_TRAMPOLINE, &ap_trampoline, &ap_trampoline_end - &ap_trampoline);
+    asm volatile ("sgdt %0" : "=m"(gdtr));
+    *(gdt_reg_t*)TRAMPOLINE_VAR(ap_gdt_desc) = gdtr;
+
+    for (i = 1; i < num_cpus; i++) {
+        init_ap_descriptors(i, &gdtr);
+        if (start_ap(i)) online++;
+    }
+    cpus[0].tlb_gen = tlb_gen;
+    if (online > 0) smp_active = TRUE;
+}
+
+/*  smp_online_mask
+    description: gets the processors jobs can be placed on, the application processors
+                 only count once smp_init is done with them
+    inputs: none
+    output: bit i set for each usable cpus[i], bit 0 always
+    side effect: none
+*/
+uint32_t smp_online_mask(void) {
+    uint32_t i, mask = 1;
+    if (!smp_active) return mask;
+    for (i = 1; i < num_cpus; i++) {
+        if (cpus[i].online) mask |= 1 << i;
+    }
+    return mask;
+}
+
+/*  set_kernel_stack
+    description: sets where this cpu enters the kernel from user space, used by the
+                 execute return path in idt.S
+    inputs: esp0 - top of the kernel stack
+    output: none
+    side effect: changes this cpu's TSS
+*/
+void set_kernel_stack(uint32_t esp0) {
+    this_cpu()->tss->esp0 = esp0;
+}
+
+/*  smp_flush_tlb_others
+    description: tells the other processors a shared page table changed (the caller
+                 flushed its own TLB). They flush when they next take the kernel lock,
+                 the IPI makes that right away for ones running user code.
+    inputs: none
+    output: none
+    side effect: sends TLB_VECTOR IPIs
+*/
+void smp_flush_tlb_others(void) {
+    uint32_t self, i;
+    if (!smp_active) return;
+    self = this_cpu_id();
+    tlb_gen++;
+    cpus[self].tlb_gen = tlb_gen;
+    for (i = 0; i < num_cpus; i++) {
+        if (i != self && cpus[i].online) smp_send_ipi(i, TLB_VECTOR);
+    }
+}
+
+/*  tlbHandler
+    description: handles TLB_VECTOR, the flush already happened taking the kernel lock
+    inputs: none
+    output: none
+    side effect: acknowledges the IPI
+*/
+void tlbHandler(void) {
+    lapic_eoi();
+}
+
+/*  kernel_lock
+    description: enters the kernel, called by every entry path in idt.S but the
+                 scheduler tick's (see timer_tick). Nests, only the outermost call on
+                 a cpu spins for the lock.
+    inputs: none
+    output: none
+    side effect: other cpus wait to enter the kernel until kernel_unlock, the
+                 terminal globals go back to the current job's terminal
+*/
+void kernel_lock(void) {
+    uint32_t flags;
+    cpu_t* cpu;
+    cli_and_save(flags);
+    cpu = this_cpu();
+    if (cpu->lock_depth++ == 0 && smp_active) {
+        ticket_lock(&big_lock);
+        if (cpu->tlb_gen != tlb_gen) {
+            cpu->tlb_gen = tlb_gen;
+            flush_tlb();
+        }
+        // The last cpu in the kernel left them on its own job's terminal
+        restore_job_vidmem();
+    }
+    restore_flags(flags);
+}
+
+/*  kernel_unlock
+    description: leaves the kernel, the outermost call releases the lock
+    inputs: none
+    output: none
+    side effect: saves the terminal globals, another cpu may take the lock
+*/
+void kernel_unlock(void) {
+    uint32_t flags;
+    cpu_t* cpu;
+    cli_and_save(flags);
+    cpu = this_cpu();
+    if (--cpu->lock_depth == 0 && smp_active) {
+        save_vidmem();
+        ticket_unlock(&big_lock);
+    }
+    restore_flags(flags);
+}
@@ -0,0 +1,97 @@
+#ifndef _SMP_H
+#define _SMP_H
+
+#include "types.h"
+#include "x86_desc.h"
+
+#define MAX_CPUS            (4)
+#define AP_TRAMPOLINE       (0x8000)    // Real mode page the application processors start in
+#define AP_STACK_SIZE       (8192)      // Idle stack of each application processor
+#define CPU_MASK_ALL        ((1 << MAX_CPUS) - 1)   // Affinity of a job that may run anywhere
+
+#ifndef ASM
+
+#include "lib.h"
+#include "apic.h"
+
+#define GDT_ENTRIES         (8)         // See x86_desc.S, entry 0 holds the cpu id
+
+#define CPUID_EDX_APIC      (1 << 9)
+
+// Microseconds the INIT-SIPI-SIPI sequence waits between steps (Intel MP spec B.4)
+#define INIT_DELAY_USECS    (10000)
+#define SIPI_DELAY_USECS    (200)
+#define AP_ONLINE_USECS     (100000)    // Give up on a processor that doesn't show up
+
+/*
+ * gdt_reg_t : what lgdt loads and sgdt stores
+ */
+typedef struct {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed)) gdt_reg_t;
+
+/*
+ * cpu_t : one processor. Each has its own GDT (so the TSS descriptor can point at
+ *         its own TSS), idle stack and page directory, the BSP's are the boot ones.
+ */
+typedef struct {
+    uint32_t apic_id;
+    volatile bool online;
+    tss_t* tss;                     // esp0/ss0 of the job on this cpu
+    uint32_t* pgdir;                // add_process_page changes this one
+    uint32_t lock_depth;            // Big kernel lock nesting, see kernel_lock
+    uint32_t tlb_gen;               // tlb_gen this cpu last flushed for
+    struct irq_frame* irq_frame;    // Innermost interrupt being handled, see do_IRQ
+    uint32_t irq_depth;             // Device handlers running (nested), on the interrupt stack
+    volatile bool need_resched;     // A tick came in during one, schedule once they're done
+    seg_desc_t gdt[GDT_ENTRIES];    // Unused on the BSP
+    tss_t tss_mem;                  // Unused on the BSP
+} cpu_t;
+
+extern cpu_t cpus[MAX_CPUS];
+extern uint32_t num_cpus;
+extern volatile bool smp_active;
+extern volatile uint32_t tlb_gen;
+
+// Assembly linkage in ap_boot.S, copied to AP_TRAMPOLINE
+extern uint8_t ap_trampoline, ap_trampoline_end;
+extern gdt_reg_t ap_gdt_desc;
+extern uint32_t ap_cr3, ap_esp, ap_entry;
+
+/*  this_cpu_id
+    description: gets the index in cpus of the processor running this. The first GDT
+                 entry can't be used as a descriptor, every cpu keeps its id there.
+    inputs: none
+    output: 0 on the BSP, 1 to num_cpus-1 on the others
+    side effect: none
+*/
+static inline uint32_t this_cpu_id(void) {
+    gdt_reg_t gdtr;
+    asm volatile ("sgdt %0" : "=m"(gdtr));
+    return *(uint32_t*)gdtr.base;
+}
+
+/*  this_cpu
+    description: gets the processor running this
+    inputs: none
+    output: its entry in cpus
+    side effect: none
+*/
+static inline cpu_t* this_cpu(void) {
+    return &cpus[this_cpu_id()];
+}
+
+void smp_detect(void);
+void smp_init(void);
+uint32_t smp_online_mask(void);
+void smp_send_ipi(uint32_t cpu, uint32_t vector);
+void smp_flush_tlb_others(void);
+void set_kernel_stack(uint32_t esp0);
+void kernel_lock(void);
+void kernel_unlock(void);
+void tlbHandler(void);
+
+#endif /* ASM */
+
+#endif
@@ -0,0 +1,186 @@
+#include "spinlock.h"
+
+/*
+ * Spinlocks and ticket locks. Neither turns interrupts off by itself, a lock an
+ * interrupt handler also takes has to be taken with the _irqsave versions
+ * everywhere else, or the handler spins forever on the cpu that holds it. A lock
+ * must never be held across a context switch (sleep_on_locked lets go of one).
+ */
+
+// Every class that had a lock taken, newest first
+static lock_stats_t* volatile lock_classes = NULL;
+
+/*  register_stats
+    description: adds a class to the ones print_lock_stats goes through, once
+    inputs: stats - the class
+    output: none
+    side effect: changes lock_classes
+*/
+static void register_stats(lock_stats_t* stats) {
+    lock_stats_t* head;
+    // Locks of the same class may get taken for the first time on two cpus at once
+    if (xchg(&stats->registered, 1) != 0) return;
+    do {
+        head = lock_classes;
+        stats->next = head;
+    } while (cmpxchg((volatile uint32_t*)&lock_classes, (uint32_t)head, (uint32_t)stats) != (uint32_t)head);
+}
+
+/*  lock_acquired
+    description: records that a lock was just taken
+    inputs: stats - its class, NULL for none
+            acquired_tsc - where the lock keeps when it was taken
+            start - low half of the TSC when the cpu started asking for it
+            spun - TRUE if it had to wait
+    output: none
+    side effect: updates the class' stats
+*/
+static void lock_acquired(lock_stats_t* stats, uint32_t* acquired_tsc, uint32_t start, bool spun) {
+    uint32_t now;
+    if (stats == NULL) return;
+    if (!stats->registered) register_stats(stats);
+    now = (uint32_t)rdtsc();
+    stats->acquired++;
+    if (spun) {
+        stats->contended++;
+        stats->wait_total += now - start;
+    }
+    *acquired_tsc = now;
+}
+
+/*  lock_released
+    description: records how long a lock was held, right before it is released
+    inputs: stats - its class, NULL for none
+            acquired_tsc - when it was taken
+    output: none
+    side effect: updates the class' stats
+*/
+static void lock_released(lock_stats_t* stats, uint32_t acquired_tsc) {
+    uint32_t held;
+    if (stats == NULL) return;
+    held = (uint32_t)rdtsc() - acquired_tsc;
+    stats->hold_total += held;
+    if (held > stats->hold_max) stats->hold_max = held;
+}
+
+/*  spin_lock_init
+    description: sets up a lock that isn't statically initialized
+    inputs: lock - the lock
+            stats - class its use is counted in, NULL for none
+    output: none
+    side effect: the lock is unlocked
+*/
+void spin_lock_init(spinlock_t* lock, lock_stats_t* stats) {
+    lock->locked = 0;
+    lock->acquired_tsc = 0;
+    lock->stats = stats;
+}
+
+/*  spin_lock
+    description: takes a spinlock, spinning on plain reads while someone else has it
+                 so the cache line isn't bounced around
+    inputs: lock - the lock
+    output: none
+    side effect: none
+*/
+void spin_lock(spinlock_t* lock) {
+    uint32_t start = (uint32_t)rdtsc();
+    bool spun = FALSE;
+    while (xchg(&lock->locked, 1) != 0) {
+        spun = TRUE;
+        while (lock->locked)
+            asm volatile ("pause");
+    }
+    lock_acquired(lock->stats, &lock->acquired_tsc, start, spun);
+}
+
+/*  spin_trylock
+    description: takes a spinlock if nobody has it
+    inputs: lock - the lock
+    output: TRUE if we got it
+    side effect: none
+*/
+bool spin_trylock(spinlock_t* lock) {
+    if (xchg(&lock->locked, 1) != 0) return FALSE;
+    lock_acquired(lock->stats, &lock->acquired_tsc, 0, FALSE);
+    return TRUE;
+}
+
+/*  spin_unlock
+    description: releases a spinlock
+    inputs: lock - a lock we hold
+    output: none
+    side effect: none
+*/
+void spin_unlock(spinlock_t* lock) {
+    lock_released(lock->stats, lock->acquired_tsc);
+    xchg(&lock->locked, 0);
+}
+
+/*  ticket_lock_init
+    description: sets up a ticket lock that isn't statically initialized
+    inputs: lock - the lock
+            stats - class its use is counted in, NULL for none
+    output: none
+    side effect: the lock is unlocked
+*/
+void ticket_lock_init(ticket_lock_t* lock, lock_stats_t* stats) {
+    lock->next = 0;
+    lock->owner = 0;
+    lock->acquired_tsc = 0;
+    lock->stats = stats;
+}
+
+/*  ticket_lock
+    description: takes a ticket and waits for it to be served
+    inputs: lock - the lock
+    output: none
+    side effect: none
+*/
+void ticket_lock(ticket_lock_t* lock) {
+    uint32_t start = (uint32_t)rdtsc();
+    uint16_t ticket = 1;
+    bool spun = FALSE;
+    asm volatile ("lock xaddw %0, %1" : "+r"(ticket), "+m"(lock->next) : : "memory");
+    while (lock->owner != ticket) {
+        spun = TRUE;
+        asm volatile ("pause");
+    }
+    lock_acquired(lock->stats, &lock->acquired_tsc, start, spun);
+}
+
+/*  ticket_unlock
+    description: serves the next ticket
+    inputs: lock - a lock we hold
+    output: none
+    side effect: the cpu that asked next gets the lock
+*/
+void ticket_unlock(ticket_lock_t* lock) {
+    lock_released(lock->stats, lock->acquired_tsc);
+    // Only the holder writes owner, the barrier keeps the section before it
+    asm volatile ("" : : : "memory");
+    lock->owner++;
+}
+
+/*  print_lock_stats
+    description: prints, per lock class, how often its locks were taken and had to be
+                 waited for and how long they were held (in TSC cycles), then starts
+                 counting over
+    inputs: none
+    output: none
+    side effect: writes to the current terminal, resets the stats
+*/
+void print_lock_stats(void) {
+    lock_stats_t* stats;
+    uint32_t hold_avg, wait_avg;
+    for (stats = lock_classes; stats != NULL; stats = stats->next) {
+        if (stats->acquired == 0) continue;
+        // No 64 bit division in the kernel, sections are short so the totals fit in 32 bits a good while
+        hold_avg = (uint32_t)stats->hold_total / stats->acquired;
+        wait_avg = (stats->contended == 0) ? 0 : (uint32_t)stats->wait_total / stats->contended;
+        printf("%s: %u taken, %u contended (avg wait %u), hold avg %u max %u cycles\n",
+            stats->name, stats->acquired, stats->contended, wait_avg, hold_avg, stats->hold_max);
+        stats->acquired = stats->contended = stats->hold_max = 0;
+        stats->wait_total = stats->hold_total = 0;
+    }
+}
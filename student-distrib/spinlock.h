@@ -0,0 +1,103 @@
+#ifndef _SPINLOCK_H
+#define _SPINLOCK_H
+
+#include "types.h"
+#include "lib.h"
+
+/*
+ * lock_stats_t : how a class of locks gets used, shared by every lock pointing at it
+ *                (all tty locks say, or one lock of its own). Registered for
+ *                print_lock_stats the first time one of its locks is taken. Locks of
+ *                the same class held on different cpus at once can race on the
+ *                counters, they are only statistics.
+ */
+typedef struct lock_stats {
+    const char* name;
+    uint32_t acquired;          // Times a lock was taken
+    uint32_t contended;         // Times that meant spinning
+    uint64_t wait_total;        // Cycles spent spinning
+    uint64_t hold_total;        // Cycles between taking and releasing
+    uint32_t hold_max;
+    volatile uint32_t registered;
+    struct lock_stats* next;    // Next registered class
+} lock_stats_t;
+
+/*
+ * spinlock_t : test and test-and-set lock, for short sections. No order among
+ *              waiters, see ticket_lock_t for that. Zero initialized is unlocked
+ *              and uninstrumented.
+ */
+typedef struct {
+    volatile uint32_t locked;
+    uint32_t acquired_tsc;      // Low half of the TSC when taken
+    lock_stats_t* stats;        // NULL for none
+} spinlock_t;
+
+/*
+ * ticket_lock_t : fair lock, cpus get it in the order they asked. Zero
+ *                 initialized is unlocked and uninstrumented.
+ */
+typedef struct {
+    volatile uint16_t next;     // Ticket the next cpu to ask gets
+    volatile uint16_t owner;    // Ticket being served
+    uint32_t acquired_tsc;
+    lock_stats_t* stats;
+} ticket_lock_t;
+
+#define LOCK_STATS_INIT(lock_name)  { .name = (lock_name) }
+#define SPINLOCK_INIT(lock_stats)   { .locked = 0, .stats = &(lock_stats) }
+#define TICKET_LOCK_INIT(lock_stats) { .next = 0, .owner = 0, .stats = &(lock_stats) }
+
+/* Atomically swaps val into addr, returns what was there */
+static inline uint32_t xchg(volatile uint32_t* addr, uint32_t val) {
+    asm volatile ("xchgl %0, %1" : "+r"(val), "+m"(*addr) : : "memory");
+    return val;
+}
+
+/* Atomically replaces what is at addr with val if it is still old, returns what
+ * was there (old if it got replaced) */
+static inline uint32_t cmpxchg(volatile uint32_t* addr, uint32_t old, uint32_t val) {
+    uint32_t prev;
+    asm volatile ("lock cmpxchgl %2, %1"
+            : "=a"(prev), "+m"(*addr)
+            : "r"(val), "0"(old)
+            : "memory");
+    return prev;
+}
+
+/* Versions that also turn interrupts off, for locks interrupt handlers take too.
+ * Interrupts go back to how they were once the lock is released. */
+#define spin_lock_irqsave(lock, flags)          \
+do {                                            \
+    cli_and_save(flags);                        \
+    spin_lock(lock);                            \
+} while (0)
+
+#define spin_unlock_irqrestore(lock, flags)     \
+do {                                            \
+    spin_unlock(lock);                          \
+    restore_flags(flags);                       \
+} while (0)
+
+#define ticket_lock_irqsave(lock, flags)        \
+do {                                            \
+    cli_and_save(flags);                        \
+    ticket_lock(lock);                          \
+} while (0)
+
+#define ticket_unlock_irqrestore(lock, flags)   \
+do {                                            \
+    ticket_unlock(lock);                        \
+    restore_flags(flags);                       \
+} while (0)
+
+void spin_lock_init(spinlock_t* lock, lock_stats_t* stats);
+void spin_lock(spinlock_t* lock);
+bool spin_trylock(spinlock_t* lock);
+void spin_unlock(spinlock_t* lock);
+void ticket_lock_init(ticket_lock_t* lock, lock_stats_t* stats);
+void ticket_lock(ticket_lock_t* lock);
+void ticket_unlock(ticket_lock_t* lock);
+void print_lock_stats(void);
+
+#endif
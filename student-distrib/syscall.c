@@ -1,7 +1,16 @@
 #include "syscall.h"
+#include "shm.h"
+#include "pipe.h"
+#include "timer.h"
+#include "ioring.h"
+#include "smp.h"
 
 // Heap of available PIDs
 int pids[MAX_PIDS] = {0, 1, 2, 3, 4, 5, 6, 7};
+static lock_stats_t pid_lock_stats = LOCK_STATS_INIT("pids");
+static spinlock_t pid_lock = SPINLOCK_INIT(pid_lock_stats);
+// Every process' files_lock
+static lock_stats_t files_lock_stats = LOCK_STATS_INIT("files");
 
 // Count of the current number of running processes
 int32_t open_processes = 0;
@@ -20,7 +29,11 @@ pcb_t* get_current_pcb()
 	//get address in esp
     register uint32_t sp asm("sp");
 	//get rid of the lower 13 bits since pcb 8kb aligned
-    return (pcb_t*)(sp & ESP_PCB_MASK);
+    pcb_t* pcb = (pcb_t*)(sp & ESP_PCB_MASK);
+    // A kernel thread working for a process acts as that process
+    if (pcb->process_id == KTHREAD_PCB_MARK && pcb->parent_id >= 0 && pcb->parent_id < MAX_PIDS)
+        return get_nth_pcb(pcb->parent_id);
+    return pcb;
 }
 
 /* get_nth_pcb
@@ -39,26 +52,33 @@ pcb_t* get_nth_pcb(uint32_t pid)
 }
 
 /* get_available_fd
- * description: Gets the next available fd in the given pcb
+ * description: Claims the next available fd in the given pcb
  * input:
  * 	pcb - pointer to some pcb
  *  ret - pointer in which to place the found fd
  * output:
  *	Indicates success or failure
- * side effects: Fills whatever is at ret pointer
+ * side effects: Fills whatever is at ret pointer, the fd is marked in use so nobody
+ *				 else gets it (set flags back to 0 to give it up)
  */
 int32_t get_available_fd(pcb_t * pcb, uint32_t * ret)
 {
     if (ret == NULL || pcb == NULL) return -1;
-    uint32_t i;
+    uint32_t i, flags;
+    spin_lock_irqsave(&pcb->files_lock, flags);
 	//loop over indexs in fd array to find open fd index
     for (i = 0; i < NUM_FILES; i++) {
         if (pcb->files[i].flags == 0) {
             break;
         }
-        // if last index has been checked to be closed return neg 1
-        if (i == NUM_FILES - 1) return -1;
     }
+    // if every index has been checked to be in use return neg 1
+    if (i == NUM_FILES) {
+        spin_unlock_irqrestore(&pcb->files_lock, flags);
+        return -1;
+    }
+    pcb->files[i].flags = 1;
+    spin_unlock_irqrestore(&pcb->files_lock, flags);
 	//insert i "index" into ret
     *ret = i;
     return 0;
@@ -112,7 +132,19 @@ int32_t stdio_init(pcb_t* pcb) {
  * side effects: Creates a new kernel and user stack, a new PCB, increases the number of processes, and takes up a PID
  */
 int32_t system_execute (const uint8_t* command) {
-	return system_execute_helper(command, INHERIT_TTY, TRUE, TRUE);
+	// The child inherits our stdin and stdout, so pipes set up with dup2 carry over
+	pcb_t* pcb = get_current_pcb();
+	file_t stdio[2];
+	stdio[STDIN_FD] = pcb->files[STDIN_FD];
+	stdio[STDOUT_FD] = pcb->files[STDOUT_FD];
+	pipe_dup(&stdio[STDIN_FD]);
+	pipe_dup(&stdio[STDOUT_FD]);
+	int32_t ret = system_execute_helper(command, INHERIT_TTY, TRUE, TRUE, stdio);
+	if (ret < 0) {
+		pipe_release(&stdio[STDIN_FD]);
+		pipe_release(&stdio[STDOUT_FD]);
+	}
+	return ret;
 }
 
 
@@ -122,11 +154,15 @@ int32_t system_execute (const uint8_t* command) {
  * 	command - name of the binary to be executed
  *  tid - terminal id associated with the process. if invalid id, it gets
  *		  inherited from the parent process
+ *  has_parent - FALSE for jobs started by the scheduler
+ *  haltable - FALSE if the process is restarted when it halts
+ *  stdio - fd 0 and 1 for the new process, NULL for the terminal. On success
+ *		  the process owns these (pipe references are not taken again)
  * output:
  *	Indicates success or exit value of the given process
  * side effects: Creates a new kernel and user stack, a new PCB, increases the number of processes, and takes up a PID
  */
-int32_t system_execute_helper (const uint8_t* command, int32_t tid, uint8_t has_parent, uint8_t haltable){
+int32_t system_execute_helper (const uint8_t* command, int32_t tid, uint8_t has_parent, uint8_t haltable, file_t* stdio){
     // Don't want interrupts until we hand over control
     cli();
 
@@ -161,8 +197,12 @@ int32_t system_execute_helper (const uint8_t* command, int32_t tid, uint8_t has_
     if (strncmp(magic_nums, buf, 4) != 0) return -1;    // Not magic number it's literally for 4 magic numbers, kinda meta if you ask me
 
     // Get an available PID from the heap
-    int pid;
-    if (heap_pop(pids, MAX_PIDS, &pid) != 0) return -2;
+    int pid, popped;
+    uint32_t flags;
+    spin_lock_irqsave(&pid_lock, flags);
+    popped = heap_pop(pids, MAX_PIDS, &pid);
+    spin_unlock_irqrestore(&pid_lock, flags);
+    if (popped != 0) return -2;
     if (pid < 0 || pid >= MAX_PIDS) return -2;
     // printf("Starting process %d\n", pid);
 
@@ -190,16 +230,21 @@ int32_t system_execute_helper (const uint8_t* command, int32_t tid, uint8_t has_
     open_processes++;
 
     // Create PCB for our new PID
-	pcb_t* curr_pcb = get_current_pcb();
+	// Scheduled jobs start from their own start stack, there is no current pcb
+	pcb_t* curr_pcb = (has_parent) ? get_current_pcb() : NULL;
     pcb_t* pcb = get_nth_pcb(pid);
     pcb->process_id = pid;
     pcb->rtc_rate = DEFAULT_RTC_RATE;
+    pcb->rtc_next = timer_now();
     pcb->parent_id = (has_parent == FALSE) ? pid : curr_pcb->process_id;
+    pcb->nice = (has_parent == FALSE) ? 0 : curr_pcb->nice;
+    pcb->cpu_mask = (has_parent == FALSE) ? CPU_MASK_ALL : curr_pcb->cpu_mask;
     pcb->crashed = FALSE;
+    pcb->vidmapped = FALSE;
 	if (tid >= 0 && tid < MAX_TERMINALS) {
 		pcb->tid = tid;
 		set_vidmem(pcb->tid);
-	} else if (tid == INHERIT_TTY) {
+	} else if (tid == INHERIT_TTY && curr_pcb != NULL) {
 		pcb->tid = curr_pcb->tid;
 	} else if (tid == HEADLESS_TTY) {
 		pcb->tid = HEADLESS_TTY;
@@ -226,12 +271,18 @@ int32_t system_execute_helper (const uint8_t* command, int32_t tid, uint8_t has_
     pcb->command_size = start_idx;
 
     // Initialize all files to nonpresent status
+    spin_lock_init(&pcb->files_lock, &files_lock_stats);
     for (i = 0; i < NUM_FILES; i++) {
         pcb->files[i].flags = 0;
     }
 
     // Initialize stdin and stdout (fd's 0 and 1)
-    stdio_init(pcb);
+    if (stdio == NULL) {
+        stdio_init(pcb);
+    } else {
+        pcb->files[STDIN_FD] = stdio[STDIN_FD];
+        pcb->files[STDOUT_FD] = stdio[STDOUT_FD];
+    }
 
     // Prepare for Context Switch
     // Save our current stack pointer
@@ -240,8 +291,12 @@ int32_t system_execute_helper (const uint8_t* command, int32_t tid, uint8_t has_
     pcb->parent_esp = sp;
 
     // Set the kernel-level esp and stack segment
-    tss.esp0 = (FOUR_MBYTES*2)-(FOUR_KBYTES*2)*(pid)-sizeof(int32_t);
-    tss.ss0 = KERNEL_DS;
+    this_cpu()->tss->esp0 = (FOUR_MBYTES*2)-(FOUR_KBYTES*2)*(pid)-sizeof(int32_t);
+    this_cpu()->tss->ss0 = KERNEL_DS;
+
+    // Leaving the kernel, the iret turns interrupts back on in user space
+    cli();
+    kernel_unlock();
 
     // Push IRET args, then IRET into program
     asm volatile ( "pushl %0;"
@@ -268,6 +323,20 @@ int32_t system_execute_helper (const uint8_t* command, int32_t tid, uint8_t has_
     return get_current_pcb()->child_status;
 }
 
+/* release_pid
+ * description: Puts a pid back into the min heap for new processes
+ * input:
+ * 	pid - pid of a process that is gone
+ * output: None
+ * side effects: None
+*/
+void release_pid(int32_t pid) {
+    uint32_t flags;
+    spin_lock_irqsave(&pid_lock, flags);
+    heap_insert(pid, pids, MAX_PIDS);
+    spin_unlock_irqrestore(&pid_lock, flags);
+}
+
 /* system_halt
  * description: Halt a process
  * input:
@@ -290,25 +359,42 @@ int32_t system_halt(uint8_t status) {
     // If not, take whatever was passed
     get_nth_pcb(pcb->parent_id)->child_status =(pcb->crashed) ? CRASH_RETURN : status;
 
+    // Cancel ring requests, workers still running one keep our pid until they're done
+    bool pid_in_use = ioring_release(pcb->process_id);
+
     // Clear the files for the next process
   	for(i = 0; i < NUM_FILES; i++){
+      // Let go of pipe ends so the other side sees EOF / a broken pipe
+      pipe_release(&pcb->files[i]);
       // set fd array flag to zero
   		pcb->files[i].flags = 0;
   	}
 
+    // Drop any shared memory this process had mapped
+    shm_detach_all(pcb->process_id);
+
+    // Its terminal may scroll along the VGA ring again
+    if (pcb->vidmapped)
+        ttys[pcb->tid].vidmaps--;
+
     // put PID back into min heap
-    heap_insert(pcb->process_id, pids, MAX_PIDS);
+    if (!pid_in_use)
+        release_pid(pcb->process_id);
 
     // Return parent paging
     add_process_page(pcb->parent_id);
 
     // This esp0 is just in case some weird stuff happens between here and the execute ending assembly linkage
-    tss.esp0 = pcb->parent_esp;
-    tss.ss0 = KERNEL_DS;
+    this_cpu()->tss->esp0 = pcb->parent_esp;
+    this_cpu()->tss->ss0 = KERNEL_DS;
 
 	// Execute again if not haltable
 	if (!pcb->haltable)
-		system_execute_helper((uint8_t*)pcb->command, pcb->tid, pcb->process_id!=pcb->parent_id, pcb->haltable);
+		system_execute_helper((uint8_t*)pcb->command, pcb->tid, pcb->process_id!=pcb->parent_id, pcb->haltable, NULL);
+
+	// A job started by the scheduler has no parent stack to go back to
+	if (pcb->process_id == pcb->parent_id)
+		finish_running_job(get_nth_pcb(pcb->parent_id)->child_status);
 
     // Restore the stack pointer to what it was when this process gained control
     asm volatile (
@@ -389,6 +475,11 @@ int32_t system_open (const uint8_t* filename) {
     int32_t ret;
 
     const int8_t* sb16_name = (int8_t*)"sb16";
+    const int8_t* irqstats_name = (int8_t*)IRQ_STATS_FILE;
+    if (filename == NULL) return -1;
+    // Virtual files aren't in the filesystem
+    if (!strncmp((int8_t*)filename, irqstats_name, strlen(irqstats_name) + 1))
+        return irqstats_open(filename);
     // Find the dentry with the given filename (and make sure it exists)
     if (read_dentry_by_name(filename, &dentry) == -1) return -1;
 
@@ -474,8 +565,24 @@ int32_t system_vidmap (uint8_t** screen_start) {
     if((uint32_t)screen_start < IN_MB(8) || screen_start == NULL)
         return -1;                              // returns -1 if address is in the first 8MB of mem. (or if a bad pointer)
 
+    pcb_t* pcb = get_current_pcb();
+    uint32_t flags;
+    // Headless processes have no screen
+    if (pcb->tid < 0 || pcb->tid >= MAX_TERMINALS)
+        return -1;
+
     // If valid, get the current process' vidmemory pointer and set screen start
-    *screen_start =  ttys[get_current_pcb()->tid].vidmem_ptr;
+    *screen_start =  ttys[pcb->tid].vidmem_ptr;
+    cli_and_save(flags);
+    // On screen that page is the start of the VGA ring, scroll back to it and stay
+    // there until we halt (see scroll)
+    if (!pcb->vidmapped) {
+        pcb->vidmapped = TRUE;
+        ttys[pcb->tid].vidmaps++;
+    }
+    if (ttys[pcb->tid].is_visible)
+        vga_home();
+    restore_flags(flags);
     return 0;
 }
 
@@ -506,8 +613,94 @@ int32_t system_sigreturn (void) {
     return -1;// For CP4 and no signal support
 }
 
+/* system_run
+ * description: Schedule a command to run alongside the caller
+ * input:
+ * 	    command - command to run
+ *      tty - terminal for the job, or INHERIT_TTY for the caller's terminal
+ * output:
+ *	    success:0, -1 on error
+ * side effects: The job gets a copy of the caller's stdin and stdout
+ */
 int32_t system_run (const uint8_t* command, int32_t tty) {
-	if (tty < -1 || tty >= MAX_TERMINALS) return -1;
-	schedule_job(command, NULL, tty, TRUE);
-	return 0;
+	if (tty < INHERIT_TTY || tty >= MAX_TERMINALS) return -1;
+	pcb_t* pcb = get_current_pcb();
+	if (tty == INHERIT_TTY) tty = pcb->tid;
+	return schedule_job(command, NULL, tty, TRUE, &pcb->files[STDIN_FD]);
+}
+
+/* system_dup2
+ * description: Make newfd refer to the same open file as oldfd
+ * input:
+ * 	    oldfd - fd to copy
+ *      newfd - fd to replace, closed first if it is open
+ * output:
+ *	    newfd on success, -1 on error
+ * side effects: May close newfd
+ */
+int32_t system_dup2 (int32_t oldfd, int32_t newfd) {
+    uint32_t flags;
+    if (oldfd < 0 || oldfd >= NUM_FILES || newfd < 0 || newfd >= NUM_FILES) return -1;
+    pcb_t* pcb = get_current_pcb();
+    if (pcb->files[oldfd].flags == 0) return -1;
+    if (oldfd == newfd) return newfd;
+
+    // Close whatever newfd was, pipe ends included
+    if (pcb->files[newfd].flags != 0 && pcb->files[newfd].file_ops.close != NULL)
+        pcb->files[newfd].file_ops.close(newfd);
+    // Nobody may claim newfd while it is half copied
+    spin_lock_irqsave(&pcb->files_lock, flags);
+    pcb->files[newfd] = pcb->files[oldfd];
+    pipe_dup(&pcb->files[newfd]);
+    spin_unlock_irqrestore(&pcb->files_lock, flags);
+    return newfd;
+}
+
+/* system_isatty
+ * description: Check whether a fd is the terminal
+ * input:
+ * 	    fd - fd to check
+ * output:
+ *	    1 if fd is the terminal, 0 if it is something else, -1 on error
+ * side effects: None
+ */
+int32_t system_isatty (int32_t fd) {
+    if (fd < 0 || fd >= NUM_FILES) return -1;
+    pcb_t* pcb = get_current_pcb();
+    if (pcb->files[fd].flags == 0) return -1;
+    return (pcb->files[fd].file_ops.read == terminal_read ||
+            pcb->files[fd].file_ops.write == terminal_write) ? 1 : 0;
+}
+
+/* system_batch
+ * description: Runs several syscalls for the price of one trap, in order, through
+ *              the same jump table as int 0x80
+ * input:
+ * 	    entries - user array of syscall numbers and args, results are written back
+ *      count - number of entries, at most BATCH_MAX_ENTRIES
+ *      flags - BATCH_STOP_ON_ERROR to stop after the first entry that returns -1
+ * output:
+ *	    number of entries that ran (their results are filled in), -1 on a bad array
+ * side effects: Whatever the batched syscalls do. halt, execute and batch itself
+ *               can't be batched and fail with -1.
+ */
+int32_t system_batch (batch_entry_t* entries, int32_t count, int32_t flags) {
+    if (count < 0 || count > BATCH_MAX_ENTRIES) return -1;
+    // The whole array has to be in the process' page, not just its start
+    if ((uint32_t)entries < USER_PAGE_START ||
+        (uint32_t)entries + count * sizeof(batch_entry_t) > USER_PAGE_END) return -1;
+    int32_t i;
+    batch_entry_t* entry;
+    for (i = 0; i < count; i++) {
+        entry = &entries[i];
+        if (entry->number < min_syscall_no || entry->number > max_syscall_no ||
+            entry->number == HALT_SYSCALL_NO || entry->number == EXECUTE_SYSCALL_NO ||
+            entry->number == BATCH_SYSCALL_NO) {
+            entry->result = -1;
+        } else {
+            entry->result = syscalls_jumptable[entry->number](entry->args[0], entry->args[1], entry->args[2]);
+        }
+        if (entry->result == -1 && (flags & BATCH_STOP_ON_ERROR)) return i + 1;
+    }
+    return count;
 }
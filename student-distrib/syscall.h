@@ -8,6 +8,7 @@
 #include "x86_desc.h"
 #include "terminal.h"
 #include "paging.h"
+#include "spinlock.h"
 
 //defines
 #define NUM_FILES			(8)
@@ -33,15 +34,47 @@ typedef struct {
 	int32_t parent_id;  // PID of this process' parent
 	int32_t parent_esp; // Parent's ESP when this process was executed
 	uint32_t rtc_rate;  // This process' chosen virtual RTC rate
+	uint32_t rtc_next;  // RTC tick of this process' next virtual interrupt
 	file_t files[NUM_FILES]; // Files open in this process
 	uint32_t child_status;   // Set by the child just before returning to execute
 	int8_t command[MAX_COMMAND_SIZE]; // The command that spawned this process
 	int32_t command_size; // Size of above string
 	uint8_t crashed; // TRUE if the program has crashed due to an exception
+	uint8_t vidmapped; // TRUE once it called vidmap, counted in its terminal's vidmaps
 	int32_t tid; // Where putc and video stuff writes to, i.e: what terminal id
 	uint8_t haltable;	// check if we call kill a process
+	int32_t nice;		// Highest scheduler level this process can be at
+	uint32_t cpu_mask;	// Cpus this process can run on, see system_set_affinity
+	spinlock_t files_lock;	// Taken to claim or replace an fd, kernel threads working for us open files too
 } pcb_t;
 
+// Kernel threads keep this as the pid in their pcb header and the pid of the
+// process they work for as the parent, see get_current_pcb
+#define KTHREAD_PCB_MARK	(-2)
+
+#define HALT_SYSCALL_NO		(1)
+#define EXECUTE_SYSCALL_NO	(2)
+#define BATCH_SYSCALL_NO	(20)
+#define BATCH_MAX_ENTRIES	(64)
+#define BATCH_STOP_ON_ERROR	(1)
+#define BATCH_NUM_ARGS		(3)
+
+/*
+ * batch_entry_t : one syscall in a batch (ece391_batch_entry_t in user space).
+ *				   The kernel fills in result with what the syscall returned.
+ */
+typedef struct {
+	int32_t number;
+	int32_t args[BATCH_NUM_ARGS];
+	int32_t result;
+} batch_entry_t;
+
+// The syscall table and its bounds, in idt.S
+typedef int32_t (*syscall_fn_t)(int32_t arg1, int32_t arg2, int32_t arg3);
+extern syscall_fn_t syscalls_jumptable[];
+extern int32_t min_syscall_no;
+extern int32_t max_syscall_no;
+
 
 // Get the PCB address corresponding to the current kernel stack
 pcb_t* get_current_pcb();
@@ -62,8 +95,12 @@ int32_t system_vidmap (uint8_t** screen_start);
 int32_t system_set_handler (int32_t signum, void* handler_address);
 int32_t system_sigreturn (void);
 int32_t system_run (const uint8_t* command, int32_t tty);
+int32_t system_dup2 (int32_t oldfd, int32_t newfd);
+int32_t system_isatty (int32_t fd);
+int32_t system_batch (batch_entry_t* entries, int32_t count, int32_t flags);
 
 // Helpers
-int32_t system_execute_helper (const uint8_t* command, int32_t tid, uint8_t has_parent, uint8_t haltable);
+void release_pid(int32_t pid);
+int32_t system_execute_helper (const uint8_t* command, int32_t tid, uint8_t has_parent, uint8_t haltable, file_t* stdio);
 
 #endif
@@ -3,6 +3,15 @@
 uint32_t tid = 0;
 tty_t ttys[MAX_TERMINALS];
 uint8_t in_shell = FALSE;
+// Taken to switch terminals, i.e: change tid and what is on screen
+static lock_stats_t tty_switch_stats = LOCK_STATS_INIT("tty switch");
+spinlock_t tty_switch_lock = SPINLOCK_INIT(tty_switch_stats);
+static lock_stats_t tty_lock_stats = LOCK_STATS_INIT("tty");
+
+// Jobs blocked in terminal_read, per terminal
+static wait_queue_t read_queues[MAX_TERMINALS];
+// Lines that scrolled off each terminal, see scrollback_push
+static uint16_t scrollback_rows[MAX_TERMINALS][SCROLLBACK_LINES][NUM_COLS];
 
 /*
   init_terminals
@@ -35,11 +44,21 @@ void init_terminals(void) {
         }
 		set_vidmem(i);
 	    clear();
+    }
+    for (i = 0; i < MAX_TERMINALS; i++) {
+        spin_lock_init(&ttys[i].lock, &tty_lock_stats);
+        ttys[i].scrollback = scrollback_rows[i];
+        ttys[i].scrollback_head = 0;
+        ttys[i].scrollback_count = 0;
+        ttys[i].scrollback_view = 0;
+        ttys[i].vidmaps = 0;
     }
 	// Switch to first terminal
     ttys[tid].is_visible = TRUE;
     background_color = ttys[tid].background_color;
     foreground_color = ttys[tid].foreground_color;
+	// Boot messages may have scrolled the screen along the VGA ring
+	vga_home();
 	set_vidmem(tid);
 	map_addr_to_addr(ttys[tid].vidmem_ptr, (uint8_t*)VIDEO);
 	clear();
@@ -59,7 +78,8 @@ int32_t terminal_switch(uint32_t new_tid) {
 	// Set which tty is visible, and change colors
 	ttys[tid].is_visible = FALSE;
 	ttys[new_tid].is_visible = TRUE;
-	// Un-map vidmem
+	// Un-map vidmem, with the screen back where VIDEO has it
+	vga_home();
 	map_addr_to_addr(ttys[tid].vidmem_ptr, ttys[tid].vidmem_ptr);
     // Memcpy vidmem to actual vga vidmem
     memcpy(ttys[tid].vidmem_ptr, (uint8_t*)VIDEO, 2*NUM_COLS*NUM_ROWS);
@@ -74,6 +94,73 @@ int32_t terminal_switch(uint32_t new_tid) {
     return 0;
 }
 
+/*
+  scrollback_push
+	description: saves rows that scrolled off a terminal in its scrollback, the
+               oldest ones go once it is full. At most two copies however many
+               rows there are.
+	inputs: terminal_id - terminal they scrolled off
+          rows - the rows, oldest first
+          n - how many
+	output: None
+	side effect: changes the terminal's scrollback
+*/
+void scrollback_push(int32_t terminal_id, const uint16_t* rows, uint32_t n) {
+    tty_t* tty;
+    uint32_t chunk;
+    // Nobody scrolls back a headless job
+    if (terminal_id < 0 || terminal_id >= MAX_TERMINALS) return;
+    tty = &ttys[terminal_id];
+    // Only the newest SCROLLBACK_LINES rows would stay anyways
+    if (n > SCROLLBACK_LINES) {
+        rows += (n - SCROLLBACK_LINES) * NUM_COLS;
+        n = SCROLLBACK_LINES;
+    }
+    tty->scrollback_count = MIN(tty->scrollback_count + n, SCROLLBACK_LINES);
+    while (n > 0) {
+        chunk = MIN(n, SCROLLBACK_LINES - tty->scrollback_head);
+        memcpy(tty->scrollback[tty->scrollback_head], rows, (chunk * NUM_COLS) << 1);
+        rows += chunk * NUM_COLS;
+        n -= chunk;
+        tty->scrollback_head = (tty->scrollback_head + chunk) % SCROLLBACK_LINES;
+    }
+}
+
+/*
+  scrollback_view
+	description: shows the visible terminal scrolled back some rows into its
+               scrollback, in VGA memory that isn't on screen so the screen
+               itself is left alone
+	inputs: lines - how many rows back, 0 goes back to the screen
+	output: None
+	side effect: changes what is on screen
+*/
+void scrollback_view(int32_t lines) {
+    tty_t* tty = &ttys[tid];
+    uint16_t *view, *screen;
+    uint32_t row, line;
+    if (lines <= 0) {
+        tty->scrollback_view = 0;
+        vga_show(NULL);
+        return;
+    }
+    // Saves what is still waiting in the VGA ring first
+    view = vga_spare_screen();
+    screen = vga_screen();
+    tty->scrollback_view = MIN((uint32_t)lines, tty->scrollback_count);
+    // Rows of scrollback followed by rows of the screen
+    for (row = 0; row < NUM_ROWS; row++) {
+        line = tty->scrollback_count - tty->scrollback_view + row;
+        if (line < tty->scrollback_count) {
+            line = (tty->scrollback_head + SCROLLBACK_LINES - tty->scrollback_count + line) % SCROLLBACK_LINES;
+            memcpy(view + row * NUM_COLS, tty->scrollback[line], NUM_COLS << 1);
+        } else {
+            memcpy(view + row * NUM_COLS, screen + (line - tty->scrollback_count) * NUM_COLS, NUM_COLS << 1);
+        }
+    }
+    vga_show(tty->scrollback_view ? view : NULL);
+}
+
 /*
   terminal_write
 	description: syscall for stout
@@ -84,11 +171,7 @@ int32_t terminal_switch(uint32_t new_tid) {
 */
 int32_t terminal_write(int32_t fd, int8_t* buff, uint32_t size){
     if (buff == NULL || NUM_FILES <= fd || fd < 0) return -1;
-    int32_t bytes_written;
-    for (bytes_written = 0; bytes_written < size; bytes_written++) {
-        putc(buff[bytes_written]);
-    }
-    return bytes_written;
+    return putbuf(buff, size);
 }
 
 /*
@@ -102,13 +185,22 @@ int32_t terminal_write(int32_t fd, int8_t* buff, uint32_t size){
 int32_t terminal_read(int32_t fd, int8_t* buff, uint32_t size){
     if (buff == NULL || NUM_FILES <= fd || fd < 0) return -1;
 	int terminal_id = get_current_pcb()->tid;
+    // Nothing can ever type into a headless job
+    if (terminal_id < 0 || terminal_id >= MAX_TERMINALS) return -1;
+    // The keyboard only touches the line again once we are done with it
+    uint32_t flags;
+    spin_lock_irqsave(&ttys[terminal_id].lock, flags);
     ttys[terminal_id].read_pending = TRUE;
 
-    // Wait for newline
-    sti();
-    while (!ttys[terminal_id].returned);
-    // Once we get our return, we ignore interrupts
-    cli();
+    // Sleep until the keyboard hands us a newline
+    while (!ttys[terminal_id].returned) {
+        // A ring worker whose process halted, the line is for whoever reads next
+        if (sleep_on_locked(&read_queues[terminal_id], &ttys[terminal_id].lock) == -1) {
+            ttys[terminal_id].read_pending = FALSE;
+            spin_unlock_irqrestore(&ttys[terminal_id].lock, flags);
+            return -1;
+        }
+    }
 
     ttys[terminal_id].returned = FALSE;
     // Copy keyboard buffer to external buffer
@@ -135,5 +227,19 @@ int32_t terminal_read(int32_t fd, int8_t* buff, uint32_t size){
     // Clear buff
     ttys[terminal_id].current_size = 0;
     ttys[terminal_id].cursor_pos = 0;
+    spin_unlock_irqrestore(&ttys[terminal_id].lock, flags);
     return i;
 }
+
+/*
+  terminal_wake_reader
+	description: wakes whoever is blocked in terminal_read on a terminal,
+               called by the keyboard handler once a line is entered, with the
+               terminal's lock held
+	inputs: terminal_id - terminal that got the newline
+	output: None
+*/
+void terminal_wake_reader(int32_t terminal_id) {
+    if (terminal_id < 0 || terminal_id >= MAX_TERMINALS) return;
+    wake_up(&read_queues[terminal_id]);
+}
@@ -7,8 +7,14 @@
 #include "syscall.h"
 #include "paging.h"
 #include "colors.h"
+#include "scheduler.h"
+#include "spinlock.h"
 
 #define HISTORY_LENGTH (20)
+// Lines each terminal keeps once they scroll off the top, and how many
+// Shift+PgUp/PgDn move by
+#define SCROLLBACK_LINES (256)
+#define SCROLLBACK_STEP (NUM_ROWS-1)
 
 typedef struct {
     // Core functionality
@@ -23,6 +29,7 @@ typedef struct {
     volatile uint8_t returned;
     uint8_t is_visible;
     uint8_t was_visited;
+    spinlock_t lock;    // Covers handing a line from the keyboard to terminal_read
     // Extra (credit?) fancy stuff
     uint8_t background_color;
     uint8_t foreground_color;
@@ -32,9 +39,15 @@ typedef struct {
     uint32_t history_size;  // How many commands are saved
     uint32_t history_pos;  // index to next history 'slot'
     uint32_t history_viewer;  // user is looking at this one
+    uint16_t (*scrollback)[NUM_COLS];  // SCROLLBACK_LINES rows, a ring
+    uint32_t scrollback_head;  // Row the next line to scroll off goes to
+    uint32_t scrollback_count;  // How many rows are saved
+    uint32_t scrollback_view;  // How many rows the screen is scrolled back, 0 for none
+    uint32_t vidmaps;  // Processes on it that called vidmap, its screen stays at VIDEO then
 } tty_t;
 
 extern uint32_t tid;
+extern spinlock_t tty_switch_lock;
 extern tty_t ttys[MAX_TERMINALS];
 extern uint8_t in_shell;
 
@@ -42,5 +55,8 @@ void init_terminals(void);
 extern int32_t terminal_switch(uint32_t new_tid);
 extern int32_t terminal_write(int32_t fd, int8_t* buff, uint32_t size);
 extern int32_t terminal_read(int32_t fd, int8_t* buff, uint32_t size);
+void terminal_wake_reader(int32_t terminal_id);
+void scrollback_push(int32_t terminal_id, const uint16_t* rows, uint32_t n);
+void scrollback_view(int32_t lines);
 
 #endif
@@ -6,10 +6,19 @@
 #include "paging.h"
 #include "terminal.h"
 #include "fs.h"
+#include "timer.h"
+#include "clock.h"
+#include "workqueue.h"
+#include "smp.h"
+#include "spinlock.h"
 
 #define PASS 1
 #define FAIL 0
 #define SKIP_FAIL 1
+#define EFLAGS_IF (0x200)
+#define FLOOD_LINE (3)			// COM2, free, stands in for the keyboard
+#define FLOOD_HANDLER_USECS (2000)	// A slow keyboard render
+#define PIT_LATENCY_ROUNDS (5)
 
 /* format these macros as you see fit */
 #define TEST_HEADER 	\
@@ -239,10 +248,13 @@ int test_spam_keyboard(){
 	TEST_HEADER;
 	int result = PASS;
 	int i = 0;
+	uint32_t dropped = keyboard_dropped();
 	for (i = 0; i < 256; i++) {
 		outb(i, KEYBOARD_SCAN_CODE_PORT);
 		asm volatile ("int $0x21");
 	}
+	// A burst this size has to fit in the scan code ring
+	if (keyboard_dropped() != dropped) result = FAIL;
 	return result;
 }
 
@@ -301,6 +313,117 @@ int test_terminal_write(){
 	return FAIL;
 }
 
+/* Tests the bulk write path
+ *
+ * Writes the same text with putbuf and one putc at a time, from the same
+ * screen and cursor, and checks both leave the same cells and cursor. There
+ * are more lines than the VGA ring has rows, so the screen wraps around it.
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: writes to vmem
+ * Coverage: putbuf, terminal_write, scroll
+ * Files: lib.c, terminal.c
+ */
+int test_putbuf(){
+	TEST_HEADER;
+	static uint16_t before[NUM_ROWS*NUM_COLS], expected[NUM_ROWS*NUM_COLS];
+	static int8_t buff[VGA_RING_ROWS*NUM_COLS];
+	uint16_t* screen = (uint16_t*)VIDEO;
+	int32_t i, x, y, expected_x, expected_y;
+	// Short lines, blank lines and lines that wrap, enough of them to scroll
+	for (i = 0; i < sizeof(buff); i++)
+		buff[i] = (i % 97 == 0 || i % 131 == 0 || i % 132 == 0) ? '\n' : 'a' + i % 26;
+	// Compare screens where the ring starts
+	vga_home();
+	x = getcursor_x();
+	y = getcursor_y();
+	memcpy(before, screen, sizeof(before));
+	for (i = 0; i < sizeof(buff); i++)
+		putc(buff[i]);
+	vga_home();
+	memcpy(expected, screen, sizeof(expected));
+	expected_x = getcursor_x();
+	expected_y = getcursor_y();
+
+	memcpy(screen, before, sizeof(before));
+	setcursor(x, y);
+	if (putbuf(buff, sizeof(buff)) != sizeof(buff))
+		return FAIL;
+	vga_home();
+	if (getcursor_x() != expected_x || getcursor_y() != expected_y)
+		return FAIL;
+	for (i = 0; i < NUM_ROWS*NUM_COLS; i++) {
+		if (screen[i] != expected[i])
+			return FAIL;
+	}
+	printf("\n");
+	return PASS;
+}
+
+/* Tests scrolling a vidmapped terminal
+ *
+ * Pretends a process on the visible terminal called vidmap and scrolls a
+ * few lines, the screen has to stay at VIDEO where its page points
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: writes to vmem
+ * Coverage: scroll, vga_home
+ * Files: lib.c, syscall.c
+ */
+int test_vidmap_scroll(){
+	TEST_HEADER;
+	uint16_t* screen = (uint16_t*)VIDEO;
+	int32_t i;
+	int result = PASS;
+	vga_home();
+	ttys[tid].vidmaps++;
+	for (i = 0; i < NUM_ROWS; i++)
+		printf("vidmap %d\n", i);
+	// The last line printed is right above the cursor's row
+	if (vga_screen() != screen || (uint8_t)screen[(NUM_ROWS-2)*NUM_COLS] != 'v')
+		result = FAIL;
+	ttys[tid].vidmaps--;
+	return result;
+}
+
+/* Tests the scrollback
+ *
+ * Scrolls lines of one letter each off the screen and checks the newest
+ * saved row is the line right above the screen, and that scrolling back a
+ * row shows it above the screen's first one
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: writes to vmem
+ * Coverage: scroll, scrollback_push, scrollback_view
+ * Files: lib.c, terminal.c
+ */
+int test_scrollback(){
+	TEST_HEADER;
+	static int8_t buff[(SCROLLBACK_LINES+NUM_ROWS)*NUM_COLS];
+	tty_t* tty = &ttys[tid];
+	uint16_t *screen = (uint16_t*)VIDEO, *view;
+	uint8_t top;
+	int32_t i;
+	for (i = 0; i < sizeof(buff); i++)
+		buff[i] = (i % NUM_COLS == NUM_COLS-1) ? '\n' : 'a' + (i / NUM_COLS) % 26;
+	putbuf(buff, sizeof(buff));
+	// Saves the rows still above the screen
+	vga_home();
+	if (tty->scrollback_count != SCROLLBACK_LINES)
+		return FAIL;
+	top = (uint8_t)screen[0];
+	i = (tty->scrollback_head + SCROLLBACK_LINES - 1) % SCROLLBACK_LINES;
+	if ((uint8_t)tty->scrollback[i][0] != 'a' + (top - 'a' + 25) % 26)
+		return FAIL;
+	scrollback_view(1);
+	view = vga_spare_screen();
+	if (tty->scrollback_view != 1 || view[0] != tty->scrollback[i][0] || view[NUM_COLS] != screen[0])
+		return FAIL;
+	scrollback_view(0);
+	printf("\n");
+	return PASS;
+}
+
 /* Tests the stdin
  *
  * Inputs: None
@@ -524,6 +647,284 @@ void test_min_heap(void){
 /* Checkpoint 4 tests */
 /* Checkpoint 5 tests */
 
+#define TEST_TIMERS	(200)
+static ktimer_t test_timers[TEST_TIMERS];
+static int test_timer_fired;
+
+/* test_timer_fn
+ * Counts timers that fired, none should in test_timer_wheel
+ */
+static void test_timer_fn(ktimer_t* timer){
+	test_timer_fired++;
+}
+
+/* Timer wheel
+ *
+ * Arms timers spread over every wheel level and cancels them again
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: None
+ * Coverage: add_timer, del_timer, timer_pending, timer_next_expiry, msecs_to_ticks
+ * Files: timer.h/c
+ */
+int test_timer_wheel(void){
+	TEST_HEADER;
+	int i;
+	int result = PASS;
+	uint32_t flags, next;
+
+	if (msecs_to_ticks(MSECS_PER_SEC) != MAX_FREQ) result = FAIL;
+	if (msecs_to_ticks(1) != 2) result = FAIL;	// rounds up
+	if (msecs_to_ticks(0xFFFFFFFF) != TIMER_MAX_TICKS) result = FAIL;
+
+	// Keep the RTC from running the wheel underneath us
+	cli_and_save(flags);
+	test_timer_fired = 0;
+	for (i = 0; i < TEST_TIMERS; i++){
+		init_timer(&test_timers[i], test_timer_fn, NULL);
+		add_timer(&test_timers[i], (1 << (i % (TIMER_LEVELS * TIMER_SLOT_BITS))) + i);
+	}
+	// The wheel's interrupt must come no later than the first of ours
+	if (!timer_next_expiry(&next) || (int32_t)(next - test_timers[0].expires) > 0) result = FAIL;
+	// Re-arming a pending timer must not link it twice
+	add_timer(&test_timers[0], TIMER_MAX_TICKS);
+	for (i = 0; i < TEST_TIMERS; i++){
+		if (!timer_pending(&test_timers[i])) result = FAIL;
+	}
+	for (i = 0; i < TEST_TIMERS; i++){
+		del_timer(&test_timers[i]);
+		del_timer(&test_timers[i]);	// cancelling twice is harmless
+	}
+	for (i = 0; i < TEST_TIMERS; i++){
+		if (timer_pending(&test_timers[i])) result = FAIL;
+	}
+	restore_flags(flags);
+	if (test_timer_fired != 0) result = FAIL;
+	return result;
+}
+
+
+/* Clock
+ *
+ * Checks the 64 bit helpers and that the clock never goes backwards
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: None
+ * Coverage: div64_32, cycles_to_ns, clock_ns
+ * Files: clock.h/c
+ */
+int test_clock(void){
+	TEST_HEADER;
+	int i;
+	uint64_t n = ((uint64_t)3 << 32) + 7;
+	uint64_t prev, now;
+
+	if (div64_32(&n, 2) != 1 || n != (((uint64_t)3 << 32) + 7) >> 1) return FAIL;
+	if (clock_tsc_khz() != 0){
+		// One second of cycles, give or take the rounding of tsc_mult
+		n = cycles_to_ns((uint64_t)clock_tsc_khz() * 1000);
+		div64_32(&n, NSEC_PER_MSEC);
+		if (n < 999 || n > 1000) return FAIL;
+	}
+
+	prev = clock_ns();
+	for (i = 0; i < 1000; i++){
+		now = clock_ns();
+		if (now < prev) return FAIL;
+		prev = now;
+	}
+	return PASS;
+}
+
+/* test_work_fn
+ * Never runs, test_workqueue's queue has no thread
+ */
+static void test_work_fn(work_t* work){
+}
+
+/* Work queue
+ *
+ * Queues work on a queue with no thread and checks order and that pending work
+ * isn't queued twice
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: None
+ * Coverage: init_work, queue_work
+ * Files: workqueue.h/c
+ */
+int test_workqueue(void){
+	TEST_HEADER;
+	int result = PASS;
+	workqueue_t wq;
+	work_t a, b;
+
+	spin_lock_init(&wq.lock, NULL);
+	wq.head = wq.tail = NULL;
+	init_wait_queue(&wq.wait);
+	init_work(&a, test_work_fn, NULL);
+	init_work(&b, test_work_fn, NULL);
+	if (!queue_work(&wq, &a)) result = FAIL;
+	if (!queue_work(&wq, &b)) result = FAIL;
+	if (queue_work(&wq, &a)) result = FAIL;	// already pending
+	if (wq.head != &a || a.next != &b || wq.tail != &b || b.next != NULL) result = FAIL;
+	if (!a.pending || !b.pending) result = FAIL;
+	return result;
+}
+
+/* SMP
+ *
+ * Checks the boot processor's bookkeeping and that the big kernel lock nests
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: None
+ * Coverage: this_cpu_id, kernel_lock, kernel_unlock, ioapic_enable_irq
+ * Files: smp.h/c, apic.h/c
+ */
+int test_smp(void){
+	TEST_HEADER;
+	int result = PASS;
+	uint32_t depth;
+
+	if (this_cpu_id() != 0) result = FAIL;	// tests run on the BSP
+	if (num_cpus < 1 || num_cpus > MAX_CPUS) result = FAIL;
+	if (this_cpu()->tss != &tss) result = FAIL;
+	if (!(smp_online_mask() & 1)) result = FAIL;	// jobs can always go on the BSP
+	if (ioapic_enable_irq(NUM_ISA_IRQS) != -1) result = FAIL;	// only the ISA lines are routed
+	depth = this_cpu()->lock_depth;
+	kernel_lock();
+	kernel_lock();
+	if (this_cpu()->lock_depth != depth + 2) result = FAIL;
+	kernel_unlock();
+	kernel_unlock();
+	if (this_cpu()->lock_depth != depth) result = FAIL;
+	return result;
+}
+
+/* Spinlocks
+ *
+ * Takes a spinlock plain, with trylock and with interrupts off, a ticket lock
+ * twice, and checks the stats counted each time. Also checks cmpxchg only
+ * replaces the value it expects.
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: None
+ * Coverage: spin_lock, spin_trylock, spin_lock_irqsave, ticket_lock, cmpxchg
+ * Files: spinlock.h/c
+ */
+int test_spinlock(void){
+	TEST_HEADER;
+	int result = PASS;
+	static lock_stats_t stats = LOCK_STATS_INIT("test");
+	spinlock_t lock;
+	ticket_lock_t ticket;
+	uint32_t flags, held_flags;
+	volatile uint32_t word = 0;
+
+	spin_lock_init(&lock, &stats);
+	spin_lock(&lock);
+	if (spin_trylock(&lock)) result = FAIL;	// already held
+	spin_unlock(&lock);
+	if (!spin_trylock(&lock)) result = FAIL;
+	spin_unlock(&lock);
+	spin_lock_irqsave(&lock, flags);
+	cli_and_save(held_flags);	// just to read eflags
+	if (held_flags & EFLAGS_IF) result = FAIL;	// interrupts off while held
+	spin_unlock_irqrestore(&lock, flags);
+	if (stats.acquired != 3 || stats.contended != 0) result = FAIL;
+
+	ticket_lock_init(&ticket, &stats);
+	ticket_lock(&ticket);
+	ticket_unlock(&ticket);
+	ticket_lock(&ticket);
+	ticket_unlock(&ticket);
+	if (ticket.next != 2 || ticket.owner != 2) result = FAIL;
+	if (stats.acquired != 5) result = FAIL;
+
+	if (cmpxchg(&word, 1, 2) != 0 || word != 0) result = FAIL;	// not what it expected
+	if (cmpxchg(&word, 0, 2) != 0 || word != 2) result = FAIL;
+	return result;
+}
+
+static volatile uint32_t pit_probe_tsc;
+static volatile bool flood_if_on, flood_line_masked;
+
+/* Stands in for schedulerHandler, notes when the PIT got through */
+static void pit_probe(void){
+	pit_probe_tsc = (uint32_t)rdtsc();
+	send_eoi(PIT_PIC_LINE);
+}
+
+/* A slow device handler, checks it runs the way do_IRQ promises */
+static void flood_handler(void){
+	uint32_t flags;
+	cli_and_save(flags);
+	restore_flags(flags);
+	flood_if_on = (flags & EFLAGS_IF) != 0;
+	if (!ioapic_active) flood_line_masked = (inb(MASTER_DATA_PORT) & (1 << FLOOD_LINE)) != 0;
+	clock_udelay(FLOOD_HANDLER_USECS);
+}
+
+/* cycles from arming a one shot PIT tick to its handler running, flooding the
+ * flood line with interrupts the whole time if asked */
+static uint32_t pit_tick_cycles(bool flood){
+	uint32_t start;
+	pit_probe_tsc = 0;
+	start = (uint32_t)rdtsc();
+	pit_arm_tick();
+	while (pit_probe_tsc == 0) {
+		if (flood) asm volatile ("int %0" : : "i"(IRQ_OFFSET + FLOOD_LINE));
+		else asm volatile ("pause");
+	}
+	return pit_probe_tsc - start;
+}
+
+/* PIT latency
+ *
+ * Arms one shot PIT ticks while a slow device handler is hammered with interrupts,
+ * the tick has to get through in the middle of one (nested) instead of waiting
+ * for it to finish. Prints the worst extra latency next to an idle baseline.
+ * Runs with the other cpus online (launch_smp_tests), whatever they hold the big
+ * kernel lock for shows up here too.
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: Takes over the PIT for a while, leaves it as init_pit does
+ * Coverage: do_IRQ, call_irq_handler, nested interrupts
+ * Files: idt_common.c, idt.S
+ */
+int test_pit_latency(void){
+	TEST_HEADER;
+	int result = PASS;
+	uint32_t flags, i, cycles, baseline = 0, worst = 0;
+	uint32_t handler_cycles = clock_tsc_khz() * (FLOOD_HANDLER_USECS / USEC_PER_MSEC);
+
+	cli_and_save(flags);
+	setIRQhandler(PIT_IRQ, &pit_probe);
+	setIRQhandler(IRQ_OFFSET + FLOOD_LINE, &flood_handler);
+	enable_irq(PIT_PIC_LINE);
+	sti();
+	for (i = 0; i < PIT_LATENCY_ROUNDS; i++) {
+		cycles = pit_tick_cycles(FALSE);
+		if (baseline == 0 || cycles < baseline) baseline = cycles;
+	}
+	for (i = 0; i < PIT_LATENCY_ROUNDS; i++) {
+		cycles = pit_tick_cycles(TRUE);
+		if (cycles > worst) worst = cycles;
+	}
+	cli();
+	disable_irq(FLOOD_LINE);
+	setIRQhandler(IRQ_OFFSET + FLOOD_LINE, NULL);
+	setIRQhandler(PIT_IRQ, &schedulerHandler);
+	init_pit();
+	restore_flags(flags);
+
+	worst = (worst > baseline) ? worst - baseline : 0;
+	printf("pit latency: baseline %u cycles, worst extra under flood %u cycles\n", baseline, worst);
+	if (!flood_if_on) result = FAIL;
+	if (!ioapic_active && !flood_line_masked) result = FAIL;
+	// Without nesting the tick waits out a whole handler
+	if (handler_cycles != 0 && worst >= handler_cycles / 2) result = FAIL;
+	return result;
+}
 
 /* Test suite entry point */
 void launch_tests(){
@@ -538,13 +939,27 @@ void launch_tests(){
 	TEST_OUTPUT("test_pagefault_vmem", test_pagefault_vmem());
 	TEST_OUTPUT("test_syscall_handler", test_syscall_handler());
 	TEST_OUTPUT("test_terminal_write", test_terminal_write());
+	TEST_OUTPUT("test_putbuf", test_putbuf());
+	TEST_OUTPUT("test_vidmap_scroll", test_vidmap_scroll());
+	TEST_OUTPUT("test_scrollback", test_scrollback());
 	TEST_OUTPUT("test_terminal_read", test_terminal_read());
 		
 	TEST_OUTPUT("test_strstrip", test_strstrip());
 	TEST_OUTPUT("test_strsplit", test_strsplit());
 	TEST_OUTPUT("test_strgetword", test_strgetword());
+	TEST_OUTPUT("test_timer_wheel", test_timer_wheel());
+	TEST_OUTPUT("test_clock", test_clock());
+	TEST_OUTPUT("test_workqueue", test_workqueue());
+	TEST_OUTPUT("test_smp", test_smp());
+	TEST_OUTPUT("test_spinlock", test_spinlock());
 	//all are PASS/FAIL, shouldn't fault
 	test_min_heap();
 	terminal_read(0,"",0);
 
 }
+
+/* Test suite entry point for tests that need the other processors online,
+ * run once smp_init started them */
+void launch_smp_tests(){
+	TEST_OUTPUT("test_pit_latency", test_pit_latency());
+}
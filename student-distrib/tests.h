@@ -3,5 +3,6 @@
 
 // test launcher
 void launch_tests();
+void launch_smp_tests();
 
 #endif /* TESTS_H */
@@ -0,0 +1,444 @@
+#include "timer.h"
+#include "rtc.h"
+#include "clock.h"
+#include "pit.h"
+#include "apic.h"
+
+// Slot lists are circular around a sentinel, so unlinking never needs to find a head
+static ktimer_t wheel[TIMER_LEVELS][TIMER_SLOTS];
+// Next tick whose level 0 slot has not been run yet
+static uint32_t wheel_now;
+// Timers on the wheel
+static uint32_t wheel_pending;
+// Where the wheel's interrupts come from, TIMER_EVENT_*
+static uint32_t wheel_event;
+// The RTC is interrupting for the wheel (TIMER_EVENT_RTC_ARMED)
+static bool event_armed;
+// Covers the wheel, wheel_now and the fields below. Callbacks run without it.
+static lock_stats_t wheel_lock_stats = LOCK_STATS_INIT("timer wheel");
+static spinlock_t wheel_lock = SPINLOCK_INIT(wheel_lock_stats);
+// Timer whose callback run_timers is in, NULL if none
+static ktimer_t* volatile running_timer;
+// A cpu is in run_timers, another one leaves the ticks to it
+static bool timers_running;
+
+/*  init_timers
+	description: empties the timer wheel and picks where its interrupts come from.
+				 Must run after init_clock and apic_init, and before init_RTC.
+	inputs: none
+	output: none
+	side effect: every slot becomes an empty list
+*/
+void init_timers(void) {
+	int level, slot;
+	for (level = 0; level < TIMER_LEVELS; level++) {
+		for (slot = 0; slot < TIMER_SLOTS; slot++) {
+			wheel[level][slot].next = &wheel[level][slot];
+			wheel[level][slot].prev = &wheel[level][slot];
+		}
+	}
+	if (clock_tsc_khz() == 0)
+		wheel_event = TIMER_EVENT_RTC;
+	else if (apic_timer_active || PIT_TICKLESS)
+		wheel_event = TIMER_EVENT_PIT;
+	else
+		wheel_event = TIMER_EVENT_RTC_ARMED;
+	wheel_pending = 0;
+	event_armed = FALSE;
+	wheel_now = timer_now();
+}
+
+/*  timer_rtc_always
+	description: checks if the RTC has to interrupt at MAX_FREQ all the time, because
+				 without a TSC its ticks are the clock
+	inputs: none
+	output: TRUE if so
+	side effect: none
+*/
+bool timer_rtc_always(void) {
+	return wheel_event == TIMER_EVENT_RTC;
+}
+
+/*  init_timer
+	description: prepares a timer that is not on the wheel
+	inputs: timer - timer to set up
+			fn - called from the RTC interrupt when the timer expires, without the
+				 wheel lock
+			data - anything fn needs, kept in timer->data
+	output: none
+	side effect: none
+*/
+void init_timer(ktimer_t* timer, timer_fn_t fn, void* data) {
+	timer->next = NULL;
+	timer->prev = NULL;
+	timer->expires = 0;
+	timer->fn = fn;
+	timer->data = data;
+}
+
+/*  enqueue_timer
+	description: links a timer into the slot for timer->expires, picking the level by
+				 how far away that is. wheel_lock must be held.
+	inputs: timer - timer not on the wheel
+	output: none
+	side effect: expiries in the past fire on the next tick, ones too far away are
+				 pulled in to TIMER_MAX_TICKS
+*/
+static void enqueue_timer(ktimer_t* timer) {
+	uint32_t delta = timer->expires - wheel_now;
+	uint32_t level;
+	ktimer_t* slot;
+	if ((int32_t)delta < 0) {
+		delta = 0;
+		timer->expires = wheel_now;
+	} else if (delta > TIMER_MAX_TICKS) {
+		delta = TIMER_MAX_TICKS;
+		timer->expires = wheel_now + TIMER_MAX_TICKS;
+	}
+	for (level = 0; level < TIMER_LEVELS - 1; level++) {
+		if (delta < (1 << ((level + 1) * TIMER_SLOT_BITS))) break;
+	}
+	slot = &wheel[level][(timer->expires >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK];
+	timer->next = slot;
+	timer->prev = slot->prev;
+	slot->prev->next = timer;
+	slot->prev = timer;
+	wheel_pending++;
+}
+
+/*  unlink_timer
+	description: takes a timer off whatever slot it is in. wheel_lock must be held.
+	inputs: timer - timer on the wheel
+	output: none
+	side effect: timer is no longer pending
+*/
+static void unlink_timer(ktimer_t* timer) {
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->next = NULL;
+	timer->prev = NULL;
+	wheel_pending--;
+}
+
+/*  next_expiry
+	description: finds the earliest tick the wheel has to run at. A level 0 slot gives
+				 its timers' tick, a slot further up the tick it cascades at, which is
+				 no later than any of its timers. wheel_lock must be held.
+	inputs: none
+	output: the tick, wheel_now + TIMER_MAX_TICKS if the wheel is empty
+	side effect: none
+*/
+static uint32_t next_expiry(void) {
+	uint32_t next = wheel_now + TIMER_MAX_TICKS;
+	uint32_t level, shift, base, i, at;
+	ktimer_t* slot;
+	for (level = 0; level < TIMER_LEVELS; level++) {
+		shift = level * TIMER_SLOT_BITS;
+		base = wheel_now >> shift;
+		for (i = 0; i < TIMER_SLOTS; i++) {
+			slot = &wheel[level][(base + i) & TIMER_SLOT_MASK];
+			if (slot->next == slot) continue;
+			at = (base + i) << shift;
+			// This slot already cascaded, what is in it now is a lap further on
+			if ((int32_t)(at - wheel_now) < 0) at += TIMER_SLOTS << shift;
+			if ((int32_t)(at - next) < 0) next = at;
+			break;
+		}
+	}
+	return next;
+}
+
+/*  ns_to_ticks
+	description: converts clock_ns to the wheel's clock
+	inputs: ns - ns since boot
+	output: RTC ticks since boot, 64 bits
+	side effect: none
+*/
+static uint64_t ns_to_ticks(uint64_t ns) {
+	uint64_t ticks = ns << RTC_FREQ_SHIFT;
+	div64_32(&ticks, NSEC_PER_SEC);
+	return ticks;
+}
+
+/*  program_wheel_event
+	description: makes sure the wheel gets an interrupt by its next expiry, and none
+				 while it is empty. With TIMER_EVENT_PIT that is the wheel's deadline
+				 for the PIT's one shots, with TIMER_EVENT_RTC_ARMED the RTC's periodic
+				 interrupt while any timer is armed. wheel_lock must be held.
+	inputs: none
+	output: none
+	side effect: programs the PIT or the RTC
+*/
+static void program_wheel_event(void) {
+	uint64_t ticks;
+	if (wheel_event == TIMER_EVENT_RTC_ARMED) {
+		if ((wheel_pending > 0) != event_armed) {
+			event_armed = (wheel_pending > 0);
+			rtc_set_periodic(event_armed);
+		}
+		return;
+	}
+	if (wheel_event != TIMER_EVENT_PIT) return;
+	if (wheel_pending == 0) {
+		pit_set_deadline(PIT_EVENT_WHEEL, PIT_NO_DEADLINE);
+		return;
+	}
+	// Widen the expiry to 64 bits around the clock, then take when that tick starts
+	// (rounded up, so the clock reads at least the expiry once it passed)
+	ticks = ns_to_ticks(clock_ns());
+	ticks += (int64_t)(int32_t)(next_expiry() - (uint32_t)ticks);
+	pit_set_deadline(PIT_EVENT_WHEEL, (ticks * NSEC_PER_SEC + MAX_FREQ - 1) >> RTC_FREQ_SHIFT);
+}
+
+/*  arm_timer
+	description: add_timer_at with wheel_lock already held
+	inputs: timer - initialized timer
+			expires - tick from timer_now() to fire at
+	output: none
+	side effect: see add_timer_at
+*/
+static void arm_timer(ktimer_t* timer, uint32_t expires) {
+	if (timer->prev != NULL) unlink_timer(timer);
+	// Nothing ran the wheel while it was empty, catch up with the clock
+	if (wheel_pending == 0) wheel_now = timer_now();
+	timer->expires = expires;
+	enqueue_timer(timer);
+	program_wheel_event();
+}
+
+/*  wait_for_callback
+	description: waits until a timer's callback is not running on another cpu
+	inputs: timer - timer off the wheel
+	output: none
+	side effect: spins, the caller must not hold a lock the callback takes
+*/
+static void wait_for_callback(ktimer_t* timer) {
+	while (running_timer == timer)
+		asm volatile("pause");
+}
+
+/*  add_timer_at
+	description: arms a timer to fire once the RTC clock reaches expires, re-arming it
+				 if it was already pending. O(1).
+	inputs: timer - initialized timer
+			expires - tick from timer_now() to fire at
+	output: none
+	side effect: timer->fn will be called from the RTC interrupt
+*/
+void add_timer_at(ktimer_t* timer, uint32_t expires) {
+	uint32_t flags;
+	spin_lock_irqsave(&wheel_lock, flags);
+	arm_timer(timer, expires);
+	spin_unlock_irqrestore(&wheel_lock, flags);
+}
+
+/*  add_timer
+	description: arms a timer to fire ticks RTC ticks from now
+	inputs: timer - initialized timer
+			ticks - delay in RTC ticks (MAX_FREQ per second)
+	output: none
+	side effect: see add_timer_at
+*/
+void add_timer(ktimer_t* timer, uint32_t ticks) {
+	add_timer_at(timer, timer_now() + ticks);
+}
+
+/*  del_timer
+	description: cancels a timer, doing nothing if it is not pending. O(1), but if its
+				 callback is running on another cpu this waits for it to finish, so
+				 never call it holding a lock the callback takes.
+	inputs: timer - initialized timer
+	output: none
+	side effect: timer->fn will not be called, and is not running, once this returns
+*/
+void del_timer(ktimer_t* timer) {
+	uint32_t flags;
+	spin_lock_irqsave(&wheel_lock, flags);
+	if (timer->prev != NULL) {
+		unlink_timer(timer);
+		program_wheel_event();
+	}
+	spin_unlock_irqrestore(&wheel_lock, flags);
+	wait_for_callback(timer);
+}
+
+/*  timer_pending
+	description: checks if a timer is armed and has not fired yet
+	inputs: timer - initialized timer
+	output: TRUE if it is on the wheel
+	side effect: none
+*/
+bool timer_pending(ktimer_t* timer) {
+	return timer->prev != NULL;
+}
+
+/*  timer_now
+	description: gets the clock timers run on, in RTC ticks (MAX_FREQ per second). Read
+				 off the TSC, the RTC only interrupts while timers need it. Without a
+				 TSC it counts RTC interrupts, and those never stop.
+	inputs: none
+	output: ticks since boot
+	side effect: none
+*/
+uint32_t timer_now(void) {
+	if (clock_tsc_khz() == 0) return get_Global_RTC_Clock();
+	return (uint32_t)ns_to_ticks(clock_ns());
+}
+
+/*  timer_next_expiry
+	description: gets the earliest tick the wheel has to run at, see next_expiry
+	inputs: expires - filled with the tick
+	output: FALSE if no timer is armed
+	side effect: none
+*/
+bool timer_next_expiry(uint32_t* expires) {
+	uint32_t flags;
+	bool armed;
+	spin_lock_irqsave(&wheel_lock, flags);
+	armed = (wheel_pending > 0);
+	if (armed) *expires = next_expiry();
+	spin_unlock_irqrestore(&wheel_lock, flags);
+	return armed;
+}
+
+/*  msecs_to_ticks
+	description: converts milliseconds to RTC ticks, rounding up so a timer never
+				 fires early
+	inputs: msecs - duration
+	output: the duration in ticks, at most TIMER_MAX_TICKS
+	side effect: none
+*/
+uint32_t msecs_to_ticks(uint32_t msecs) {
+	uint32_t secs = msecs / MSECS_PER_SEC;
+	if (secs >= TIMER_MAX_TICKS / MAX_FREQ) return TIMER_MAX_TICKS;
+	// Split up so the multiplication can't overflow
+	return secs * MAX_FREQ + ((msecs % MSECS_PER_SEC) * MAX_FREQ + MSECS_PER_SEC - 1) / MSECS_PER_SEC;
+}
+
+/*  cascade
+	description: moves every timer in a slot of a level above 0 down to where it
+				 belongs now that the level below has wrapped around
+	inputs: level - level of the slot, 1 or more
+			index - slot in that level
+	output: none
+	side effect: the slot is left empty
+*/
+static void cascade(uint32_t level, uint32_t index) {
+	ktimer_t* slot = &wheel[level][index];
+	ktimer_t* timer;
+	while (slot->next != slot) {
+		timer = slot->next;
+		unlink_timer(timer);
+		enqueue_timer(timer);
+	}
+}
+
+/*  run_timers
+	description: fires every timer that expired up to and including now. Called from
+				 the RTC interrupt, costs a slot per tick whatever the number of timers.
+				 The wheel lock is let go around each callback, so callbacks can take
+				 locks whose holders arm and cancel timers.
+	inputs: now - current RTC clock
+	output: none
+	side effect: runs timer callbacks with interrupts off
+*/
+void run_timers(uint32_t now) {
+	uint32_t index, level, flags;
+	ktimer_t* slot;
+	ktimer_t* timer;
+	// The RTC handler runs with interrupts on, see do_IRQ
+	spin_lock_irqsave(&wheel_lock, flags);
+	if (timers_running) {
+		spin_unlock_irqrestore(&wheel_lock, flags);
+		return;
+	}
+	timers_running = TRUE;
+	while ((int32_t)(now - wheel_now) >= 0) {
+		index = wheel_now & TIMER_SLOT_MASK;
+		// Level 0 wrapped, bring the next stretch of timers down from above
+		for (level = 1; index == 0 && level < TIMER_LEVELS; level++) {
+			index = (wheel_now >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK;
+			cascade(level, index);
+		}
+		slot = &wheel[0][wheel_now & TIMER_SLOT_MASK];
+		// Timers re-armed from a callback land in a later slot, never this one
+		wheel_now++;
+		while (slot->next != slot) {
+			timer = slot->next;
+			unlink_timer(timer);
+			running_timer = timer;
+			spin_unlock(&wheel_lock);
+			timer->fn(timer);
+			spin_lock(&wheel_lock);
+			running_timer = NULL;
+		}
+	}
+	timers_running = FALSE;
+	program_wheel_event();
+	spin_unlock_irqrestore(&wheel_lock, flags);
+}
+
+/*  timer_interrupt
+	description: what the RTC and PIT handlers do for the wheel, runs every timer
+				 that is due by the clock (however many ticks went by since the last
+				 interrupt) and arms the next interrupt
+	inputs: none
+	output: none
+	side effect: see run_timers, publishes the tick count on the time page
+*/
+void timer_interrupt(void) {
+	uint32_t now = timer_now();
+	clock_tick(now);
+	run_timers(now);
+}
+
+/*  wake_sleeper
+	description: timer callback waking whoever sleeps on the queue in timer->data
+	inputs: timer - the expired timer
+	output: none
+	side effect: makes the sleeper runnable
+*/
+static void wake_sleeper(ktimer_t* timer) {
+	wake_up((wait_queue_t*)timer->data);
+}
+
+/*  timer_sleep_until
+	description: blocks the current job until the RTC clock reaches expires
+	inputs: expires - tick from timer_now() to wake up at
+	output: none
+	side effect: other jobs run in the meantime
+*/
+void timer_sleep_until(uint32_t expires) {
+	wait_queue_t queue;
+	ktimer_t timer;
+	uint32_t flags;
+	init_wait_queue(&queue);
+	init_timer(&timer, wake_sleeper, &queue);
+	spin_lock_irqsave(&wheel_lock, flags);
+	arm_timer(&timer, expires);
+	while (timer_pending(&timer)) {
+		// The timer and queue live on our stack, take it off the wheel before leaving
+		if (sleep_on_locked(&queue, &wheel_lock) == -1) {
+			if (timer_pending(&timer)) {
+				unlink_timer(&timer);
+				program_wheel_event();
+			}
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&wheel_lock, flags);
+	// wake_sleeper may still be using the queue on another cpu
+	wait_for_callback(&timer);
+}
+
+/*  system_sleep
+	description: sleep syscall, blocks the calling process for a while without using
+				 the cpu
+	inputs: msecs - how long to sleep in milliseconds, rounded up to RTC ticks
+	output: 0
+	side effect: other jobs run in the meantime
+*/
+int32_t system_sleep(uint32_t msecs) {
+	timer_sleep_until(timer_now() + msecs_to_ticks(msecs));
+	return 0;
+}
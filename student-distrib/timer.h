@@ -0,0 +1,64 @@
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include "types.h"
+#include "lib.h"
+#include "scheduler.h"
+
+/*
+ * Kernel timers on a hierarchical timer wheel, in RTC ticks (MAX_FREQ per second)
+ * read off the TSC. Nothing interrupts for the wheel while it is empty, otherwise a
+ * one shot (or the RTC) comes at the earliest expiry, see program_wheel_event.
+ * Level 0 has a slot for each of the next TIMER_SLOTS ticks, every level above
+ * covers TIMER_SLOTS times the span of the one below. A timer is linked into the
+ * slot of its expiry at the coarsest level that still tells it apart, and moved
+ * down (cascaded) when the level below wraps around to it. Adding and cancelling
+ * are O(1), and a tick only touches the one slot that expires.
+ */
+#define TIMER_LEVELS	(4)
+#define TIMER_SLOT_BITS	(6)
+#define TIMER_SLOTS		(1 << TIMER_SLOT_BITS)
+#define TIMER_SLOT_MASK	(TIMER_SLOTS - 1)
+// Timers further out than this are clamped to it (about 4.5 hours)
+#define TIMER_MAX_TICKS	((1 << (TIMER_LEVELS * TIMER_SLOT_BITS)) - 1)
+#define MSECS_PER_SEC	(1000)
+
+// Where the wheel's interrupts come from, picked by init_timers
+#define TIMER_EVENT_RTC			(0)	// RTC at MAX_FREQ all the time, it is the clock (no TSC)
+#define TIMER_EVENT_RTC_ARMED	(1)	// RTC at MAX_FREQ while timers are armed (the PIT ticks periodically)
+#define TIMER_EVENT_PIT			(2)	// PIT one shot at the earliest expiry (shared with the scheduler)
+
+struct ktimer;
+typedef void (*timer_fn_t)(struct ktimer* timer);
+
+/*
+ * ktimer_t : one timeout, owned by the caller (usually on its kernel stack).
+ *			  fn runs in interrupt context once the clock reaches expires, without
+ *			  the wheel lock held (del_timer waits for it to finish).
+ */
+typedef struct ktimer {
+	struct ktimer* next;
+	struct ktimer* prev;	// NULL when not on the wheel
+	uint32_t expires;		// RTC tick to fire at
+	timer_fn_t fn;
+	void* data;
+} ktimer_t;
+
+void init_timers(void);
+bool timer_rtc_always(void);
+void init_timer(ktimer_t* timer, timer_fn_t fn, void* data);
+void add_timer(ktimer_t* timer, uint32_t ticks);
+void add_timer_at(ktimer_t* timer, uint32_t expires);
+void del_timer(ktimer_t* timer);
+bool timer_pending(ktimer_t* timer);
+uint32_t timer_now(void);
+bool timer_next_expiry(uint32_t* expires);
+uint32_t msecs_to_ticks(uint32_t msecs);
+void run_timers(uint32_t now);
+void timer_interrupt(void);
+void timer_sleep_until(uint32_t expires);
+
+// Syscall handler
+int32_t system_sleep(uint32_t msecs);
+
+#endif
@@ -0,0 +1,107 @@
+#include "workqueue.h"
+
+workqueue_t system_wq;
+static lock_stats_t workqueue_lock_stats = LOCK_STATS_INIT("workqueue");
+
+/*  init_workqueues
+	description: starts the shared work queue, needs the scheduler initialized
+	inputs: none
+	output: none
+	side effect: creates a kernel thread
+*/
+void init_workqueues(void) {
+	init_workqueue(&system_wq);
+}
+
+/*  worker_thread
+	description: body of a work queue's thread, runs its work forever
+	inputs: arg - the work queue
+	output: none, never returns
+	side effect: sleeps while the queue is empty
+*/
+static void worker_thread(void* arg) {
+	workqueue_t* wq = (workqueue_t*)arg;
+	work_t* work;
+	uint32_t flags;
+	while (1) {
+		spin_lock_irqsave(&wq->lock, flags);
+		while (wq->head == NULL)
+			sleep_on_locked(&wq->wait, &wq->lock);
+		work = wq->head;
+		wq->head = work->next;
+		if (wq->head == NULL) wq->tail = NULL;
+		work->next = NULL;
+		// Cleared first, so work queued while fn runs gets another run
+		work->pending = FALSE;
+		spin_unlock_irqrestore(&wq->lock, flags);
+		// Work is driver code like the handler that queued it
+		kernel_lock();
+		work->fn(work);
+		kernel_unlock();
+	}
+}
+
+/*  init_workqueue
+	description: sets up an empty work queue and starts its thread
+	inputs: wq - queue to set up
+	output: 0 on success, -1 if no kernel thread is left for it
+	side effect: creates a kernel thread
+*/
+int32_t init_workqueue(workqueue_t* wq) {
+	spin_lock_init(&wq->lock, &workqueue_lock_stats);
+	wq->head = NULL;
+	wq->tail = NULL;
+	init_wait_queue(&wq->wait);
+	return kthread_create(worker_thread, wq, KTHREAD_NO_PID);
+}
+
+/*  init_work
+	description: prepares work that is not queued
+	inputs: work - work to set up
+			fn - what to run, gets work back
+			data - anything fn needs, kept in work->data
+	output: none
+	side effect: none
+*/
+void init_work(work_t* work, work_fn_t fn, void* data) {
+	work->next = NULL;
+	work->fn = fn;
+	work->data = data;
+	work->pending = FALSE;
+}
+
+/*  queue_work
+	description: has the queue's thread run work soon. Safe from interrupt handlers.
+	inputs: wq - queue to run it on
+			work - initialized work
+	output: TRUE if it got queued, FALSE if it was already pending
+	side effect: wakes the queue's thread
+*/
+bool queue_work(workqueue_t* wq, work_t* work) {
+	uint32_t flags;
+	spin_lock_irqsave(&wq->lock, flags);
+	if (work->pending) {
+		spin_unlock_irqrestore(&wq->lock, flags);
+		return FALSE;
+	}
+	work->pending = TRUE;
+	work->next = NULL;
+	if (wq->tail != NULL)
+		wq->tail->next = work;
+	else
+		wq->head = work;
+	wq->tail = work;
+	wake_up(&wq->wait);
+	spin_unlock_irqrestore(&wq->lock, flags);
+	return TRUE;
+}
+
+/*  schedule_work
+	description: queue_work on the shared queue
+	inputs: work - initialized work
+	output: see queue_work
+	side effect: see queue_work
+*/
+bool schedule_work(work_t* work) {
+	return queue_work(&system_wq, work);
+}
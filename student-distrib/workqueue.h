@@ -0,0 +1,45 @@
+#ifndef _WORKQUEUE_H
+#define _WORKQUEUE_H
+
+#include "types.h"
+#include "lib.h"
+#include "scheduler.h"
+
+struct work;
+typedef void (*work_fn_t)(struct work* work);
+
+/*
+ * work_t : a deferred call of fn, owned by the caller (usually static next to the
+ *			interrupt handler that queues it). Queueing work that is already
+ *			pending does nothing, so one run can cover any number of interrupts.
+ */
+typedef struct work {
+	struct work* next;
+	work_fn_t fn;
+	void* data;
+	volatile bool pending;	// On a queue and not started yet
+} work_t;
+
+/*
+ * workqueue_t : FIFO of work run one at a time by its own kernel thread, with
+ *				 interrupts on and at the same priority as a process that just
+ *				 woke up from I/O. Work runs under the big kernel lock, the
+ *				 thread only holds it while it does.
+ */
+typedef struct {
+	spinlock_t lock;		// Covers head, tail and the pending flag of the work on it
+	work_t* head;
+	work_t* tail;
+	wait_queue_t wait;		// The worker thread, when there's nothing to do
+} workqueue_t;
+
+// Shared queue for short device work
+extern workqueue_t system_wq;
+
+void init_workqueues(void);
+int32_t init_workqueue(workqueue_t* wq);
+void init_work(work_t* work, work_fn_t fn, void* data);
+bool queue_work(workqueue_t* wq, work_t* work);
+bool schedule_work(work_t* work);
+
+#endif
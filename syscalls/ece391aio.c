@@ -0,0 +1,86 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define BUFSIZE     32
+#define RTC_RATE    8       /* rtc reads per second */
+#define RUN_MSECS   2000
+
+#define TAG_RTC     1
+#define TAG_WRITE   2
+#define TAG_DONE    3
+
+static ece391_io_sq_t* sq;
+static ece391_io_cq_t* cq;
+
+/* queue a request, the kernel only sees it on the next ioring_enter */
+static void
+submit (uint32_t opcode, int32_t fd, const void* addr, uint32_t len, uint32_t user_data)
+{
+    ece391_io_sqe_t* sqe = &sq->entries[sq->tail & (ECE391_IORING_ENTRIES - 1)];
+
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint32_t)addr;
+    sqe->len = len;
+    sqe->user_data = user_data;
+    sq->tail++;
+}
+
+/*
+ * Keeps a blocking rtc read in flight the whole time and prints a line each time
+ * one completes, with a timeout request ending the run. The program itself only
+ * ever waits in ioring_enter, the blocking happens in the kernel's workers.
+ */
+int main ()
+{
+    uint8_t* ring;
+    uint8_t line[BUFSIZE];
+    int32_t rtc_fd, rate = RTC_RATE, garbage;
+    int32_t ticks = 0, len, done = 0;
+    ece391_io_cqe_t* cqe;
+
+    if (0 != ece391_ioring_setup (&ring)) {
+        ece391_fdputs (1, (uint8_t*)"ioring_setup failed\n");
+        return 2;
+    }
+    sq = (ece391_io_sq_t*)ring;
+    cq = (ece391_io_cq_t*)(ring + ECE391_IORING_CQ_OFFSET);
+
+    rtc_fd = ece391_open ((uint8_t*)"rtc");
+    ece391_write (rtc_fd, &rate, 4);
+
+    submit (ECE391_IORING_OP_TIMEOUT, -1, 0, RUN_MSECS, TAG_DONE);
+    submit (ECE391_IORING_OP_READ, rtc_fd, &garbage, 4, TAG_RTC);
+
+    /* the rtc read is always outstanding, so the loop ends on the timeout */
+    while (!done) {
+        ece391_ioring_enter (ECE391_IORING_ENTRIES, 1);
+        while (cq->head != cq->tail) {
+            cqe = &cq->entries[cq->head & (ECE391_IORING_ENTRIES - 1)];
+            switch (cqe->user_data) {
+                case TAG_RTC:
+                    ticks++;
+                    ece391_strcpy (line, (uint8_t*)"tick ");
+                    ece391_itoa (ticks, line + ece391_strlen (line), 10);
+                    len = ece391_strlen (line);
+                    line[len++] = '\n';
+                    /* line is only reused after the write completes, one tick later */
+                    submit (ECE391_IORING_OP_WRITE, 1, line, len, TAG_WRITE);
+                    submit (ECE391_IORING_OP_READ, rtc_fd, &garbage, 4, TAG_RTC);
+                    break;
+                case TAG_DONE:
+                    done = 1;
+                    break;
+            }
+            cq->head++;
+        }
+    }
+
+    /* the last rtc read is still in flight, halt waits for it before closing rtc_fd */
+    ece391_itoa (ticks, line, 10);
+    ece391_fdputs (1, line);
+    ece391_fdputs (1, (uint8_t*)" ticks in 2 s\n");
+    return 0;
+}
@@ -0,0 +1,49 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391sysnum.h"
+#include "ece391syscall.h"
+
+#define CALLS   (1024 * ECE391_BATCH_MAX)
+
+/* print "<name>: <ns> ns per call" */
+static void
+report (const char* name, const ece391_timespec_t* t0, const ece391_timespec_t* t1)
+{
+    ece391_fdputs (1, (uint8_t*)name);
+    ece391_put_num (": ", ece391_elapsed_ns (t0, t1) / CALLS, " ns per call\n");
+}
+
+/*
+ * Per call overhead of single syscalls against batches of ECE391_BATCH_MAX.
+ * isatty on stdout does almost no work, so the difference is the trap.
+ */
+int main ()
+{
+    ece391_batch_entry_t batch[ECE391_BATCH_MAX];
+    ece391_timespec_t t0, t1;
+    int32_t i;
+
+    for (i = 0; i < ECE391_BATCH_MAX; i++) {
+        batch[i].number = SYS_ISATTY;
+        batch[i].args[0] = 1;
+        batch[i].args[1] = batch[i].args[2] = 0;
+    }
+
+    ece391_now (&t0);
+    for (i = 0; i < CALLS; i++)
+        ece391_isatty (1);
+    ece391_now (&t1);
+    report ("one by one", &t0, &t1);
+
+    ece391_now (&t0);
+    for (i = 0; i < CALLS; i += ECE391_BATCH_MAX) {
+        if (ECE391_BATCH_MAX != ece391_batch (batch, ECE391_BATCH_MAX, ECE391_BATCH_STOP_ON_ERROR)) {
+            ece391_fdputs (1, (uint8_t*)"batch failed\n");
+            return 2;
+        }
+    }
+    ece391_now (&t1);
+    report ("batched", &t0, &t1);
+    return 0;
+}
@@ -9,6 +9,7 @@ int main ()
 {
     uint32_t i, cnt, max = 0;
     uint8_t buf[BUFSIZE];
+    ece391_timespec_t start, end;
 
     ece391_fdputs(1, (uint8_t*)"Enter the Test Number: (0): 100, (1): 10000, (2): 100000\n");
     if (-1 == (cnt = ece391_read(0, buf, BUFSIZE-1)) ) {
@@ -34,11 +35,18 @@ int main ()
         }
     }
 
+    ece391_now(&start);
     for (i = 0; i < max; i++) {
         ece391_itoa(i+1, buf, 10);
         ece391_fdputs(1, buf);
         ece391_fdputs(1, (uint8_t*)"\n");
     }
+    ece391_now(&end);
+
+    ece391_fdputs(1, (uint8_t*)"took ");
+    ece391_itoa(ece391_elapsed_us(&start, &end), buf, 10);
+    ece391_fdputs(1, buf);
+    ece391_fdputs(1, (uint8_t*)" us\n");
 
     return 0;
 }
@@ -0,0 +1,55 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define SHM_KEY     395
+#define WORK_LOOPS  (1 << 26)
+#define MAX_CPUS    4
+
+/*
+ * Throughput of cpu bound jobs on 1, 2 and 4 cpus.
+ * "cpubench" runs ECE391_BENCH_JOBS counting jobs ("cpubench w<mask>") at once,
+ * each pinned to the first 1, 2 then 4 online cpus with set_affinity, and prints
+ * how many loops per ms they got through together. With per-cpu run queues that
+ * should double with each round, for as many cpus as the machine has (qemu -smp 4).
+ * Jobs count themselves done in shared memory (ece391_bench_init).
+ */
+int main ()
+{
+    uint8_t buf[ECE391_BENCH_ARGS];
+    uint8_t command[ECE391_BENCH_ARGS];
+    volatile uint32_t* done;
+    uint32_t online, mask, cpus, bit, ms;
+    int32_t role;
+
+    role = ece391_bench_init (SHM_KEY, WORK_LOOPS, buf, &done);
+    if (0 != role)
+        return (role < 0) ? 2 : 0;
+
+    /* the old mask is every online cpu */
+    online = ece391_set_affinity ((1 << MAX_CPUS) - 1);
+    mask = 0;
+    cpus = 0;
+    for (bit = 0; bit < MAX_CPUS; bit++) {
+        if (!(online & (1 << bit)))
+            continue;
+        mask |= 1 << bit;
+        cpus++;
+        /* 1, 2 and 4 cpus */
+        if (cpus & (cpus - 1))
+            continue;
+        ece391_strcpy (command, (uint8_t*)"cpubench w");
+        ece391_itoa (mask, command + ece391_strlen (command), 10);
+        ms = ece391_run_and_wait (command, ECE391_BENCH_JOBS, done);
+        if (ms == 0) {
+            ece391_fdputs (1, (uint8_t*)"could not start the jobs\n");
+            return 3;
+        }
+        ece391_put_num ("", ECE391_BENCH_JOBS, " jobs on ");
+        ece391_put_num ("", cpus, " cpus: ");
+        ece391_put_num ("", ms, " ms, ");
+        ece391_put_num ("", ECE391_BENCH_JOBS * (WORK_LOOPS / 1000) / ms, " kloops/ms\n");
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define SHM_KEY     392
+#define SHM_SIZE    4096
+#define BUFSIZE     128
+#define TICK_RATE   2       /* rtc reads per second in the ticker */
+#define SECONDS     5
+
+/*
+ * Measures how much CPU a compute bound job gets.
+ * "cpushare" spins counting loop iterations while "cpushare t", started
+ * alongside it with run, marks the start and end of a SECONDS long window
+ * using blocking rtc reads. Compare the iterations per second with the other
+ * shells sitting idle at their prompt against the same count taken while
+ * they are busy: with blocking reads the idle shells should cost nothing.
+ * Word 0 of the segment is the start flag, word 1 is the stop flag.
+ */
+int main ()
+{
+    uint8_t buf[BUFSIZE];
+    uint8_t* shm;
+    volatile uint32_t* flags;
+    int32_t rtc_fd, garbage, i;
+    int32_t rate = TICK_RATE;
+    uint32_t count;
+
+    buf[0] = '\0';
+    ece391_getargs (buf, BUFSIZE);
+    if (0 != ece391_shm_create (SHM_KEY, SHM_SIZE) || 0 != ece391_shm_attach (SHM_KEY, &shm)) {
+        ece391_fdputs (1, (uint8_t*)"could not get shared memory\n");
+        return 2;
+    }
+    flags = (volatile uint32_t*)shm;
+
+    if (buf[0] == 't') {
+        rtc_fd = ece391_open ((uint8_t*)"rtc");
+        ece391_write (rtc_fd, &rate, 4);
+        ece391_read (rtc_fd, &garbage, 4);  /* line up with a tick */
+        flags[0] = 1;
+        for (i = 0; i < TICK_RATE * SECONDS; i++)
+            ece391_read (rtc_fd, &garbage, 4);
+        flags[1] = 1;
+        ece391_close (rtc_fd);
+        return 0;
+    }
+
+    flags[0] = 0;
+    flags[1] = 0;
+    if (-1 == ece391_run ((uint8_t*)"cpushare t", ECE391_INHERIT_TTY)) {
+        ece391_fdputs (1, (uint8_t*)"could not start the ticker\n");
+        return 2;
+    }
+    while (flags[0] == 0);
+    for (count = 0; flags[1] == 0; count++);
+
+    ece391_put_num ("iterations per second: ", count / SECONDS, "\n");
+    return 0;
+}
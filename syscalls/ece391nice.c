@@ -0,0 +1,33 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define BUFSIZE 1024
+
+/*
+ * nice <level> <command>: runs command with the given nice value,
+ * 0 is the default and most important, 2 only gets leftover cpu.
+ */
+int main ()
+{
+    int32_t rval, nice;
+    uint8_t buf[BUFSIZE];
+
+    if (0 != ece391_getargs (buf, BUFSIZE) || buf[0] < '0' || buf[0] > '0' + ECE391_NICE_MAX
+        || buf[1] != ' ' || buf[2] == '\0') {
+        ece391_put_num ("usage: nice <0-", ECE391_NICE_MAX, "> <command>\n");
+        return 3;
+    }
+    nice = buf[0] - '0';
+    if (-1 == ece391_nice (nice)) {
+        ece391_fdputs (1, (uint8_t*)"could not set the nice level\n");
+        return 3;
+    }
+    rval = ece391_execute (&buf[2]);
+    if (-1 == rval) {
+        ece391_fdputs (1, (uint8_t*)"no such command\n");
+        return 3;
+    }
+    return rval;
+}
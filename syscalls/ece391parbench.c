@@ -0,0 +1,44 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define SHM_KEY     394
+#define WORK_LOOPS  (1 << 27)
+
+/*
+ * Parallel speedup of cpu bound jobs.
+ * "parbench" runs 1, 2 then 4 workers ("parbench w"), each doing the same fixed
+ * amount of work, and prints how long each round took. Workers never enter the
+ * kernel, so with one cpu per worker every round takes as long as the first
+ * (speedup n), with a single cpu round n takes n times as long (speedup 1).
+ * Workers count themselves done in shared memory (ece391_bench_init).
+ */
+int main ()
+{
+    uint8_t buf[ECE391_BENCH_ARGS];
+    volatile uint32_t* done;
+    uint32_t ms, one_ms = 0;
+    int32_t n;
+
+    n = ece391_bench_init (SHM_KEY, WORK_LOOPS, buf, &done);
+    if (0 != n)
+        return (n < 0) ? 2 : 0;
+
+    for (n = 1; n <= ECE391_BENCH_JOBS; n *= 2) {
+        ms = ece391_run_and_wait ((uint8_t*)"parbench w", n, done);
+        if (ms == 0) {
+            ece391_fdputs (1, (uint8_t*)"could not start the workers\n");
+            return 3;
+        }
+        if (n == 1)
+            one_ms = ms;
+        ece391_put_num ("", n, " workers: ");
+        ece391_put_num ("", ms, " ms, speedup ");
+        /* n times the work of one worker, in tenths */
+        ms = n * one_ms * 10 / ms;
+        ece391_put_num ("", ms / 10, ".");
+        ece391_put_num ("", ms % 10, "\n");
+    }
+    return 0;
+}
@@ -3,6 +3,7 @@
 #include "ece391support.h"
 #include "ece391syscall.h"
 
+
 int main ()
 {
     int32_t retval, tty;
@@ -20,7 +21,7 @@ int main ()
 		tty = (int32_t)buf[5]-0x30;
 		retval = ece391_run(&buf[6], tty);
 	} else {
-		tty = -1;
+		tty = ECE391_INHERIT_TTY;
 		retval = ece391_run(buf, tty);
 	}
 
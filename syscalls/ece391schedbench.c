@@ -0,0 +1,41 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define SHM_KEY     393
+#define SPIN_LOOPS  (1 << 28)
+
+/*
+ * Scheduler overhead with many runnable jobs.
+ * "schedbench <n>" starts n cpu bound spinners ("schedbench w") and waits
+ * for them all to finish. Press CTRL-ALT-S before and after: the second
+ * print shows the cycles per scheduling decision while they all competed.
+ * Spinners count themselves done in shared memory (ece391_bench_init).
+ */
+int main ()
+{
+    uint8_t buf[ECE391_BENCH_ARGS];
+    volatile uint32_t* done;
+    int32_t n, started;
+
+    n = ece391_bench_init (SHM_KEY, SPIN_LOOPS, buf, &done);
+    if (0 != n)
+        return (n < 0) ? 2 : 0;
+
+    n = buf[0] - '0';
+    if (n < 1 || n > ECE391_BENCH_JOBS) {
+        ece391_fdputs (1, (uint8_t*)"usage: schedbench <1-4>\n");
+        return 3;
+    }
+    *done = 0;
+    for (started = 0; started < n; started++) {
+        if (-1 == ece391_run ((uint8_t*)"schedbench w", ECE391_INHERIT_TTY))
+            break;
+    }
+    /* spin with them, it is a cpu bound job too */
+    while (*done < started);
+
+    ece391_put_num ("", started, " spinners done, CTRL-ALT-S prints the scheduler overhead\n");
+    return 0;
+}
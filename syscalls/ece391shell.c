@@ -4,10 +4,41 @@
 #include "ece391syscall.h"
 
 #define BUFSIZE 1024
+#define SAVE_FD 7       /* parks the shell's own stdin/stdout around a pipeline */
+
+/*
+ * Run "left | right": left is started alongside us with its stdout on the
+ * pipe, right runs in the foreground reading the pipe as its stdin.
+ * Returns the exit value of right, like a plain execute would.
+ */
+static int32_t
+run_pipeline (uint8_t* left, uint8_t* right)
+{
+    int32_t fds[2], rval;
+
+    if (-1 == ece391_pipe (fds))
+	return -1;
+
+    /* left inherits our stdout at run time, so point it at the pipe */
+    ece391_dup2 (1, SAVE_FD);
+    ece391_dup2 (fds[1], 1);
+    ece391_close (fds[1]);
+    rval = ece391_run (left, ECE391_INHERIT_TTY);
+    ece391_dup2 (SAVE_FD, 1);
+
+    /* same for right and our stdin */
+    ece391_dup2 (0, SAVE_FD);
+    ece391_dup2 (fds[0], 0);
+    ece391_close (fds[0]);
+    if (-1 != rval)
+	rval = ece391_execute (right);
+    ece391_dup2 (SAVE_FD, 0);
+    return rval;
+}
 
 int main ()
 {
-    int32_t cnt, rval;
+    int32_t cnt, rval, i;
     uint8_t buf[BUFSIZE];
     ece391_fdputs (1, (uint8_t*)"Starting 391 Shell\n");
 
@@ -24,7 +55,13 @@ int main ()
 	    return 0;
 	if ('\0' == buf[0])
 	    continue;
-	rval = ece391_execute (buf);
+	for (i = 0; '\0' != buf[i] && '|' != buf[i]; i++);
+	if ('|' == buf[i]) {
+	    buf[i] = '\0';
+	    rval = run_pipeline (buf, &buf[i + 1]);
+	} else {
+	    rval = ece391_execute (buf);
+	}
 	if (-1 == rval)
 	    ece391_fdputs (1, (uint8_t*)"no such command\n");
 	else if (256 == rval)
@@ -0,0 +1,59 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define SHM_KEY     391
+#define SHM_SIZE    (64*1024)
+#define DATA_START  8
+#define BUFSIZE     128
+
+/*
+ * Producer/consumer over a shared memory segment.
+ * Start the consumer first with "run shmtest c", then "shmtest p".
+ * Word 0 of the segment is the ready flag, word 1 is the done flag.
+ */
+int main ()
+{
+    uint8_t buf[BUFSIZE];
+    uint8_t* shm;
+    volatile uint32_t* flags;
+    int32_t rtc_fd, garbage, i;
+    int32_t rate = 32;
+
+    if (0 != ece391_getargs (buf, BUFSIZE) || (buf[0] != 'p' && buf[0] != 'c')) {
+        ece391_fdputs (1, (uint8_t*)"usage: shmtest p|c\n");
+        return 3;
+    }
+    if (0 != ece391_shm_create (SHM_KEY, SHM_SIZE) || 0 != ece391_shm_attach (SHM_KEY, &shm)) {
+        ece391_fdputs (1, (uint8_t*)"could not get shared memory\n");
+        return 2;
+    }
+    flags = (volatile uint32_t*)shm;
+    rtc_fd = ece391_open ((uint8_t*)"rtc");
+    ece391_write (rtc_fd, &rate, 4);
+
+    if (buf[0] == 'p') {
+        // Fill the segment and wait for the consumer to check it
+        for (i = DATA_START; i < SHM_SIZE; i++)
+            shm[i] = (uint8_t)i;
+        flags[0] = 1;
+        while (flags[1] == 0)
+            ece391_read (rtc_fd, &garbage, 4);
+        ece391_fdputs (1, (uint8_t*)"producer: consumer got the data\n");
+    } else {
+        while (flags[0] == 0)
+            ece391_read (rtc_fd, &garbage, 4);
+        for (i = DATA_START; i < SHM_SIZE; i++) {
+            if (shm[i] != (uint8_t)i) {
+                ece391_fdputs (1, (uint8_t*)"consumer: data mismatch\n");
+                flags[1] = 1;
+                return 1;
+            }
+        }
+        flags[1] = 1;
+        ece391_fdputs (1, (uint8_t*)"consumer: 64kB received\n");
+    }
+    ece391_close (rtc_fd);
+    return 0;
+}
@@ -0,0 +1,30 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define BUFSIZE 1024
+
+/*
+ * sleep <msecs>: blocks for the given number of milliseconds without using the cpu
+ */
+int main ()
+{
+    uint8_t buf[BUFSIZE];
+    uint32_t msecs = 0;
+    int32_t i;
+
+    if (0 != ece391_getargs (buf, BUFSIZE) || buf[0] == '\0') {
+        ece391_fdputs (1, (uint8_t*)"usage: sleep <msecs>\n");
+        return 3;
+    }
+    for (i = 0; buf[i] != '\0'; i++) {
+        if (buf[i] < '0' || buf[i] > '9') {
+            ece391_fdputs (1, (uint8_t*)"usage: sleep <msecs>\n");
+            return 3;
+        }
+        msecs = msecs * 10 + (buf[i] - '0');
+    }
+    ece391_sleep (msecs);
+    return 0;
+}
@@ -21,6 +21,17 @@ void ece391_fdputs(int32_t fd, const uint8_t* s)
     (void)ece391_write (fd, s, ece391_strlen(s));
 }
 
+/* Print before, num in decimal and after to stdout */
+void ece391_put_num(const char* before, uint32_t num, const char* after)
+{
+    uint8_t buf[12];
+
+    ece391_fdputs (1, (const uint8_t*)before);
+    ece391_itoa (num, buf, 10);
+    ece391_fdputs (1, buf);
+    ece391_fdputs (1, (const uint8_t*)after);
+}
+
 int32_t ece391_strcmp(const uint8_t* s1, const uint8_t* s2)
 {
     while (*s1 == *s2) {
@@ -102,3 +113,142 @@ uint8_t* ece391_strrev(uint8_t* s)
    return s;
 }
 
+/*
+ * Read the monotonic clock off the time page, without a syscall. Falls back on
+ * clock_gettime if the kernel has no TSC clock, zero if it has no clock at all.
+ */
+void ece391_now(ece391_timespec_t* ts)
+{
+    const volatile ece391_time_page_t* page = (const volatile ece391_time_page_t*)ECE391_TIME_PAGE;
+    uint32_t seq, mult, shift, base_low, base_high, low, high, rem;
+    uint64_t cycles, ns;
+
+    if (0 == page->tsc_khz) {
+        if (0 != ece391_clock_gettime (ECE391_CLOCK_MONOTONIC, ts))
+            ts->tv_sec = ts->tv_nsec = 0;
+        return;
+    }
+    do {
+        seq = page->seq;
+        mult = page->tsc_mult;
+        shift = page->tsc_shift;
+        base_low = page->tsc_base_low;
+        base_high = page->tsc_base_high;
+        asm volatile ("rdtsc" : "=a" (low), "=d" (high) : : "memory");
+    } while ((seq & 1) || seq != page->seq);
+
+    cycles = (((uint64_t)high << 32) | low) - (((uint64_t)base_high << 32) | base_low);
+    high = (uint32_t)(cycles >> 32);
+    low = (uint32_t)cycles;
+    ns = (((uint64_t)high * mult) << (32 - shift)) + (((uint64_t)low * mult) >> shift);
+
+    /* 64 by 32 bit divide by hand, there is no libgcc */
+    high = (uint32_t)(ns >> 32);
+    low = (uint32_t)ns;
+    rem = high % 1000000000;
+    asm ("divl %4" : "=a" (low), "=d" (rem) : "0" (low), "1" (rem), "rm" (1000000000));
+    ts->tv_sec = low;
+    ts->tv_nsec = rem;
+}
+
+/* Low half of the time stamp counter, enough for differences under ~1s */
+uint32_t ece391_rdtsc_low(void)
+{
+    uint32_t low, high;
+
+    asm volatile ("rdtsc" : "=a" (low), "=d" (high));
+    return low;
+}
+
+/* Nanoseconds from start to end, for intervals under ~4 seconds */
+uint32_t ece391_elapsed_ns(const ece391_timespec_t* start, const ece391_timespec_t* end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000000000 + end->tv_nsec - start->tv_nsec;
+}
+
+/* Microseconds from start to end, for intervals under ~70 minutes */
+uint32_t ece391_elapsed_us(const ece391_timespec_t* start, const ece391_timespec_t* end)
+{
+    int32_t nsecs = (int32_t)end->tv_nsec - (int32_t)start->tv_nsec;
+
+    return (end->tv_sec - start->tv_sec) * 1000000 + nsecs / 1000;
+}
+
+/*
+ * Counter of finished jobs, for benchmarks that run copies of themselves: word 0
+ * of the shared memory segment key, whoever gets there first creates it. 0 if
+ * there is no shared memory.
+ */
+volatile uint32_t* ece391_done_counter(int32_t key)
+{
+    uint8_t* shm;
+
+    if (0 != ece391_shm_create (key, ECE391_DONE_SHM_SIZE) || 0 != ece391_shm_attach (key, &shm))
+        return 0;
+    return (volatile uint32_t*)shm;
+}
+
+/* Counts a finished job, atomically since the others run at the same time */
+void ece391_count_done(volatile uint32_t* done)
+{
+    asm volatile ("lock incl %0" : "+m" (*done));
+}
+
+/*
+ * Common start of the benchmarks that run copies of themselves. Reads our
+ * arguments into args (ECE391_BENCH_ARGS bytes) and gets the done counter for
+ * key. If the arguments start with ECE391_BENCH_WORKER we are one of the copies:
+ * pin to the cpu mask that follows it, if any, spin loops times and count
+ * ourselves done. Returns 1 if we were a copy, 0 if we are the benchmark itself
+ * and -1 (after saying why) if there is no shared memory or the mask is bad.
+ */
+int32_t ece391_bench_init(int32_t key, uint32_t loops, uint8_t* args, volatile uint32_t** done)
+{
+    volatile uint32_t i;
+    uint32_t mask;
+    uint8_t* digit;
+
+    args[0] = '\0';
+    ece391_getargs (args, ECE391_BENCH_ARGS);
+    *done = ece391_done_counter (key);
+    if (0 == *done) {
+        ece391_fdputs (1, (uint8_t*)"could not get shared memory\n");
+        return -1;
+    }
+    if (args[0] != ECE391_BENCH_WORKER)
+        return 0;
+
+    mask = 0;
+    for (digit = args + 1; *digit >= '0' && *digit <= '9'; digit++)
+        mask = mask * 10 + (*digit - '0');
+    if (0 != mask && -1 == ece391_set_affinity (mask)) {
+        ece391_fdputs (1, (uint8_t*)"could not set the cpu mask\n");
+        return -1;
+    }
+    for (i = 0; i < loops; i++);
+    ece391_count_done (*done);
+    return 1;
+}
+
+/*
+ * Runs n copies of command at once on our terminal and waits for all of them to
+ * count themselves done. Returns how long that took in ms, 0 if one could not be
+ * started.
+ */
+uint32_t ece391_run_and_wait(const uint8_t* command, int32_t n, volatile uint32_t* done)
+{
+    ece391_timespec_t start, end;
+    int32_t started;
+
+    *done = 0;
+    ece391_now (&start);
+    for (started = 0; started < n; started++) {
+        if (-1 == ece391_run (command, ECE391_INHERIT_TTY))
+            return 0;
+    }
+    /* sleep instead of spinning, we would take a cpu away from them */
+    while (*done < n)
+        ece391_sleep (ECE391_DONE_POLL_MSECS);
+    ece391_now (&end);
+    return ece391_elapsed_us (&start, &end) / 1000;
+}
@@ -1,13 +1,30 @@
 #if !defined(ECE391SUPPORT_H)
 #define ECE391SUPPORT_H
 
+#include "ece391syscall.h"
+
+#define ECE391_DONE_SHM_SIZE    4096
+#define ECE391_DONE_POLL_MSECS  10
+#define ECE391_BENCH_ARGS       128
+#define ECE391_BENCH_WORKER     'w'
+#define ECE391_BENCH_JOBS       4   /* 3 shells + the benchmark + 4 jobs fill the 8 pids */
+
 extern uint32_t ece391_strlen(const uint8_t* s);
 extern void ece391_strcpy(uint8_t* dst, const uint8_t* src);
 extern void ece391_fdputs(int32_t fd, const uint8_t* s);
+extern void ece391_put_num(const char* before, uint32_t num, const char* after);
 extern int32_t ece391_strcmp(const uint8_t* s1, const uint8_t* s2);
 extern int32_t ece391_strncmp(const uint8_t* s1, const uint8_t* s2, uint32_t n);
 extern uint8_t *ece391_itoa(uint32_t value, uint8_t* buf, int32_t radix);
 extern uint8_t *ece391_strrev(uint8_t* s);
+extern void ece391_now(ece391_timespec_t* ts);
+extern uint32_t ece391_rdtsc_low(void);
+extern uint32_t ece391_elapsed_ns(const ece391_timespec_t* start, const ece391_timespec_t* end);
+extern uint32_t ece391_elapsed_us(const ece391_timespec_t* start, const ece391_timespec_t* end);
+extern volatile uint32_t* ece391_done_counter(int32_t key);
+extern void ece391_count_done(volatile uint32_t* done);
+extern int32_t ece391_bench_init(int32_t key, uint32_t loops, uint8_t* args, volatile uint32_t** done);
+extern uint32_t ece391_run_and_wait(const uint8_t* command, int32_t n, volatile uint32_t* done);
 
 #endif /* ECE391SUPPORT_H */
 
@@ -0,0 +1,72 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define BUFSIZE     128
+#define ROUND_TRIPS 4096
+#define SAVE_IN     6
+#define SAVE_OUT    7
+
+/*
+ * Context switch ping-pong.
+ * "switchbench" starts "switchbench e" with its stdin and stdout on two pipes,
+ * then bounces a byte off it ROUND_TRIPS times. Every hop blocks one side and
+ * wakes the other, so a round trip is two switches (plus the pipe syscalls).
+ */
+int main ()
+{
+    uint8_t buf[BUFSIZE];
+    int32_t to_echo[2], from_echo[2];
+    int32_t i;
+    uint8_t c = 'x';
+    uint32_t start, cycles;
+    ece391_timespec_t t0, t1;
+
+    buf[0] = '\0';
+    ece391_getargs (buf, BUFSIZE);
+    if (buf[0] == 'e') {
+        /* echo side: send back whatever comes in until the pipe closes */
+        while (1 == ece391_read (0, &c, 1))
+            ece391_write (1, &c, 1);
+        return 0;
+    }
+
+    if (-1 == ece391_pipe (to_echo) || -1 == ece391_pipe (from_echo)) {
+        ece391_fdputs (1, (uint8_t*)"could not create pipes\n");
+        return 2;
+    }
+    /* hand the echo job its ends as stdin/stdout, like the shell does */
+    ece391_dup2 (0, SAVE_IN);
+    ece391_dup2 (1, SAVE_OUT);
+    ece391_dup2 (to_echo[0], 0);
+    ece391_dup2 (from_echo[1], 1);
+    i = ece391_run ((uint8_t*)"switchbench e", ECE391_INHERIT_TTY);
+    ece391_dup2 (SAVE_IN, 0);
+    ece391_dup2 (SAVE_OUT, 1);
+    ece391_close (to_echo[0]);
+    ece391_close (from_echo[1]);
+    if (-1 == i) {
+        ece391_fdputs (1, (uint8_t*)"could not start the echo job\n");
+        return 2;
+    }
+
+    /* first trip waits for the echo job to start, leave it out */
+    ece391_write (to_echo[1], &c, 1);
+    ece391_read (from_echo[0], &c, 1);
+
+    ece391_now (&t0);
+    start = ece391_rdtsc_low ();
+    for (i = 0; i < ROUND_TRIPS; i++) {
+        ece391_write (to_echo[1], &c, 1);
+        ece391_read (from_echo[0], &c, 1);
+    }
+    cycles = ece391_rdtsc_low () - start;
+    ece391_now (&t1);
+    ece391_close (to_echo[1]);
+    ece391_close (from_echo[0]);
+
+    ece391_put_num ("cycles per switch: ", cycles / (2 * ROUND_TRIPS), "");
+    ece391_put_num (", ns per switch: ", ece391_elapsed_ns (&t0, &t1) / (2 * ROUND_TRIPS), "\n");
+    return 0;
+}
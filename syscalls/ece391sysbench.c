@@ -0,0 +1,44 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define CALLS   100000
+
+/* print "<name>: <cycles> cycles, <ns> ns per call" */
+static void
+report (const char* name, uint32_t cycles, const ece391_timespec_t* t0, const ece391_timespec_t* t1)
+{
+    ece391_fdputs (1, (uint8_t*)name);
+    ece391_put_num (": ", cycles / CALLS, " cycles, ");
+    ece391_put_num ("", ece391_elapsed_ns (t0, t1) / CALLS, " ns per call\n");
+}
+
+/*
+ * Null syscall latency, int 0x80 against sysenter/sysexit.
+ * isatty on a bad fd goes through the whole entry, bounds check, jump table
+ * and exit, and does next to nothing in between.
+ */
+int main ()
+{
+    ece391_timespec_t t0, t1;
+    uint32_t start, cycles;
+    int32_t i;
+
+    ece391_now (&t0);
+    start = ece391_rdtsc_low ();
+    for (i = 0; i < CALLS; i++)
+        ece391_isatty (-1);
+    cycles = ece391_rdtsc_low () - start;
+    ece391_now (&t1);
+    report ("int 0x80", cycles, &t0, &t1);
+
+    ece391_now (&t0);
+    start = ece391_rdtsc_low ();
+    for (i = 0; i < CALLS; i++)
+        ece391_fast_isatty (-1);
+    cycles = ece391_rdtsc_low () - start;
+    ece391_now (&t1);
+    report ("sysenter", cycles, &t0, &t1);
+    return 0;
+}
@@ -5,6 +5,31 @@
 
 /* All calls return >= 0 on success or -1 on failure. */
 
+/* Monotonic time since boot, from clock_gettime */
+#define ECE391_CLOCK_MONOTONIC 1
+typedef struct {
+    uint32_t tv_sec;
+    uint32_t tv_nsec;
+} ece391_timespec_t;
+
+/*
+ * Read only page the kernel maps at ECE391_TIME_PAGE in every process, so the time
+ * can be read without a syscall (see ece391_now). seq is odd while the kernel
+ * updates the page, read it before and after and retry if it is odd or changed.
+ * ns since boot = (tsc - tsc_base) * tsc_mult >> tsc_shift, unless tsc_khz is 0.
+ */
+#define ECE391_TIME_PAGE 0x08800000
+typedef struct {
+    volatile uint32_t seq;
+    uint32_t ticks;
+    uint32_t tick_hz;
+    uint32_t tsc_khz;
+    uint32_t tsc_mult;
+    uint32_t tsc_shift;
+    uint32_t tsc_base_low;
+    uint32_t tsc_base_high;
+} ece391_time_page_t;
+
 /*
  * Note that the system call for halt will have to make sure that only
  * the low byte of EBX (the status argument) is returned to the calling
@@ -21,7 +46,84 @@ extern int32_t ece391_getargs (uint8_t* buf, int32_t nbytes);
 extern int32_t ece391_vidmap (uint8_t** screen_start);
 extern int32_t ece391_set_handler (int32_t signum, void* handler);
 extern int32_t ece391_sigreturn (void);
+/* tty for ece391_run: the job goes on the caller's terminal */
+#define ECE391_INHERIT_TTY (-2)
 extern int32_t ece391_run (const uint8_t* command, int32_t tty);
+extern int32_t ece391_shm_create (int32_t key, int32_t nbytes);
+extern int32_t ece391_shm_attach (int32_t key, uint8_t** addr);
+extern int32_t ece391_pipe (int32_t fds[2]);
+extern int32_t ece391_dup2 (int32_t oldfd, int32_t newfd);
+extern int32_t ece391_isatty (int32_t fd);
+/* 0 (the default, most important) to ECE391_NICE_MAX, returns the old value */
+#define ECE391_NICE_MAX 2
+extern int32_t ece391_nice (int32_t nice);
+extern int32_t ece391_sleep (uint32_t msecs);
+extern int32_t ece391_clock_gettime (int32_t clock_id, ece391_timespec_t* ts);
+
+/*
+ * One trap for up to ECE391_BATCH_MAX syscalls, run in order. Each entry gets
+ * the syscall's return value in result. Returns how many entries ran, which is
+ * fewer than count if ECE391_BATCH_STOP_ON_ERROR is set and one returned -1.
+ * halt, execute and batch can't be batched.
+ */
+#define ECE391_BATCH_MAX 64
+#define ECE391_BATCH_STOP_ON_ERROR 1
+typedef struct {
+    int32_t number;
+    int32_t args[3];
+    int32_t result;
+} ece391_batch_entry_t;
+extern int32_t ece391_batch (ece391_batch_entry_t* entries, int32_t count, int32_t flags);
+
+/*
+ * Asynchronous I/O through a pair of rings shared with the kernel. ioring_setup
+ * maps them at *addr: the submission ring first, the completion ring one page
+ * later. Fill entries at sq->tail and bump it, then ioring_enter takes up to
+ * to_submit of them and waits until min_complete completions are ready at
+ * cq->head, returning how many are. Both heads and tails count up forever,
+ * index with & (ECE391_IORING_ENTRIES - 1).
+ */
+#define ECE391_IORING_ENTRIES 32
+#define ECE391_IORING_OP_NOP 0
+#define ECE391_IORING_OP_READ 1
+#define ECE391_IORING_OP_WRITE 2
+#define ECE391_IORING_OP_TIMEOUT 3	/* len is milliseconds */
+typedef struct {
+	uint32_t opcode;
+	int32_t fd;
+	uint32_t addr;
+	uint32_t len;
+	uint32_t user_data;
+} ece391_io_sqe_t;
+typedef struct {
+	uint32_t user_data;
+	int32_t res;
+} ece391_io_cqe_t;
+typedef struct {
+	volatile uint32_t head;
+	volatile uint32_t tail;
+	ece391_io_sqe_t entries[ECE391_IORING_ENTRIES];
+} ece391_io_sq_t;
+typedef struct {
+	volatile uint32_t head;
+	volatile uint32_t tail;
+	ece391_io_cqe_t entries[ECE391_IORING_ENTRIES];
+} ece391_io_cq_t;
+#define ECE391_IORING_CQ_OFFSET 4096
+extern int32_t ece391_ioring_setup (uint8_t** addr);
+extern int32_t ece391_ioring_enter (int32_t to_submit, int32_t min_complete);
+
+/*
+ * Bit i of mask lets the process (and the children it executes) run on the i-th
+ * cpu. Returns the old mask, limited to the cpus that are online, or -1.
+ */
+extern int32_t ece391_set_affinity (uint32_t mask);
+
+/* The same calls through sysenter/sysexit instead of int 0x80 */
+extern int32_t ece391_fast_read (int32_t fd, void* buf, int32_t nbytes);
+extern int32_t ece391_fast_write (int32_t fd, const void* buf, int32_t nbytes);
+extern int32_t ece391_fast_isatty (int32_t fd);
+extern int32_t ece391_fast_clock_gettime (int32_t clock_id, ece391_timespec_t* ts);
 
 enum signums {
 	DIV_ZERO = 0,
@@ -12,5 +12,17 @@
 #define SYS_SET_HANDLER  9
 #define SYS_SIGRETURN  10
 #define SYS_RUN  11
+#define SYS_SHM_CREATE  12
+#define SYS_SHM_ATTACH  13
+#define SYS_PIPE  14
+#define SYS_DUP2  15
+#define SYS_ISATTY  16
+#define SYS_NICE  17
+#define SYS_SLEEP  18
+#define SYS_CLOCK_GETTIME  19
+#define SYS_BATCH  20
+#define SYS_IORING_SETUP  21
+#define SYS_IORING_ENTER  22
+#define SYS_SET_AFFINITY  23
 
 #endif /* ECE391SYSNUM_H */
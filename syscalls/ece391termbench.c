@@ -0,0 +1,56 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define LINE_LEN    80      /* 79 characters and a newline */
+#define CHUNK       (25 * LINE_LEN)     /* a screen, about 2 KB */
+#define ROUNDS      200
+
+static uint8_t text[CHUNK];
+
+/* writes ROUNDS screens to stdout size bytes per write, returns bytes per second */
+static uint32_t
+run (uint32_t size)
+{
+    ece391_timespec_t start, end;
+    uint32_t round, done, ms;
+
+    ece391_now (&start);
+    for (round = 0; round < ROUNDS; round++) {
+        for (done = 0; done < CHUNK; done += size)
+            ece391_write (1, text + done, size);
+    }
+    ece391_now (&end);
+    ms = ece391_elapsed_us (&start, &end) / 1000;
+    if (ms == 0)
+        ms = 1;
+    return ROUNDS * CHUNK / ms * 1000;
+}
+
+/* print "<name>: <rate> bytes/s" */
+static void
+report (const char* name, uint32_t rate)
+{
+    ece391_fdputs (1, (uint8_t*)name);
+    ece391_put_num (": ", rate, " bytes/s\n");
+}
+
+/*
+ * Throughput of terminal_write.
+ * "termbench" prints ROUNDS screens of text a screen per write, then the same
+ * text a line per write, and reports bytes per second for both. Results are only
+ * printed once both are done so they don't scroll away.
+ */
+int main ()
+{
+    uint32_t i, screens, lines;
+
+    for (i = 0; i < CHUNK; i++)
+        text[i] = (i % LINE_LEN == LINE_LEN - 1) ? '\n' : 'a' + i % 26;
+    screens = run (CHUNK);
+    lines = run (LINE_LEN);
+    report ("screen writes", screens);
+    report ("line writes", lines);
+    return 0;
+}